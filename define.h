@@ -28,4 +28,7 @@
 #define BEGIN_NESTED_SCOPE do {
 #define END_NESTED_SCOPE } while(false);
 
+/// The cache line size used for padding.
+#define AVALON_CACHE_LINE 64
+
 #endif
@@ -0,0 +1,373 @@
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/clock.h"
+#include "../thread/metrics.h"
+#include "../thread/threadpool.h"
+#include "../thread/workpool.h"
+#include "speed_report.h"
+
+BOOST_AUTO_TEST_SUITE (executors)
+
+using namespace avalon::thread;
+
+namespace {
+
+/// A job function, with its argument.
+typedef void (*JobFunc)(void*);
+
+/// A countdown to wait for a known number of jobs.
+class Countdown
+{
+public:
+    explicit Countdown(size_t n) : remaining_(n), finished_(n == 0) {}
+    
+    void done()
+    {
+        // the waiter only returns after finished_ is set under the lock, so 
+        // the countdown is not destroyed before the last done() is over.
+        if (remaining_.fetch_sub(1) == 1) {
+            boost::mutex::scoped_lock locker(lock_);
+            finished_ = true;
+            cond_.notify_all();
+        }
+    }
+    
+    void wait()
+    {
+        boost::mutex::scoped_lock locker(lock_);
+        while (!finished_)
+            cond_.wait(locker);
+    }
+    
+private:
+    boost::atomic<size_t> remaining_;
+    bool finished_;
+    boost::mutex lock_;
+    boost::condition_variable cond_;
+};
+
+void count_down(void* arg)
+{
+    ((Countdown*)arg)->done();
+}
+
+void call_job(AsyncResult& ar, JobFunc func, void* arg)
+{
+    func(arg);
+}
+
+void nop_job(AsyncResult& ar)
+{
+}
+
+double seconds(Clock::duration d)
+{
+    return boost::chrono::duration_cast<boost::chrono::duration<double> >(d).count();
+}
+
+/// An executor under test.
+class Target
+{
+public:
+    virtual ~Target() {}
+    
+    /// Run func(arg) on a worker.
+    virtual void post(JobFunc func, void* arg) = 0;
+    
+    /// Run k empty jobs as one batch, and wait for all of them.
+    virtual void fan_out(size_t k) = 0;
+    
+    /// Run a chain of empty jobs, each started by the previous one.
+    virtual void chain(size_t length) = 0;
+    
+    /// Stop the workers.
+    virtual void stop() = 0;
+};
+
+/// A bare io_service with worker threads, the baseline.
+class RawTarget : public Target
+{
+public:
+    explicit RawTarget(int workers)
+     :  work_(new boost::asio::io_service::work(service_))
+    {
+        for (int i=0; i<workers; i++) {
+            threads_.create_thread(boost::bind(&boost::asio::io_service::run, &service_));
+        }
+    }
+    
+    virtual void post(JobFunc func, void* arg)
+    {
+        service_.post(boost::bind(func, arg));
+    }
+    
+    virtual void fan_out(size_t k)
+    {
+        Countdown countdown(k);
+        for (size_t i=0; i<k; i++) {
+            service_.post(boost::bind(count_down, &countdown));
+        }
+        countdown.wait();
+    }
+    
+    virtual void chain(size_t length)
+    {
+        Countdown countdown(1);
+        service_.post(boost::bind(&RawTarget::link, this, length, &countdown));
+        countdown.wait();
+    }
+    
+    virtual void stop()
+    {
+        work_.reset();
+        threads_.join_all();
+    }
+    
+private:
+    void link(size_t left, Countdown* countdown)
+    {
+        if (left <= 1)
+            countdown->done();
+        else
+            service_.post(boost::bind(&RawTarget::link, this, left - 1, countdown));
+    }
+    
+    boost::asio::io_service service_;
+    boost::shared_ptr<boost::asio::io_service::work> work_;
+    boost::thread_group threads_;
+};
+
+/// An Executor of this library.
+class ExecutorTarget : public Target
+{
+public:
+    ExecutorTarget(Executor* executor, const boost::function<void()>& stopper)
+     :  executor_(executor), stopper_(stopper)
+    {
+    }
+    
+    virtual void post(JobFunc func, void* arg)
+    {
+        AsyncResultPtr ar(new AsyncResult(boost::bind(call_job, _1, func, arg)));
+        while (executor_->try_submit(ar) != Executor::SUBMIT_OK)
+            boost::this_thread::yield();
+    }
+    
+    virtual void fan_out(size_t k)
+    {
+        std::vector<AsyncResultPtr> jobs;
+        jobs.reserve(k);
+        for (size_t i=0; i<k; i++) {
+            jobs.push_back(AsyncResultPtr(new AsyncResult(nop_job)));
+        }
+        executor_->submit_bulk(jobs)->wait();
+    }
+    
+    virtual void chain(size_t length)
+    {
+        AsyncResultPtr first(new AsyncResult(nop_job));
+        AsyncResultPtr last = first;
+        for (size_t i=1; i<length; i++) {
+            last = last->then(*executor_, nop_job);
+        }
+        executor_->submit(first);
+        last->wait();
+    }
+    
+    virtual void stop()
+    {
+        stopper_();
+    }
+    
+private:
+    boost::shared_ptr<Executor> executor_;
+    boost::function<void()> stopper_;
+};
+
+void stop_threadpool(ThreadPool* pool)
+{
+    pool->stop();
+}
+
+/// The executor names.
+const char* TARGETS[] = {
+    "io_service", "WorkPool", "LockFreeWorkPool", "ThreadPool", "ThreadPool-WS"
+};
+const size_t TARGET_COUNT = 5;
+
+/// Create an executor by name.
+Target* make_target(const std::string& name, int workers)
+{
+    if (name == "io_service")
+        return new RawTarget(workers);
+    if (name == "WorkPool") {
+        WorkPool* pool = new WorkPool(workers);
+        return new ExecutorTarget(pool, boost::bind(&WorkPool::stop, pool));
+    }
+    if (name == "LockFreeWorkPool") {
+        LockFreeWorkPool* pool = new LockFreeWorkPool(workers, 65536);
+        return new ExecutorTarget(pool, boost::bind(&LockFreeWorkPool::stop, pool));
+    }
+    ThreadPool* pool = new ThreadPool(workers, 0, name == "ThreadPool" ? 
+                                      ThreadPool::SHARED_QUEUE : ThreadPool::WORK_STEALING);
+    pool->run();
+    return new ExecutorTarget(pool, boost::bind(stop_threadpool, pool));
+}
+
+void produce(Target* target, size_t n, Countdown* countdown)
+{
+    for (size_t i=0; i<n; i++) {
+        target->post(count_down, countdown);
+    }
+}
+
+/// A job of the open-loop test, stamping its own latency.
+struct LatencyJob
+{
+    /// When the job should have been submitted.
+    Clock::time_point intended;
+    
+    /// From the intended submission to the end of the job.
+    Clock::duration latency;
+    
+    /// Counted down when done.
+    Countdown* countdown;
+};
+
+void latency_job(void* arg)
+{
+    LatencyJob* job = (LatencyJob*)arg;
+    job->latency = Clock::now() - job->intended;
+    job->countdown->done();
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE( submit_throughput )
+{
+    size_t total = speed_scale(200000);
+    int counts[] = {1, 2, 4};
+    for (size_t t=0; t<TARGET_COUNT; t++) {
+        for (int w=0; w<3; w++) {
+            for (int p=0; p<3; p++) {
+                int producers = counts[p], workers = counts[w];
+                boost::shared_ptr<Target> target(make_target(TARGETS[t], workers));
+                size_t each = total / producers;
+                Countdown countdown(each * producers);
+                
+                Clock::time_point start = Clock::now();
+                boost::thread_group threads;
+                for (int i=0; i<producers; i++) {
+                    threads.create_thread(boost::bind(produce, target.get(), each, &countdown));
+                }
+                threads.join_all();
+                Clock::duration submitted = Clock::now() - start;
+                countdown.wait();
+                Clock::duration elapsed = Clock::now() - start;
+                target->stop();
+                
+                SpeedReport& report = SpeedReport::instance();
+                report.add("submit_throughput", TARGETS[t], producers, workers, "submit_rate",
+                           each * producers / seconds(submitted), "jobs/s");
+                report.add("submit_throughput", TARGETS[t], producers, workers, "throughput",
+                           each * producers / seconds(elapsed), "jobs/s");
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( open_loop_latency )
+{
+    // Jobs are sent on a fixed schedule, and latency counts from the 
+    // scheduled time, so a stalled sender does not hide queueing delay.
+    const size_t rate = 10000;
+    size_t n = speed_scale(5000);
+    Clock::duration period = boost::chrono::nanoseconds(1000000000 / rate);
+    for (size_t t=0; t<TARGET_COUNT; t++) {
+        boost::shared_ptr<Target> target(make_target(TARGETS[t], 2));
+        Countdown countdown(n);
+        std::vector<LatencyJob> jobs(n);
+        Clock::time_point start = Clock::now();
+        for (size_t i=0; i<n; i++) {
+            jobs[i].intended = start + period * i;
+            jobs[i].countdown = &countdown;
+            boost::this_thread::sleep_until(jobs[i].intended);
+            target->post(latency_job, &jobs[i]);
+        }
+        countdown.wait();
+        target->stop();
+        
+        LatencyHistogram histogram;
+        for (size_t i=0; i<n; i++) {
+            histogram.record(boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+                jobs[i].latency).count());
+        }
+        HistogramSnapshot snapshot;
+        histogram.add_to(snapshot);
+        SpeedReport& report = SpeedReport::instance();
+        report.add("open_loop_latency", TARGETS[t], 1, 2, "p50", snapshot.percentile(0.5) / 1e3, "us");
+        report.add("open_loop_latency", TARGETS[t], 1, 2, "p99", snapshot.percentile(0.99) / 1e3, "us");
+        report.add("open_loop_latency", TARGETS[t], 1, 2, "p999", snapshot.percentile(0.999) / 1e3, "us");
+        report.add("open_loop_latency", TARGETS[t], 1, 2, "max", snapshot.max() / 1e3, "us");
+    }
+}
+
+BOOST_AUTO_TEST_CASE( fan_out )
+{
+    const size_t width = 64;
+    size_t rounds = speed_scale(500);
+    for (size_t t=0; t<TARGET_COUNT; t++) {
+        boost::shared_ptr<Target> target(make_target(TARGETS[t], 2));
+        Clock::time_point start = Clock::now();
+        for (size_t i=0; i<rounds; i++) {
+            target->fan_out(width);
+        }
+        double elapsed = seconds(Clock::now() - start);
+        target->stop();
+        SpeedReport::instance().add("fan_out_64", TARGETS[t], 1, 2, "round", 
+                                    elapsed / rounds * 1e6, "us");
+    }
+}
+
+BOOST_AUTO_TEST_CASE( continuation_chain )
+{
+    const size_t length = 1000;
+    size_t rounds = speed_scale(20);
+    for (size_t t=0; t<TARGET_COUNT; t++) {
+        boost::shared_ptr<Target> target(make_target(TARGETS[t], 2));
+        Clock::time_point start = Clock::now();
+        for (size_t i=0; i<rounds; i++) {
+            target->chain(length);
+        }
+        double elapsed = seconds(Clock::now() - start);
+        target->stop();
+        SpeedReport::instance().add("continuation_chain", TARGETS[t], 1, 2, "link", 
+                                    elapsed / (rounds * length) * 1e9, "ns");
+    }
+    
+    // inline continuations run on the finishing thread, without a queue.
+    Clock::time_point start = Clock::now();
+    for (size_t i=0; i<rounds; i++) {
+        AsyncResultPtr first(new AsyncResult(nop_job));
+        AsyncResultPtr last = first;
+        for (size_t j=1; j<length; j++) {
+            last = last->then(nop_job);
+        }
+        first->execute();
+        BOOST_CHECK( last->status() == AsyncResult::SUCCESS );
+    }
+    double elapsed = seconds(Clock::now() - start);
+    SpeedReport::instance().add("continuation_chain", "inline", 1, 0, "link", 
+                                elapsed / (rounds * length) * 1e9, "ns");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,80 @@
+#include <boost/test/unit_test.hpp>
+
+#include "speed_report.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <boost/foreach.hpp>
+
+namespace {
+    /// Quote a string for CSV and JSON. Names here have no special characters.
+    std::string quote(const std::string& s)
+    {
+        return "\"" + s + "\"";
+    }
+    
+    /// Write the report when the tests are done.
+    struct WriteReport
+    {
+        ~WriteReport()
+        {
+            SpeedReport::instance().write();
+        }
+    };
+}
+
+BOOST_GLOBAL_FIXTURE( WriteReport );
+
+SpeedReport& SpeedReport::instance()
+{
+    static SpeedReport report;
+    return report;
+}
+
+void SpeedReport::add(const std::string& benchmark, const std::string& executor, 
+                      int producers, int workers, 
+                      const std::string& metric, double value, const std::string& unit)
+{
+    Row row = { benchmark, executor, producers, workers, metric, value, unit };
+    rows_.push_back(row);
+    printf ("%-20s %-16s p=%-2d w=%-2d %-12s %14.3f %s\n", benchmark.c_str(), executor.c_str(), 
+            producers, workers, metric.c_str(), value, unit.c_str());
+    fflush(stdout);
+}
+
+void SpeedReport::write() const
+{
+    const char* env = getenv("AVALON_SPEED_OUTPUT");
+    std::string path = env && *env ? env : "speed_results";
+    
+    std::ofstream csv((path + ".csv").c_str());
+    csv << "benchmark,executor,producers,workers,metric,value,unit\n";
+    BOOST_FOREACH(const Row& row, rows_) {
+        csv << row.benchmark << ',' << row.executor << ',' << row.producers << ',' 
+            << row.workers << ',' << row.metric << ',' << row.value << ',' << row.unit << '\n';
+    }
+    
+    std::ofstream json((path + ".json").c_str());
+    json << "[";
+    for (size_t i=0; i<rows_.size(); i++) {
+        const Row& row = rows_[i];
+        json << (i ? ",\n " : "\n ") << "{\"benchmark\":" << quote(row.benchmark) 
+             << ",\"executor\":" << quote(row.executor) 
+             << ",\"producers\":" << row.producers << ",\"workers\":" << row.workers 
+             << ",\"metric\":" << quote(row.metric) << ",\"value\":" << row.value 
+             << ",\"unit\":" << quote(row.unit) << "}";
+    }
+    json << "\n]\n";
+    printf ("Results written to %s.csv and %s.json\n", path.c_str(), path.c_str());
+}
+
+size_t speed_scale(size_t n)
+{
+    const char* env = getenv("AVALON_SPEED_SCALE");
+    double scale = env ? atof(env) : 1.0;
+    if (scale <= 0)
+        scale = 1.0;
+    size_t ret = (size_t)(n * scale);
+    return ret ? ret : 1;
+}
@@ -0,0 +1,47 @@
+#ifndef TEST_SPEED_REPORT_H
+#define TEST_SPEED_REPORT_H
+
+#include <string>
+#include <vector>
+
+/// The results of the speed tests, written as CSV and JSON on exit.
+/**
+ * Each result is one row, so that two runs can be compared line by line. 
+ * The files are named by AVALON_SPEED_OUTPUT (default "speed_results"), 
+ * with ".csv" and ".json" appended.
+ */
+class SpeedReport
+{
+public:
+    /// One measured value.
+    struct Row
+    {
+        std::string benchmark;
+        std::string executor;
+        int producers;
+        int workers;
+        std::string metric;
+        double value;
+        std::string unit;
+    };
+    
+    /// The report of the process.
+    static SpeedReport& instance();
+    
+    /// Add a result, and print it.
+    void add(const std::string& benchmark, const std::string& executor, 
+             int producers, int workers, 
+             const std::string& metric, double value, const std::string& unit);
+    
+    /// Write the CSV and JSON files.
+    void write() const;
+    
+private:
+    /// The results.
+    std::vector<Row> rows_;
+};
+
+/// Scale an iteration count by AVALON_SPEED_SCALE (default 1).
+size_t speed_scale(size_t n);
+
+#endif // TEST_SPEED_REPORT_H
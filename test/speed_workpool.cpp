@@ -10,6 +10,7 @@
 #include "../thread/asyncresult.h"
 #include "../thread/workpool.h"
 #include "../errors.h"
+#include "speed_report.h"
 
 BOOST_AUTO_TEST_SUITE (workpool)
 
@@ -18,18 +19,20 @@ using namespace avalon;
 
 void dummy(AsyncResult&) {}
 
-BOOST_AUTO_TEST_CASE( mutex )
+BOOST_AUTO_TEST_CASE( status )
 {
     {
         AsyncResult ar(dummy);
         boost::timer timer;
-        printf ("Testing AsyncResult::Lock speed in one thread ... ");
+        printf ("Testing AsyncResult::status speed in one thread ... ");
         
         int loop = 10000000;
         for (int i=0; i<loop; i++) {
             AsyncResult::Status status = ar.status();
         }
-        printf ("%lfs.", timer.elapsed() );
+        printf ("%lfs.\n", timer.elapsed() );
+        SpeedReport::instance().add("status", "AsyncResult", 1, 0, "call", 
+                                    timer.elapsed() / loop * 1e9, "ns");
     }
 }
 
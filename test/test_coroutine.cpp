@@ -0,0 +1,155 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <stdexcept>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/coroutine.h"
+#include "../thread/errors.h"
+#include "../thread/stackpool.h"
+#include "../thread/threadpool.h"
+
+BOOST_AUTO_TEST_SUITE (coroutine)
+
+using namespace avalon::thread;
+
+void add_one(AsyncResult& ar, boost::atomic<int>& counter)
+{
+    counter.fetch_add(1);
+}
+
+void noop_job(AsyncResult& ar)
+{
+}
+
+/// Await jobs of the pool the coroutine runs on.
+void fan_out(AsyncResult& ar, ThreadPool& pool, boost::atomic<int>& counter, bool& inside)
+{
+    for (int i=0; i<10; i++) {
+        AsyncResultPtr child = pool.submit(boost::bind(add_one, _1, boost::ref(counter)),
+                                           AsyncResult::Callback());
+        Coroutine::await(child);
+        Coroutine::yield();
+    }
+    inside = Coroutine::current() != NULL && AsyncResult::current() == &ar;
+}
+
+void await_gate(AsyncResult& ar, AsyncResultPtr gate, boost::atomic<int>& counter)
+{
+    Coroutine::await(gate);
+    counter.fetch_add(1);
+}
+
+void throw_error(AsyncResult& ar)
+{
+    Coroutine::yield();
+    throw std::runtime_error("coroutine");
+}
+
+BOOST_AUTO_TEST_CASE( suspend )
+{
+    // one worker would deadlock if the coroutine blocked it.
+    ThreadPool pool(1, 0);
+    pool.run();
+    boost::atomic<int> counter(0);
+    bool inside = false;
+    AsyncResultPtr handle = Coroutine::spawn(pool, boost::bind(
+        fan_out, _1, boost::ref(pool), boost::ref(counter), boost::ref(inside)));
+    BOOST_REQUIRE( handle->wait(5000) );
+    BOOST_CHECK( handle->status() == AsyncResult::SUCCESS );
+    BOOST_CHECK_EQUAL( counter.load(), 10 );
+    BOOST_CHECK( inside );
+    BOOST_CHECK( Coroutine::current() == NULL );
+    
+    // an exception finishes the handle with ERROR.
+    handle = Coroutine::spawn(pool, throw_error);
+    BOOST_REQUIRE( handle->wait(5000) );
+    BOOST_CHECK( handle->status() == AsyncResult::ERROR );
+    
+    // outside a coroutine, await blocks.
+    AsyncResultPtr job = pool.submit(noop_job, AsyncResult::Callback());
+    Coroutine::await(job);
+    BOOST_CHECK( job->done() );
+}
+
+BOOST_AUTO_TEST_CASE( many_suspended )
+{
+    const int COUNT = 1000;
+    StackPool stacks(StackPool::DEFAULT_STACK_SIZE, 16);
+    ThreadPool pool(2, 0);
+    pool.run();
+    boost::atomic<int> counter(0);
+    AsyncResultPtr gate(new AsyncResult(noop_job));
+    std::vector<AsyncResultPtr> handles;
+    for (int i=0; i<COUNT; i++) {
+        handles.push_back(Coroutine::spawn(pool, boost::bind(
+            await_gate, _1, gate, boost::ref(counter)), stacks));
+    }
+    
+    // all coroutines are suspended on their own stacks, no worker is blocked.
+    BOOST_REQUIRE( pool.wait_idle(5000) );
+    BOOST_CHECK_EQUAL( stacks.in_use(), (size_t)COUNT );
+    BOOST_CHECK_EQUAL( counter.load(), 0 );
+    
+    gate->execute();
+    for (int i=0; i<COUNT; i++) {
+        BOOST_REQUIRE( handles[i]->wait(5000) );
+        BOOST_CHECK( handles[i]->status() == AsyncResult::SUCCESS );
+    }
+    BOOST_REQUIRE( pool.wait_idle(5000) );
+    BOOST_CHECK_EQUAL( counter.load(), COUNT );
+    BOOST_CHECK_EQUAL( stacks.in_use(), (size_t)0 );
+    BOOST_CHECK_EQUAL( stacks.cached(), (size_t)16 );
+}
+
+BOOST_AUTO_TEST_CASE( cancelled )
+{
+    ThreadPool pool(1, 0);
+    pool.run();
+    boost::atomic<int> counter(0);
+    AsyncResultPtr gate(new AsyncResult(noop_job));
+    
+    // a cancelled coroutine unwinds when it resumes.
+    AsyncResultPtr handle = Coroutine::spawn(pool, boost::bind(
+        await_gate, _1, gate, boost::ref(counter)));
+    BOOST_REQUIRE( pool.wait_idle(5000) );
+    BOOST_CHECK( !handle->cancel() );
+    BOOST_CHECK( gate->cancel() );
+    BOOST_REQUIRE( handle->wait(5000) );
+    BOOST_CHECK( handle->status() == AsyncResult::CANCELLED );
+    BOOST_CHECK_EQUAL( counter.load(), 0 );
+    
+    // a dropped slice cancels the coroutine.
+    ThreadPool stopped(1, 0);
+    handle = Coroutine::spawn(stopped, noop_job);
+    stopped.cancel_all();
+    BOOST_CHECK( handle->status() == AsyncResult::CANCELLED );
+}
+
+BOOST_AUTO_TEST_CASE( stack_pool )
+{
+    StackPool stacks(1000, 1);
+    BOOST_CHECK( stacks.stack_size() >= 1000 );
+    BOOST_CHECK_EQUAL( stacks.stack_size() % 4096, (size_t)0 );
+    
+    // a released stack is reused, with its pages given back.
+    StackPool::Stack first = stacks.allocate();
+    BOOST_CHECK_EQUAL( stacks.in_use(), (size_t)1 );
+    ((char*)first.top())[-1] = 1;
+    stacks.release(first);
+    BOOST_CHECK_EQUAL( stacks.cached(), (size_t)1 );
+    StackPool::Stack second = stacks.allocate();
+    BOOST_CHECK( second.base == first.base );
+    BOOST_CHECK_EQUAL( ((char*)second.top())[-1], 0 );
+    
+    // beyond the cache limit stacks are unmapped.
+    StackPool::Stack third = stacks.allocate();
+    stacks.release(second);
+    stacks.release(third);
+    BOOST_CHECK_EQUAL( stacks.cached(), (size_t)1 );
+    BOOST_CHECK_EQUAL( stacks.in_use(), (size_t)0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,138 @@
+#include <boost/test/unit_test.hpp>
+
+#include <stdexcept>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/metrics.h"
+#include "../thread/threadpool.h"
+#include "../thread/workpool.h"
+
+BOOST_AUTO_TEST_SUITE (metrics)
+
+using namespace avalon::thread;
+
+void sleep_job(AsyncResult& ar, size_t milliseconds)
+{
+    boost::this_thread::sleep(boost::posix_time::milliseconds(milliseconds));
+}
+
+void fail_job(AsyncResult& ar)
+{
+    throw std::runtime_error("fail");
+}
+
+BOOST_AUTO_TEST_CASE( histogram )
+{
+    // small values are exact, larger ones within 1/8.
+    BOOST_CHECK_EQUAL( LatencyHistogram::bucket_of(5), 5u );
+    BOOST_CHECK_EQUAL( LatencyHistogram::bucket_high(5), 5u );
+    boost::uint64_t values[] = {8, 9, 100, 1000, 123456789, ~(boost::uint64_t)0};
+    for (size_t i=0; i<6; i++) {
+        size_t bucket = LatencyHistogram::bucket_of(values[i]);
+        BOOST_REQUIRE( bucket < LatencyHistogram::BUCKET_COUNT );
+        boost::uint64_t high = LatencyHistogram::bucket_high(bucket);
+        BOOST_CHECK( high >= values[i] );
+        BOOST_CHECK( high - values[i] <= values[i] / 8 );
+        if (bucket)
+            BOOST_CHECK( LatencyHistogram::bucket_high(bucket - 1) < values[i] );
+    }
+    
+    LatencyHistogram histogram;
+    for (boost::uint64_t v=1; v<=1000; v++) {
+        histogram.record(v);
+    }
+    HistogramSnapshot snapshot;
+    histogram.add_to(snapshot);
+    BOOST_CHECK_EQUAL( snapshot.count(), 1000u );
+    BOOST_CHECK( snapshot.percentile(0.5) >= 500 && snapshot.percentile(0.5) <= 500 + 500 / 8 );
+    BOOST_CHECK( snapshot.percentile(0.99) >= 990 );
+    BOOST_CHECK( snapshot.max() >= 1000 && snapshot.max() <= 1000 + 1000 / 8 );
+    BOOST_CHECK_EQUAL( HistogramSnapshot().percentile(0.5), 0u );
+    
+    snapshot.merge(snapshot);
+    BOOST_CHECK_EQUAL( snapshot.count(), 2000u );
+}
+
+BOOST_AUTO_TEST_CASE( pool_metrics )
+{
+    ThreadPool pool(1, 0);
+    pool.set_timing(true);
+    pool.run();
+    
+    // the first job holds the worker, so the others are queued.
+    std::vector<AsyncResultPtr> jobs;
+    jobs.push_back(pool.submit(boost::bind(sleep_job, _1, 20), AsyncResult::Callback()));
+    for (int i=0; i<9; i++) {
+        jobs.push_back(pool.submit(boost::bind(sleep_job, _1, 1), AsyncResult::Callback()));
+    }
+    AsyncResultPtr failed = pool.submit(fail_job, AsyncResult::Callback());
+    AsyncResultPtr cancelled = pool.submit(fail_job, AsyncResult::Callback());
+    cancelled->cancel();
+    // the cancelled job is still dequeued, before this one.
+    jobs.push_back(pool.submit(boost::bind(sleep_job, _1, 0), AsyncResult::Callback()));
+    MetricsSnapshot busy = pool.metrics();
+    BOOST_CHECK_EQUAL( busy.jobs, 12u );
+    BOOST_CHECK( busy.queued >= 11u );
+    
+    for (size_t i=0; i<jobs.size(); i++) {
+        BOOST_CHECK( jobs[i]->wait(5000) );
+    }
+    BOOST_CHECK( failed->wait(5000) );
+    MetricsSnapshot running = pool.metrics();
+    BOOST_CHECK_EQUAL( running.workers.size(), 1u );
+    BOOST_CHECK( running.total.active );
+    BOOST_CHECK( running.total.utilisation > 0 );
+    
+    // stopped workers have recorded everything.
+    pool.stop();
+    MetricsSnapshot stopped = pool.metrics();
+    const WorkerSnapshot& total = stopped.total;
+    BOOST_CHECK( !total.active );
+    BOOST_CHECK_EQUAL( stopped.jobs, 0u );
+    BOOST_CHECK_EQUAL( stopped.queued, 0u );
+    BOOST_CHECK_EQUAL( total.outcomes[AsyncResult::SUCCESS], 11u );
+    BOOST_CHECK_EQUAL( total.outcomes[AsyncResult::ERROR], 1u );
+    BOOST_CHECK_EQUAL( total.outcomes[AsyncResult::CANCELLED], 1u );
+    BOOST_CHECK_EQUAL( total.executed(), 13u );
+    BOOST_CHECK_EQUAL( total.run_latency.count(), 13u );
+    BOOST_CHECK_EQUAL( total.wait_latency.count(), 13u );
+    BOOST_CHECK( total.busy >= boost::chrono::milliseconds(29) );
+    BOOST_CHECK( total.run_latency.max() >= 20000000u );
+    
+    // the load counters are taken from the same records.
+    ThreadPool::LoadStats stats = pool.take_load_stats();
+    BOOST_CHECK_EQUAL( stats.executed, 13u );
+    BOOST_CHECK( stats.busy_time == total.busy );
+    BOOST_CHECK_EQUAL( pool.take_load_stats().executed, 0u );
+}
+
+BOOST_AUTO_TEST_CASE( workpool_metrics )
+{
+    LockFreeWorkPool ring(1, 16);
+    WorkPool pool(1);
+    pool.set_timing(true);
+    for (int i=0; i<5; i++) {
+        ring.submit(boost::bind(sleep_job, _1, 0), AsyncResult::Callback());
+        pool.submit(boost::bind(sleep_job, _1, 0), AsyncResult::Callback());
+    }
+    ring.submit(fail_job, AsyncResult::Callback())->wait(5000);
+    pool.submit(fail_job, AsyncResult::Callback())->wait(5000);
+    ring.stop();
+    pool.stop();
+    
+    MetricsSnapshot a = ring.metrics();
+    BOOST_CHECK_EQUAL( a.total.outcomes[AsyncResult::SUCCESS], 5u );
+    BOOST_CHECK_EQUAL( a.total.outcomes[AsyncResult::ERROR], 1u );
+    BOOST_CHECK_EQUAL( a.total.run_latency.count(), 0u );
+    
+    MetricsSnapshot b = pool.metrics();
+    BOOST_CHECK_EQUAL( b.jobs, 0u );
+    BOOST_CHECK_EQUAL( b.total.outcomes[AsyncResult::SUCCESS], 5u );
+    BOOST_CHECK_EQUAL( b.total.outcomes[AsyncResult::ERROR], 1u );
+    BOOST_CHECK_EQUAL( b.total.run_latency.count(), 6u );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,138 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/errors.h"
+#include "../thread/shardedexecutor.h"
+
+BOOST_AUTO_TEST_SUITE (sharded)
+
+using namespace avalon::thread;
+using namespace avalon;
+
+/// The state of a key, only touched by its shard.
+struct KeyState
+{
+    size_t shard;
+    int next;
+    bool ordered;
+};
+
+void key_job(AsyncResult& ar, ShardedExecutor& executor, KeyState& state, int index)
+{
+    if (executor.current_shard() != state.shard || state.next++ != index)
+        state.ordered = false;
+}
+
+void noop_job(AsyncResult& ar)
+{
+}
+
+void gate_job(AsyncResult& ar, boost::mutex& gate)
+{
+    boost::mutex::scoped_lock locker(gate);
+}
+
+BOOST_AUTO_TEST_CASE( affinity )
+{
+    const size_t KEYS = 32, JOBS = 50;
+    ShardedExecutor executor(4);
+    BOOST_CHECK( executor.current_shard() == executor.shard_count() );
+    BOOST_CHECK_THROW( ShardedExecutor(0), AvalonInvalidArgument );
+    
+    std::vector<KeyState> states(KEYS);
+    std::vector<AsyncResultPtr> last(KEYS);
+    std::vector<bool> used(executor.shard_count(), false);
+    for (size_t k=0; k<KEYS; k++) {
+        states[k].shard = executor.shard_of(k);
+        states[k].next = 0;
+        states[k].ordered = true;
+        used[states[k].shard] = true;
+    }
+    BOOST_CHECK( std::count(used.begin(), used.end(), true) > 1 );
+    
+    for (size_t j=0; j<JOBS; j++) {
+        for (size_t k=0; k<KEYS; k++) {
+            last[k] = executor.submit(boost::bind(key_job, _1, boost::ref(executor), 
+                                                  boost::ref(states[k]), (int)j),
+                                      AsyncResult::Callback(), k);
+        }
+    }
+    size_t executed = 0;
+    for (size_t k=0; k<KEYS; k++) {
+        BOOST_REQUIRE( last[k]->wait(5000) );
+        BOOST_CHECK( states[k].ordered );
+        BOOST_CHECK_EQUAL( states[k].next, (int)JOBS );
+    }
+    std::vector<ShardedExecutor::ShardStats> stats = executor.shard_stats();
+    for (size_t i=0; i<stats.size(); i++) {
+        executed += stats[i].executed;
+        BOOST_CHECK( stats[i].donated == 0 );
+    }
+    // the counter of a job lags behind its waiters.
+    BOOST_CHECK( executed <= KEYS * JOBS && executed + KEYS >= KEYS * JOBS );
+}
+
+BOOST_AUTO_TEST_CASE( depth )
+{
+    // a blocked shard fills up, and reports its depth.
+    ShardedExecutor executor(2, 2);
+    size_t shard = executor.shard_of(7);
+    boost::mutex gate;
+    boost::mutex::scoped_lock locker(gate);
+    AsyncResultPtr blocker = executor.submit(boost::bind(gate_job, _1, boost::ref(gate)),
+                                             AsyncResult::Callback(), 7);
+    while (executor.depth(shard) != 0) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    AsyncResultPtr first = executor.submit(boost::bind(gate_job, _1, boost::ref(gate)),
+                                           AsyncResult::Callback(), 7);
+    executor.submit(AsyncResultPtr(new AsyncResult(noop_job)), 7);
+    AsyncResultPtr rejected(new AsyncResult(noop_job));
+    BOOST_CHECK( executor.try_submit(rejected, 7) == Executor::SUBMIT_FULL );
+    BOOST_CHECK( executor.depth(shard) == 2 );
+    BOOST_CHECK( executor.shard_stats()[shard].depth == 2 );
+    
+    // the job left in a stopped executor is cancelled.
+    locker.unlock();
+    BOOST_CHECK( first->wait(5000) );
+    executor.stop();
+    BOOST_CHECK( executor.depth(shard) == 0 );
+    BOOST_CHECK( rejected->status() == AsyncResult::WAIT );
+    
+    // a stopped executor rejects new jobs instead of stranding them.
+    BOOST_CHECK( executor.try_submit(rejected, 0) == Executor::SUBMIT_FULL );
+    BOOST_CHECK( executor.try_submit(rejected) == Executor::SUBMIT_FULL );
+    BOOST_CHECK( rejected->status() == AsyncResult::WAIT );
+}
+
+BOOST_AUTO_TEST_CASE( donation )
+{
+    // a hot key gives its backlog to the idle shard.
+    ShardedExecutor executor(2, 0, true);
+    boost::mutex gate;
+    boost::mutex::scoped_lock locker(gate);
+    std::vector<AsyncResultPtr> jobs;
+    jobs.push_back(executor.submit(boost::bind(gate_job, _1, boost::ref(gate)),
+                                   AsyncResult::Callback(), 3));
+    for (int i=0; i<20; i++) {
+        jobs.push_back(executor.submit(AsyncResultPtr(new AsyncResult(noop_job)), 3));
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    locker.unlock();
+    for (size_t i=0; i<jobs.size(); i++) {
+        BOOST_CHECK( jobs[i]->wait(5000) );
+    }
+    
+    std::vector<ShardedExecutor::ShardStats> stats = executor.shard_stats();
+    size_t shard = executor.shard_of(3);
+    BOOST_CHECK( stats[shard].donated > 0 );
+    BOOST_CHECK( stats[1 - shard].executed > 0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/errors.h"
+#include "../thread/strand.h"
+#include "../thread/threadpool.h"
+#include "../thread/workpool.h"
+
+BOOST_AUTO_TEST_SUITE (strand)
+
+using namespace avalon::thread;
+
+/// The state of a session, touched by its jobs without a lock.
+struct Session
+{
+    Strand::Ptr strand;
+    boost::atomic<int> inside;
+    int next;
+    bool ordered;
+};
+
+void session_job(AsyncResult& ar, Session& session, int index)
+{
+    if (session.inside.fetch_add(1) != 0 || !session.strand->running_in_this_thread())
+        session.ordered = false;
+    if (session.next++ != index)
+        session.ordered = false;
+    boost::this_thread::yield();
+    session.inside.fetch_sub(1);
+}
+
+void open_session(Session& session, Executor& executor)
+{
+    session.strand = Strand::create(executor);
+    session.inside.store(0);
+    session.next = 0;
+    session.ordered = true;
+}
+
+void run_sessions(Executor& executor)
+{
+    const size_t SESSIONS = 200, JOBS = 100;
+    std::vector<Session> sessions(SESSIONS);
+    std::vector<AsyncResultPtr> last(SESSIONS);
+    for (size_t i=0; i<SESSIONS; i++) {
+        open_session(sessions[i], executor);
+    }
+    
+    // jobs of many sessions are interleaved on the pool.
+    for (size_t j=0; j<JOBS; j++) {
+        for (size_t i=0; i<SESSIONS; i++) {
+            AsyncResultPtr ar(new AsyncResult(
+                boost::bind(session_job, _1, boost::ref(sessions[i]), (int)j)));
+            last[i] = sessions[i].strand->submit(ar);
+        }
+    }
+    for (size_t i=0; i<SESSIONS; i++) {
+        BOOST_REQUIRE( last[i]->wait(5000) );
+        BOOST_CHECK( sessions[i].ordered );
+        BOOST_CHECK_EQUAL( sessions[i].next, (int)JOBS );
+        BOOST_CHECK( !sessions[i].strand->running_in_this_thread() );
+    }
+}
+
+BOOST_AUTO_TEST_CASE( serial )
+{
+    ThreadPool pool(4, 0);
+    pool.run();
+    run_sessions(pool);
+    
+    LockFreeWorkPool workpool(4, 1 << 16);
+    run_sessions(workpool);
+}
+
+BOOST_AUTO_TEST_CASE( rejected )
+{
+    Session session;
+    ThreadPool pool(1, 1);
+    open_session(session, pool);
+    
+    // a full pool rejects the turn, and the job is left untouched.
+    AsyncResultPtr filler = pool.submit(AsyncResultPtr(new AsyncResult(AsyncResult::Task())));
+    AsyncResultPtr job(new AsyncResult(boost::bind(session_job, _1, boost::ref(session), 0)));
+    BOOST_CHECK( session.strand->try_submit(job) == Executor::SUBMIT_FULL );
+    BOOST_CHECK( job->status() == AsyncResult::WAIT );
+    BOOST_CHECK_THROW( session.strand->submit(job), AvalonThreadPoolIsFull );
+    
+    // a dropped turn cancels the queued jobs, and the strand recovers.
+    pool.cancel_all();
+    BOOST_CHECK( filler->status() == AsyncResult::CANCELLED );
+    AsyncResultPtr dropped(new AsyncResult(boost::bind(session_job, _1, boost::ref(session), 0)));
+    session.strand->submit(dropped);
+    pool.cancel_all();
+    BOOST_CHECK( dropped->status() == AsyncResult::CANCELLED );
+    
+    session.strand->submit(job);
+    pool.run();
+    BOOST_CHECK( job->wait(5000) );
+    BOOST_CHECK( job->status() == AsyncResult::SUCCESS );
+    BOOST_CHECK( session.ordered );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
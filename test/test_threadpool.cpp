@@ -0,0 +1,677 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/autoscaler.h"
+#include "../thread/threadpool.h"
+#include "../thread/combinators.h"
+#include "../thread/parallel.h"
+#include "../thread/slotmap.h"
+#include "../thread/taskgroup.h"
+#include "../thread/errors.h"
+#include "../errors.h"
+
+BOOST_AUTO_TEST_SUITE (threadpool)
+
+using namespace avalon::thread;
+using namespace avalon;
+
+void count_job(AsyncResult& ar, boost::atomic<int>& counter)
+{
+    counter.fetch_add(1);
+}
+
+void spawn_job(AsyncResult& ar, ThreadPool& pool, boost::atomic<int>& counter,
+               std::vector<AsyncResultPtr>& children)
+{
+    // children are pushed into the worker's own deque.
+    for (size_t i=0; i<children.size(); i++) {
+        children[i] = pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                  AsyncResult::Callback());
+    }
+}
+
+void run_pool(ThreadPool::Mode mode)
+{
+    ThreadPool pool(4, 0, mode);
+    pool.run();
+
+    boost::atomic<int> counter(0);
+    std::vector<AsyncResultPtr> jobs;
+    for (int i=0; i<1000; i++) {
+        jobs.push_back(pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                   AsyncResult::Callback()));
+    }
+    for (size_t i=0; i<jobs.size(); i++) {
+        BOOST_REQUIRE( jobs[i] );
+        BOOST_CHECK( jobs[i]->wait(5000) );
+        BOOST_CHECK( jobs[i]->status() == AsyncResult::SUCCESS );
+    }
+    BOOST_CHECK( counter.load() == 1000 );
+
+    // nested submission
+    std::vector<AsyncResultPtr> children(100);
+    AsyncResultPtr parent = pool.submit(
+        boost::bind(spawn_job, _1, boost::ref(pool), boost::ref(counter), boost::ref(children)),
+        AsyncResult::Callback());
+    BOOST_CHECK( parent->wait(5000) );
+    for (size_t i=0; i<children.size(); i++) {
+        BOOST_REQUIRE( children[i] );
+        BOOST_CHECK( children[i]->wait(5000) );
+    }
+    BOOST_CHECK( counter.load() == 1100 );
+
+    // resize and restart
+    pool.reduce_workers(2);
+    pool.add_workers(1);
+    BOOST_CHECK( pool.worker_count() == 3 );
+    pool.stop();
+
+    AsyncResultPtr later = pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                       AsyncResult::Callback());
+    BOOST_CHECK( !later->wait(50) );
+    pool.run();
+    BOOST_CHECK( later->wait(5000) );
+    BOOST_CHECK( counter.load() == 1101 );
+}
+
+BOOST_AUTO_TEST_CASE( shared_queue )
+{
+    run_pool(ThreadPool::SHARED_QUEUE);
+}
+
+BOOST_AUTO_TEST_CASE( work_stealing )
+{
+    run_pool(ThreadPool::WORK_STEALING);
+}
+
+void step(AsyncResult& ar)
+{
+    int prev = 0;
+    if (ar.parent() && ar.parent()->get_result<int>())
+        prev = *ar.parent()->get_result<int>();
+    ar.set_result<int>(new int(prev + 1));
+}
+
+void fail_step(AsyncResult& ar)
+{
+    AVALON_THROW_INFO(AvalonException, error_number(7));
+}
+
+BOOST_AUTO_TEST_CASE( continuation )
+{
+    ThreadPool pool(2, 0, ThreadPool::WORK_STEALING);
+    pool.run();
+    
+    // a chain of submitted and inline steps.
+    AsyncResultPtr first = pool.submit(step, AsyncResult::Callback());
+    AsyncResultPtr last = first->then(pool, step)
+                               ->then(pool, step, AsyncResult::CONTINUE_INLINE)
+                               ->then(step);
+    BOOST_CHECK( last->wait(5000) );
+    BOOST_REQUIRE( last->get_result<int>() );
+    BOOST_CHECK( *last->get_result<int>() == 4 );
+    
+    // errors are passed down the chain without executing.
+    AsyncResultPtr bad = pool.submit(fail_step, AsyncResult::Callback());
+    AsyncResultPtr after = bad->then(pool, step)->then(pool, step);
+    BOOST_CHECK( after->wait(5000) );
+    BOOST_CHECK( after->status() == AsyncResult::ERROR );
+    BOOST_CHECK( !after->get_result<int>() );
+    BOOST_REQUIRE( after->exception() );
+    BOOST_CHECK( *boost::get_error_info<error_number>(*after->exception()) == 7 );
+    
+    // cancellation too.
+    AsyncResultPtr waiting(new AsyncResult(step));
+    AsyncResultPtr next = waiting->then(pool, step);
+    waiting->cancel();
+    BOOST_CHECK( next->status() == AsyncResult::CANCELLED );
+    
+    // a long inline chain runs without recursion, and releases its links.
+    AsyncResultPtr head(new AsyncResult(step));
+    AsyncResultPtr tail = head;
+    for (int i=0; i<100000; i++) {
+        tail = tail->then(step);
+    }
+    head->execute();
+    BOOST_REQUIRE( tail->get_result<int>() );
+    BOOST_CHECK( *tail->get_result<int>() == 100001 );
+    BOOST_CHECK( !tail->parent() );
+    
+    // a job not managed by AsyncResultPtr cannot be chained.
+    AsyncResult local(step);
+    BOOST_CHECK_THROW( local.then(step), AvalonOperationForbid );
+}
+
+BOOST_AUTO_TEST_CASE( combinators )
+{
+    ThreadPool pool(2, 0, ThreadPool::WORK_STEALING);
+    pool.run();
+    
+    // fan out and fan in without blocking a worker.
+    boost::atomic<int> counter(0);
+    std::vector<AsyncResultPtr> jobs;
+    for (int i=0; i<200; i++) {
+        jobs.push_back(pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                   AsyncResult::Callback()));
+    }
+    AsyncResultPtr all = when_all(jobs.begin(), jobs.end())->then(
+        boost::bind(count_job, _1, boost::ref(counter)));
+    BOOST_CHECK( all->wait(5000) );
+    BOOST_CHECK( counter.load() == 201 );
+    BOOST_CHECK( when_all(jobs)->jobs().size() == 200 );
+    
+    // the first finished job wins.
+    std::vector<AsyncResultPtr> pending;
+    pending.push_back(AsyncResultPtr(new AsyncResult(step)));
+    pending.push_back(AsyncResultPtr(new AsyncResult(step)));
+    JoinResult::Ptr any = when_any(pending);
+    BOOST_CHECK( any->status() == AsyncResult::WAIT );
+    pending[1]->cancel();
+    BOOST_CHECK( any->status() == AsyncResult::SUCCESS );
+    BOOST_CHECK( any->first() == 1 );
+    pending[0]->cancel();
+    
+    // empty collections finish immediately.
+    BOOST_CHECK( when_all(std::vector<AsyncResultPtr>())->done() );
+}
+
+void run_bulk(ThreadPool::Mode mode)
+{
+    ThreadPool pool(3, 250, mode);
+    boost::atomic<int> counter(0);
+    std::vector<AsyncResult::Task> tasks(100, boost::bind(count_job, _1, boost::ref(counter)));
+    std::vector<AsyncResult::Task> too_many(200, boost::bind(count_job, _1, boost::ref(counter)));
+    
+    // submitted before run, executed after.
+    JoinResult::Ptr group = pool.submit_bulk(tasks.begin(), tasks.end(), AsyncResult::Callback());
+    BOOST_CHECK( group->jobs().size() == 100 );
+    BOOST_CHECK_THROW( pool.submit_bulk(too_many.begin(), too_many.end(), AsyncResult::Callback()),
+                       AvalonThreadPoolIsFull );
+    pool.run();
+    BOOST_CHECK( group->wait(5000) );
+    BOOST_CHECK( group->pending() == 0 );
+    BOOST_CHECK( counter.load() == 100 );
+    
+    group = pool.submit_bulk(tasks.begin(), tasks.end(), AsyncResult::Callback());
+    BOOST_CHECK( group->wait(5000) );
+    BOOST_CHECK( counter.load() == 200 );
+    
+    // a stopped pool keeps the batch, which can be cancelled as a whole.
+    pool.stop();
+    group = pool.submit_bulk(tasks.begin(), tasks.begin() + 10, AsyncResult::Callback());
+    BOOST_CHECK( group->cancel_jobs() == 10 );
+    BOOST_CHECK( group->done() );
+}
+
+void busy_job(AsyncResult& ar, boost::atomic<int>& counter, size_t milliseconds)
+{
+    // Not an interruption point, so stop() must not rely on interrupting it.
+    Clock::time_point until = Clock::now() + boost::chrono::milliseconds(milliseconds);
+    while (Clock::now() < until) {
+    }
+    counter.fetch_add(1);
+}
+
+BOOST_AUTO_TEST_CASE( bulk )
+{
+    run_bulk(ThreadPool::SHARED_QUEUE);
+    run_bulk(ThreadPool::WORK_STEALING);
+    
+    // stop() leaves the rest of a batch in the queue.
+    ThreadPool pool(1, 0);
+    boost::atomic<int> counter(0);
+    std::vector<AsyncResult::Task> tasks(100, boost::bind(busy_job, _1, boost::ref(counter), 10));
+    pool.run();
+    JoinResult::Ptr group = pool.submit_bulk(tasks.begin(), tasks.end(), AsyncResult::Callback());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(30));
+    pool.stop();
+    int ran = counter.load();
+    BOOST_CHECK( ran < 50 );
+    BOOST_CHECK( group->pending() == (size_t)(100 - ran) );
+    BOOST_CHECK( pool.job_count(ThreadPool::NORMAL) == (size_t)(100 - ran) );
+    pool.run();
+    BOOST_CHECK( group->wait(5000) );
+    BOOST_CHECK( counter.load() == 100 );
+}
+
+void record_job(AsyncResult& ar, boost::mutex& lock, std::vector<int>& order, int priority)
+{
+    boost::unique_lock<boost::mutex> locker(lock);
+    order.push_back(priority);
+}
+
+std::vector<int> run_lanes(ThreadPool::Mode mode, size_t aging, int interactive, int background)
+{
+    ThreadPool pool(1, 0, mode);
+    pool.set_aging(aging);
+    boost::mutex lock;
+    std::vector<int> order;
+    std::vector<AsyncResultPtr> jobs;
+    
+    // queued before run, so that the lanes decide the order.
+    for (int i=0; i<background; i++) {
+        jobs.push_back(pool.submit(boost::bind(record_job, _1, boost::ref(lock), boost::ref(order),
+                                               (int)ThreadPool::BACKGROUND),
+                                   AsyncResult::Callback(), ThreadPool::BACKGROUND));
+    }
+    for (int i=0; i<interactive; i++) {
+        jobs.push_back(pool.submit(boost::bind(record_job, _1, boost::ref(lock), boost::ref(order),
+                                               (int)ThreadPool::INTERACTIVE),
+                                   AsyncResult::Callback(), ThreadPool::INTERACTIVE));
+    }
+    BOOST_CHECK( pool.job_count(ThreadPool::BACKGROUND) == (size_t)background );
+    pool.run();
+    for (size_t i=0; i<jobs.size(); i++) {
+        BOOST_CHECK( jobs[i]->wait(5000) );
+    }
+    pool.stop();
+    return order;
+}
+
+void run_priority(ThreadPool::Mode mode)
+{
+    // strict priority.
+    std::vector<int> order = run_lanes(mode, 0, 4, 4);
+    BOOST_REQUIRE( order.size() == 8 );
+    for (int i=0; i<8; i++) {
+        BOOST_CHECK_EQUAL( order[i], i < 4 ? ThreadPool::INTERACTIVE : ThreadPool::BACKGROUND );
+    }
+    
+    // a background job gets its turn after being passed over twice.
+    order = run_lanes(mode, 2, 6, 2);
+    BOOST_REQUIRE( order.size() == 8 );
+    BOOST_CHECK_EQUAL( order[2], ThreadPool::BACKGROUND );
+    BOOST_CHECK_EQUAL( order[5], ThreadPool::BACKGROUND );
+    
+    // each lane has its own limit.
+    ThreadPool pool(1, 0, mode);
+    pool.set_max_queue(ThreadPool::BACKGROUND, 2);
+    boost::atomic<int> counter(0);
+    AsyncResult::Task task = boost::bind(count_job, _1, boost::ref(counter));
+    pool.submit(task, AsyncResult::Callback(), ThreadPool::BACKGROUND);
+    pool.submit(task, AsyncResult::Callback(), ThreadPool::BACKGROUND);
+    BOOST_CHECK_THROW( pool.submit(task, AsyncResult::Callback(), ThreadPool::BACKGROUND),
+                       AvalonThreadPoolIsFull );
+    std::vector<AsyncResult::Task> tasks(2, task);
+    BOOST_CHECK_THROW( pool.submit_bulk(tasks.begin(), tasks.end(), AsyncResult::Callback(),
+                                        ThreadPool::BACKGROUND),
+                       AvalonThreadPoolIsFull );
+    AsyncResultPtr normal = pool.submit(task, AsyncResult::Callback());
+    pool.run();
+    BOOST_CHECK( normal->wait(5000) );
+}
+
+BOOST_AUTO_TEST_CASE( priority )
+{
+    run_priority(ThreadPool::SHARED_QUEUE);
+    run_priority(ThreadPool::WORK_STEALING);
+}
+
+void respawn_job(AsyncResult& ar, ThreadPool& pool, boost::atomic<bool>& stop)
+{
+    if (!stop.load())
+        pool.submit(boost::bind(respawn_job, _1, boost::ref(pool), boost::ref(stop)),
+                    AsyncResult::Callback());
+}
+
+void set_flag(AsyncResult& ar, boost::atomic<bool>& flag)
+{
+    flag.store(true);
+}
+
+BOOST_AUTO_TEST_CASE( fairness )
+{
+    // jobs queued before run start in submission order.
+    ThreadPool pool(1, 0, ThreadPool::WORK_STEALING);
+    boost::mutex lock;
+    std::vector<int> order;
+    std::vector<AsyncResultPtr> jobs;
+    for (int i=0; i<64; i++) {
+        jobs.push_back(pool.submit(boost::bind(record_job, _1, boost::ref(lock), 
+                                               boost::ref(order), i),
+                                   AsyncResult::Callback()));
+    }
+    pool.run();
+    BOOST_CHECK( pool.wait_idle(5000) );
+    BOOST_REQUIRE( order.size() == 64 );
+    for (int i=0; i<64; i++) {
+        BOOST_CHECK_EQUAL( order[i], i );
+    }
+    
+    // a worker busy with its own spawned jobs still takes outside ones.
+    boost::atomic<bool> stop(false);
+    pool.submit(boost::bind(respawn_job, _1, boost::ref(pool), boost::ref(stop)),
+                AsyncResult::Callback());
+    AsyncResultPtr outside = pool.submit(boost::bind(set_flag, _1, boost::ref(stop)),
+                                         AsyncResult::Callback());
+    BOOST_CHECK( outside->wait(5000) );
+    BOOST_CHECK( pool.wait_idle(5000) );
+}
+
+BOOST_AUTO_TEST_CASE( deadline )
+{
+    ThreadPool pool(1, 0, ThreadPool::WORK_STEALING);
+    boost::atomic<int> counter(0);
+    boost::atomic<int> expired(0);
+    AsyncResult::Task task = boost::bind(count_job, _1, boost::ref(counter));
+    
+    // queued past their deadline, so dropped when dequeued.
+    AsyncResultPtr stale = pool.submit(task, AsyncResult::Callback(), deadline_after(0));
+    stale->add_expire(boost::bind(count_job, _1, boost::ref(expired)));
+    AsyncResultPtr fresh = pool.submit(task, AsyncResult::Callback(), deadline_after(60000),
+                                       ThreadPool::INTERACTIVE);
+    AsyncResultPtr after = stale->then(pool, task);
+    boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    pool.run();
+    
+    // callbacks run in order, so the expire callback has run once the 
+    // continuation is cancelled.
+    BOOST_CHECK( after->wait(5000) );
+    BOOST_CHECK( fresh->wait(5000) );
+    BOOST_CHECK( stale->status() == AsyncResult::EXPIRED );
+    BOOST_CHECK( fresh->status() == AsyncResult::SUCCESS );
+    BOOST_CHECK( after->status() == AsyncResult::CANCELLED );
+    BOOST_CHECK( expired.load() == 1 );
+    BOOST_CHECK( counter.load() == 1 );
+}
+
+void sleep_job(AsyncResult& ar, size_t milliseconds)
+{
+    boost::this_thread::sleep(boost::posix_time::milliseconds(milliseconds));
+}
+
+BOOST_AUTO_TEST_CASE( back_pressure )
+{
+    ThreadPool pool(1, 2);
+    pool.set_max_queue(ThreadPool::BACKGROUND, 1);
+    AsyncResult::Task task = boost::bind(sleep_job, _1, 0);
+    AsyncResultPtr slow = pool.submit(boost::bind(sleep_job, _1, 50), AsyncResult::Callback(),
+                                      ThreadPool::BACKGROUND);
+    
+    // the lane is full, and the pool is not.
+    AsyncResultPtr late(new AsyncResult(task));
+    BOOST_CHECK( pool.try_submit(late, ThreadPool::BACKGROUND) == Executor::SUBMIT_FULL );
+    BOOST_CHECK( pool.submit_wait(late, 20, ThreadPool::BACKGROUND) == Executor::SUBMIT_TIMEOUT );
+    BOOST_CHECK( late->status() == AsyncResult::WAIT );
+    AsyncResultPtr normal(new AsyncResult(task));
+    BOOST_CHECK( pool.try_submit(normal) == Executor::SUBMIT_OK );
+    
+    // a blocked producer resumes when a job of the lane finishes.
+    pool.run();
+    BOOST_CHECK( pool.submit_wait(late, 5000, ThreadPool::BACKGROUND) == Executor::SUBMIT_OK );
+    BOOST_CHECK( slow->status() == AsyncResult::SUCCESS );
+    BOOST_CHECK( late->wait(5000) );
+    BOOST_CHECK( normal->wait(5000) );
+    
+    // raising the limit wakes it too.
+    pool.stop();
+    AsyncResultPtr queued = pool.submit(task, AsyncResult::Callback());
+    AsyncResultPtr blocked(new AsyncResult(task));
+    pool.set_max_queue(ThreadPool::NORMAL, 1);
+    boost::thread raiser(boost::bind(&ThreadPool::set_max_queue, &pool, ThreadPool::NORMAL, 0));
+    BOOST_CHECK( pool.submit_wait(blocked, 5000) == Executor::SUBMIT_OK );
+    raiser.join();
+    pool.run();
+    BOOST_CHECK( blocked->wait(5000) );
+    BOOST_CHECK( queued->wait(5000) );
+}
+
+void gate_job(AsyncResult& ar, boost::mutex& gate)
+{
+    boost::mutex::scoped_lock locker(gate);
+}
+
+BOOST_AUTO_TEST_CASE( quiescence )
+{
+    ThreadPool pool(2, 0);
+    boost::atomic<int> counter(0);
+    BOOST_CHECK( pool.wait_idle(0) );
+    
+    // jobs of a stopped pool stay in flight.
+    for (int i=0; i<100; i++) {
+        pool.submit(boost::bind(count_job, _1, boost::ref(counter)), AsyncResult::Callback());
+    }
+    BOOST_CHECK( pool.in_flight() == 100 );
+    BOOST_CHECK( !pool.wait_idle(20) );
+    pool.run();
+    BOOST_CHECK( pool.wait(5000) );
+    BOOST_CHECK( pool.in_flight() == 0 );
+    BOOST_CHECK( counter.load() == 100 );
+    
+    // a group is fenced while another job is still running.
+    boost::mutex gate;
+    boost::mutex::scoped_lock locker(gate);
+    AsyncResultPtr held = pool.submit(boost::bind(gate_job, _1, boost::ref(gate)),
+                                      AsyncResult::Callback());
+    TaskGroup::Ptr group = TaskGroup::create();
+    BOOST_CHECK( group->wait_idle() );
+    for (int i=0; i<10; i++) {
+        group->submit(pool, boost::bind(count_job, _1, boost::ref(counter)), 
+                      AsyncResult::Callback());
+    }
+    BOOST_CHECK( group->wait_idle(5000) );
+    BOOST_CHECK( group->pending() == 0 );
+    BOOST_CHECK( counter.load() == 110 );
+    BOOST_CHECK( !pool.wait_idle(20) );
+    BOOST_CHECK( held->status() != AsyncResult::SUCCESS );
+    locker.unlock();
+    BOOST_CHECK( pool.wait_idle(5000) );
+    
+    // a finished job is counted out at once.
+    group->add(held);
+    BOOST_CHECK( group->pending() == 0 );
+}
+
+void fill_slots(SlotMap<int>& slots, int count)
+{
+    for (int i=0; i<count; i++) {
+        slots.insert(i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( registry )
+{
+    // a freed slot is reused under a new key.
+    SlotMap<int> slots(4);
+    SlotMap<int>::Key first = slots.insert(1);
+    int value = 0;
+    BOOST_CHECK( first != 0 );
+    BOOST_CHECK( slots.erase(first, value) && value == 1 );
+    SlotMap<int>::Key second = slots.insert(2);
+    BOOST_CHECK( second != first );
+    BOOST_CHECK( !slots.get(first, value) );
+    BOOST_CHECK( !slots.erase(first, value) );
+    BOOST_CHECK( slots.get(second, value) && value == 2 );
+    slots.insert(3);
+    std::vector<int> values;
+    slots.clear(values);
+    BOOST_CHECK( values.size() == 2 && slots.size() == 0 );
+    
+    // the size sums the shards of all inserting threads.
+    boost::thread_group fillers;
+    for (int i=0; i<4; i++) {
+        fillers.create_thread(boost::bind(fill_slots, boost::ref(slots), 100));
+    }
+    fillers.join_all();
+    BOOST_CHECK( slots.size() == 400 );
+    values.clear();
+    slots.collect(values);
+    BOOST_CHECK( values.size() == 400 );
+    
+    // jobs registered while stopped are posted by run(), or cancelled.
+    ThreadPool pool(2, 0);
+    boost::atomic<int> counter(0);
+    AsyncResultPtr kept = pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                      AsyncResult::Callback(), ThreadPool::INTERACTIVE);
+    BOOST_CHECK( kept->slot_key() != 0 );
+    BOOST_CHECK( pool.job_count(ThreadPool::INTERACTIVE) == 1 );
+    pool.run();
+    BOOST_CHECK( pool.wait_idle(5000) );
+    BOOST_CHECK( pool.job_count(ThreadPool::INTERACTIVE) == 0 );
+    pool.stop();
+    AsyncResultPtr dropped = pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                         AsyncResult::Callback());
+    pool.cancel_all();
+    BOOST_CHECK( dropped->status() == AsyncResult::CANCELLED );
+    BOOST_CHECK( pool.job_count(ThreadPool::NORMAL) == 0 );
+    BOOST_CHECK( pool.in_flight() == 0 );
+    BOOST_CHECK( counter.load() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( autoscale )
+{
+    ThreadPool pool(1, 0);
+    pool.run();
+    AutoScaler::Options options;
+    options.max_workers = 3;
+    options.grow_wait = 5;
+    options.grow_samples = 1;
+    options.shrink_samples = 2;
+    options.grow_step = 1;
+    AutoScaler scaler(pool, options);
+    
+    // queued jobs wait, so the pool grows.
+    std::vector<AsyncResult::Task> tasks(20, boost::bind(sleep_job, _1, 10));
+    JoinResult::Ptr group = pool.submit_bulk(tasks.begin(), tasks.end(), AsyncResult::Callback());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(35));
+    BOOST_CHECK_EQUAL( scaler.sample(), 1 );
+    BOOST_CHECK_EQUAL( pool.worker_count(), 2u );
+    BOOST_CHECK( group->wait(5000) );
+    
+    // jobs longer than the interval keep the workers busy, not idle.
+    std::vector<AsyncResult::Task> long_tasks(2, boost::bind(sleep_job, _1, 60));
+    group = pool.submit_bulk(long_tasks.begin(), long_tasks.end(), AsyncResult::Callback());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    pool.take_load_stats();
+    for (int i=0; i<3; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        BOOST_CHECK_EQUAL( scaler.sample(), 0 );
+    }
+    BOOST_CHECK_EQUAL( pool.worker_count(), 2u );
+    BOOST_CHECK( group->wait(5000) );
+    
+    // an idle pool shrinks back to the minimum, one step per two samples.
+    pool.take_load_stats();
+    for (int i=0; i<10 && pool.worker_count() > 1; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+        scaler.sample();
+    }
+    BOOST_CHECK_EQUAL( pool.worker_count(), 1u );
+    
+    // retired workers left cleanly, and the rest still work.
+    boost::atomic<int> counter(0);
+    AsyncResultPtr job = pool.submit(boost::bind(count_job, _1, boost::ref(counter)),
+                                     AsyncResult::Callback());
+    BOOST_CHECK( job->wait(5000) );
+    BOOST_CHECK( counter.load() == 1 );
+    scaler.start();
+    scaler.stop();
+    
+    options.min_workers = 4;
+    BOOST_CHECK_THROW( AutoScaler bad(pool, options), AvalonInvalidArgument );
+    
+    // a work stealing pool has a worker limit.
+    ThreadPool stealing(1, 0, ThreadPool::WORK_STEALING);
+    options.min_workers = 1;
+    options.max_workers = ThreadPool::MAX_STEALING_WORKERS + 1;
+    BOOST_CHECK_THROW( AutoScaler bad(stealing, options), AvalonInvalidArgument );
+    options.max_workers = ThreadPool::MAX_STEALING_WORKERS;
+    AutoScaler good(stealing, options);
+}
+
+struct Square
+{
+    std::vector<int>* out;
+    
+    explicit Square(std::vector<int>* out) : out(out) {}
+    
+    void operator()(size_t i) const
+    {
+        (*out)[i] = (int)(i * i);
+    }
+};
+
+int negate(int x)
+{
+    return -x;
+}
+
+void throw_at(int i, int bad)
+{
+    if (i == bad)
+        AVALON_THROW_INFO(AvalonException, error_number(i));
+}
+
+void run_parallel(Executor& executor)
+{
+    const int n = 10000;
+    std::vector<int> squares(n);
+    parallel_for(executor, (size_t)0, (size_t)n, Square(&squares), 16);
+    for (int i=0; i<n; i++)
+        BOOST_CHECK_EQUAL( squares[i], i * i );
+    
+    std::vector<int> negated(n);
+    BOOST_CHECK( parallel_transform(executor, squares.begin(), squares.end(),
+                                    negated.begin(), negate) == negated.end() );
+    BOOST_CHECK_EQUAL( negated[n - 1], -(n - 1) * (n - 1) );
+    
+    std::vector<long> values(n);
+    for (int i=0; i<n; i++)
+        values[i] = i;
+    BOOST_CHECK_EQUAL( parallel_reduce(executor, values.begin(), values.end(), 7L,
+                                       std::plus<long>()), 7L + (long)n * (n - 1) / 2 );
+    BOOST_CHECK_EQUAL( parallel_reduce(executor, values.begin(), values.begin(), 7L,
+                                       std::plus<long>()), 7L );
+    
+    std::vector<int> unsorted(n);
+    for (int i=0; i<n; i++)
+        unsorted[i] = (i * 7919) % n;
+    parallel_sort(executor, unsorted.begin(), unsorted.end(), std::less<int>(), 500);
+    for (int i=0; i<n; i++)
+        BOOST_CHECK_EQUAL( unsorted[i], i );
+    
+    // the first exception is thrown on the calling thread.
+    try {
+        parallel_for(executor, 0, n, boost::bind(throw_at, _1, 4321));
+        BOOST_ERROR( "exception expected" );
+    } catch (AvalonException& e) {
+        BOOST_CHECK( *boost::get_error_info<error_number>(e) == 4321 );
+    }
+}
+
+void nested_parallel(AsyncResult& ar, Executor& executor)
+{
+    run_parallel(executor);
+}
+
+BOOST_AUTO_TEST_CASE( parallel )
+{
+    ThreadPool shared(3, 0, ThreadPool::SHARED_QUEUE);
+    shared.run();
+    run_parallel(shared);
+    
+    ThreadPool stealing(3, 0, ThreadPool::WORK_STEALING);
+    stealing.run();
+    run_parallel(stealing);
+    
+    // a stopped pool leaves all the work to the caller.
+    stealing.stop();
+    run_parallel(stealing);
+    stealing.run();
+    
+    // loops can be nested inside jobs of the same pool.
+    AsyncResultPtr outer = stealing.submit(
+        boost::bind(nested_parallel, _1, boost::ref(stealing)), AsyncResult::Callback());
+    BOOST_CHECK( outer->wait(10000) );
+    BOOST_CHECK( outer->status() == AsyncResult::SUCCESS );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,129 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/threadpool.h"
+#include "../thread/timerservice.h"
+#include "../errors.h"
+
+BOOST_AUTO_TEST_SUITE (timerservice)
+
+using namespace avalon::thread;
+using namespace avalon;
+
+void tick_job(AsyncResult& ar, boost::atomic<int>& counter)
+{
+    counter.fetch_add(1);
+}
+
+void hold_job(AsyncResult& ar, boost::shared_ptr<int> held)
+{
+}
+
+void wait_count(boost::atomic<int>& counter, int n)
+{
+    for (int i=0; i<500 && counter.load() < n; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( one_shot )
+{
+    ThreadPool pool(2, 0, ThreadPool::WORK_STEALING);
+    pool.run();
+    TimerService timers(pool);
+    timers.start();
+    boost::atomic<int> counter(0);
+    AsyncResult::Task task = boost::bind(tick_job, _1, boost::ref(counter));
+    
+    // not before the delay.
+    Clock::time_point start = Clock::now();
+    AsyncResultPtr later = timers.submit_after(30, task, AsyncResult::Callback());
+    BOOST_CHECK( later->wait(5000) );
+    BOOST_CHECK( Clock::now() - start >= boost::chrono::milliseconds(30) );
+    BOOST_CHECK( later->status() == AsyncResult::SUCCESS );
+    
+    // a cancelled timer never runs, and is dropped when due.
+    AsyncResultPtr cancelled = timers.submit_after(20, task, AsyncResult::Callback());
+    BOOST_CHECK( cancelled->cancel() );
+    AsyncResultPtr past = timers.submit_at(start, task, AsyncResult::Callback());
+    BOOST_CHECK( past->wait(5000) );
+    boost::this_thread::sleep(boost::posix_time::milliseconds(40));
+    BOOST_CHECK( counter.load() == 2 );
+    BOOST_CHECK( timers.pending() == 0 );
+    
+    // a far timer which is cancelled is not pending, and frees its task.
+    boost::shared_ptr<int> held(new int(0));
+    AsyncResultPtr far = timers.submit_after(60000, boost::bind(hold_job, _1, held),
+                                             AsyncResult::Callback());
+    BOOST_CHECK( timers.pending() == 1 );
+    BOOST_CHECK( held.use_count() == 2 );
+    BOOST_CHECK( far->cancel() );
+    BOOST_CHECK( timers.pending() == 0 );
+    BOOST_CHECK( held.use_count() == 1 );
+    
+    // many timers across several wheel levels.
+    std::vector<AsyncResultPtr> jobs;
+    for (int i=0; i<5000; i++) {
+        jobs.push_back(timers.submit_after(i % 300, task, AsyncResult::Callback()));
+    }
+    for (size_t i=0; i<jobs.size(); i++) {
+        BOOST_CHECK( jobs[i]->wait(5000) );
+    }
+    BOOST_CHECK( counter.load() == 5002 );
+    
+    // a stopped service keeps the timers, and cancels them on destruction.
+    timers.stop();
+    AsyncResultPtr kept = timers.submit_after(10, task, AsyncResult::Callback());
+    BOOST_CHECK( !kept->wait(50) );
+    timers.start();
+    BOOST_CHECK( kept->wait(5000) );
+    
+    AsyncResultPtr dropped;
+    {
+        TimerService local(pool);
+        dropped = local.submit_after(60000, task, AsyncResult::Callback());
+    }
+    BOOST_CHECK( dropped->status() == AsyncResult::CANCELLED );
+    
+    // the thread sleeps past the far timers, and wakes for an earlier one.
+    TimerService coarse(pool, 10);
+    coarse.start();
+    AsyncResultPtr hour = coarse.submit_after(3600000, task, AsyncResult::Callback());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    start = Clock::now();
+    AsyncResultPtr soon = coarse.submit_after(20, task, AsyncResult::Callback());
+    BOOST_CHECK( soon->wait(5000) );
+    BOOST_CHECK( Clock::now() - start < boost::chrono::milliseconds(1000) );
+    BOOST_CHECK( coarse.pending() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( periodic )
+{
+    ThreadPool pool(1, 0);
+    pool.run();
+    TimerService timers(pool, 2);
+    timers.start();
+    boost::atomic<int> counter(0);
+    boost::atomic<int> finished(0);
+    
+    AsyncResultPtr every = timers.submit_every(10, boost::bind(tick_job, _1, boost::ref(counter)),
+                                               boost::bind(tick_job, _1, boost::ref(finished)));
+    wait_count(finished, 3);
+    BOOST_CHECK( counter.load() >= 3 );
+    BOOST_CHECK( every->status() == AsyncResult::WAIT );
+    
+    BOOST_CHECK( every->cancel() );
+    boost::this_thread::sleep(boost::posix_time::milliseconds(30));
+    int stopped = counter.load();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    BOOST_CHECK( counter.load() == stopped );
+    BOOST_CHECK( timers.pending() == 0 );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,105 @@
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/nodepools.h"
+#include "../thread/threadpool.h"
+#include "../thread/topology.h"
+
+BOOST_AUTO_TEST_SUITE (topology)
+
+using namespace avalon::thread;
+
+BOOST_AUTO_TEST_CASE( cpu_list )
+{
+    Topology::CpuList cpus = Topology::parse_cpu_list("0-3,8,10-11\n");
+    int expected[] = {0, 1, 2, 3, 8, 10, 11};
+    BOOST_CHECK_EQUAL_COLLECTIONS( cpus.begin(), cpus.end(), expected, expected + 7 );
+    BOOST_CHECK( Topology::parse_cpu_list("").empty() );
+    
+    // the machine has at least one node with one CPU.
+    const Topology& system = Topology::system();
+    BOOST_REQUIRE( system.node_count() >= 1 );
+    BOOST_CHECK( !system.cpus(0).empty() );
+    BOOST_CHECK( system.node_of(system.cpus(0)[0]) == 0 );
+    
+    // only CPUs the process may run on are seen.
+    Topology::CpuList allowed = Topology::allowed_cpus();
+    if (!allowed.empty()) {
+        Topology::CpuList all = system.all_cpus();
+        for (size_t i=0; i<all.size(); i++) {
+            BOOST_CHECK( std::find(allowed.begin(), allowed.end(), all[i]) != allowed.end() );
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( placement )
+{
+    std::vector<Topology::CpuList> nodes;
+    nodes.push_back(Topology::parse_cpu_list("0-1"));
+    nodes.push_back(Topology::parse_cpu_list("2-3"));
+    Topology topology(nodes);
+    BOOST_CHECK( topology.node_of(3) == 1 );
+    
+    // spread deals threads over nodes.
+    Placement spread = Placement::spread();
+    BOOST_CHECK( spread.cpus_for(0, topology) == nodes[0] );
+    BOOST_CHECK( spread.cpus_for(1, topology) == nodes[1] );
+    BOOST_CHECK( spread.cpus_for(2, topology) == nodes[0] );
+    
+    // compact fills a node first.
+    Placement compact = Placement::compact();
+    BOOST_CHECK( compact.cpus_for(1, topology) == Topology::CpuList(1, 1) );
+    BOOST_CHECK( compact.cpus_for(2, topology) == Topology::CpuList(1, 2) );
+    BOOST_CHECK( compact.cpus_for(4, topology) == Topology::CpuList(1, 0) );
+    
+    BOOST_CHECK( Placement::node(1, topology).cpus_for(7, topology) == nodes[1] );
+    BOOST_CHECK( Placement().cpus_for(0, topology).empty() );
+    
+    // nodes without allowed CPUs are dropped.
+    Topology restricted(nodes);
+    restricted.restrict_to(Topology::parse_cpu_list("1,3"));
+    BOOST_REQUIRE( restricted.node_count() == 2 );
+    BOOST_CHECK( restricted.cpus(1) == Topology::CpuList(1, 3) );
+    restricted.restrict_to(Topology::CpuList(1, 1));
+    BOOST_CHECK( restricted.node_count() == 1 );
+    restricted.restrict_to(Topology::CpuList());
+    BOOST_CHECK( restricted.all_cpus() == Topology::CpuList(1, 1) );
+}
+
+void record_cpu(AsyncResult& ar, boost::atomic<int>& cpu)
+{
+    cpu.store(Topology::current_cpu());
+}
+
+BOOST_AUTO_TEST_CASE( pinned_pool )
+{
+    // system() only holds CPUs in the affinity mask, so the bind is allowed.
+    int target = Topology::system().cpus(0).back();
+    ThreadPool pool(2, 0);
+    pool.set_placement(Placement::cpu_set(Topology::CpuList(1, target)));
+    pool.run();
+    
+    boost::atomic<int> cpu(-2);
+    AsyncResultPtr job = pool.submit(boost::bind(record_cpu, _1, boost::ref(cpu)),
+                                     AsyncResult::Callback());
+    BOOST_CHECK( job->wait(5000) );
+    BOOST_CHECK_EQUAL( cpu.load(), target );
+    
+    // one pool per node.
+    NodePools pools(1, 0);
+    pools.run();
+    BOOST_CHECK( pools.node_count() == Topology::system().node_count() );
+    BOOST_CHECK( pools.concurrency() == pools.node_count() );
+    job = pools.submit(boost::bind(record_cpu, _1, boost::ref(cpu)), AsyncResult::Callback(), 0);
+    BOOST_CHECK( job->wait(5000) );
+    BOOST_CHECK( Topology::system().node_of(cpu.load()) == 0 );
+    job = pools.submit(boost::bind(record_cpu, _1, boost::ref(cpu)), AsyncResult::Callback());
+    BOOST_CHECK( job->wait(5000) );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,145 @@
+#include <boost/test/unit_test.hpp>
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include "../thread/asyncresult.h"
+#include "../thread/threadpool.h"
+#include "../thread/tracer.h"
+#include "../errors.h"
+
+BOOST_AUTO_TEST_SUITE (tracer)
+
+using namespace avalon::thread;
+using namespace avalon;
+
+void nop_job(AsyncResult& ar)
+{
+}
+
+void spawn_job(AsyncResult& ar, ThreadPool& pool, AsyncResultPtr& child)
+{
+    child = pool.submit(nop_job, AsyncResult::Callback());
+}
+
+std::string link(const AsyncResultPtr& job, const AsyncResultPtr& parent)
+{
+    return "\"job\":" + boost::lexical_cast<std::string>(job->trace_id()) + 
+           ",\"parent\":" + boost::lexical_cast<std::string>(parent->trace_id());
+}
+
+BOOST_AUTO_TEST_CASE( lifecycle )
+{
+    Tracer& tracer = Tracer::instance();
+    BOOST_CHECK_THROW( tracer.enable(0), AvalonInvalidArgument );
+    BOOST_CHECK_THROW( tracer.enable(1, 0), AvalonInvalidArgument );
+    tracer.clear();
+    tracer.enable(1.0);
+    
+    ThreadPool pool(1, 0);
+    pool.run();
+    AsyncResultPtr child;
+    AsyncResultPtr parent = pool.submit(boost::bind(spawn_job, _1, boost::ref(pool), 
+                                                    boost::ref(child)),
+                                        AsyncResult::Callback());
+    BOOST_CHECK( parent->wait(5000) );
+    AsyncResultPtr next = parent->then(pool, nop_job);
+    BOOST_CHECK( next->wait(5000) );
+    BOOST_REQUIRE( child );
+    BOOST_CHECK( child->wait(5000) );
+    pool.stop();
+    tracer.disable();
+    
+    // children and continuations are traced with their parent.
+    BOOST_CHECK( parent->trace_id() != 0 );
+    BOOST_CHECK( child->trace_id() != 0 );
+    BOOST_CHECK( next->trace_id() != 0 );
+    
+    std::ostringstream out;
+    tracer.write_json(out);
+    std::string json = out.str();
+    BOOST_CHECK( json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[") == 0 );
+    BOOST_CHECK( json.find(link(child, parent)) != std::string::npos );
+    BOOST_CHECK( json.find(link(next, parent)) != std::string::npos );
+    BOOST_CHECK( json.find("\"name\":\"dequeue\"") != std::string::npos );
+    BOOST_CHECK( json.find("\"ph\":\"B\"") != std::string::npos );
+    BOOST_CHECK( json.find("\"status\":\"SUCCESS\"") != std::string::npos );
+    BOOST_CHECK( json.find("\"ph\":\"f\"") != std::string::npos );
+    BOOST_CHECK( json.substr(json.size() - 4) == "\n]}\n" );
+    
+    // cleared events are not dumped again.
+    tracer.clear();
+    out.str("");
+    tracer.write_json(out);
+    BOOST_CHECK( out.str().find("\"job\"") == std::string::npos );
+}
+
+BOOST_AUTO_TEST_CASE( sampling )
+{
+    Tracer& tracer = Tracer::instance();
+    tracer.clear();
+    tracer.enable(0.01, 16);
+    
+    ThreadPool pool(1, 0);
+    pool.run();
+    std::vector<AsyncResultPtr> jobs;
+    for (int i=0; i<1000; i++) {
+        jobs.push_back(pool.submit(nop_job, AsyncResult::Callback()));
+    }
+    tracer.disable();
+    AsyncResultPtr untraced = pool.submit(nop_job, AsyncResult::Callback());
+    
+    size_t traced = 0;
+    for (size_t i=0; i<jobs.size(); i++) {
+        BOOST_CHECK( jobs[i]->wait(5000) );
+        if (jobs[i]->trace_id())
+            traced++;
+    }
+    BOOST_CHECK_EQUAL( traced, 10u );
+    BOOST_CHECK( untraced->wait(5000) );
+    BOOST_CHECK_EQUAL( untraced->trace_id(), 0u );
+    pool.stop();
+    tracer.clear();
+}
+
+void submit_traced(AsyncResultPtr job)
+{
+    Tracer::on_submit(*job);
+}
+
+size_t count_of(const std::string& text, const std::string& word)
+{
+    size_t ret = 0;
+    for (size_t i=text.find(word); i!=std::string::npos; i=text.find(word, i + 1)) {
+        ret++;
+    }
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE( retired_rings )
+{
+    Tracer& tracer = Tracer::instance();
+    tracer.clear();
+    tracer.enable(1.0, 16);
+    
+    // the rings of exited threads are kept for one dump, and bounded.
+    for (size_t i=0; i<Tracer::MAX_RETIRED_RINGS * 2; i++) {
+        boost::thread thread(boost::bind(submit_traced, 
+                                         AsyncResultPtr(new AsyncResult(nop_job))));
+        thread.join();
+    }
+    tracer.disable();
+    std::ostringstream out;
+    tracer.write_json(out);
+    BOOST_CHECK_EQUAL( count_of(out.str(), "\"name\":\"submit\""), Tracer::MAX_RETIRED_RINGS );
+    out.str("");
+    tracer.write_json(out);
+    BOOST_CHECK_EQUAL( count_of(out.str(), "\"name\":\"submit\""), 0u );
+    tracer.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
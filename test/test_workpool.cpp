@@ -2,12 +2,16 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 #include "../thread/asyncresult.h"
 #include "../thread/workpool.h"
+#include "../thread/future.h"
 #include "../errors.h"
 
 BOOST_AUTO_TEST_SUITE (workpool)
@@ -69,6 +73,9 @@ void cb(AsyncResult &ar)
         case AsyncResult::INTERRUPTED:
             *i += BIT_5;
             break;
+        case AsyncResult::EXPIRED:
+            *i += BIT_6;
+            break;
         default:
             *i += BIT_9;
             break;
@@ -87,6 +94,7 @@ void cb2(AsyncResult &ar, bool& flag)
     ar.add_error(cb); \
     ar.add_cancel(cb); \
     ar.add_interrupt(cb); \
+    ar.add_expire(cb); \
     ar.add_all(boost::bind(cb2, _1, boost::ref(flag)));
     
 #define CHECK_RESULT(ar, v) ( (ar.get_result<int>()) && (*ar.get_result<int>() == (v)))
@@ -95,6 +103,103 @@ BOOST_AUTO_TEST_CASE( workpool )
 {
 }
 
+void count_job(AsyncResult& ar, boost::atomic<int>& counter)
+{
+    counter.fetch_add(1);
+}
+
+BOOST_AUTO_TEST_CASE( lockfree_workpool )
+{
+    BOOST_CHECK_THROW( LockFreeWorkPool(1, 0), AvalonInvalidArgument );
+    
+    boost::atomic<int> counter(0);
+    std::vector<AsyncResultPtr> jobs;
+    {
+        LockFreeWorkPool pool(4, 1024);
+        for (int i=0; i<1000; i++) {
+            jobs.push_back(pool.submit(boost::bind(count_job, _1, boost::ref(counter)), cb));
+        }
+        for (size_t i=0; i<jobs.size(); i++) {
+            BOOST_CHECK( jobs[i]->wait(5000) );
+            BOOST_CHECK( jobs[i]->status() == AsyncResult::SUCCESS );
+        }
+        BOOST_CHECK( counter.load() == 1000 );
+        
+        std::vector<AsyncResult::Task> tasks(500, boost::bind(count_job, _1, boost::ref(counter)));
+        JoinResult::Ptr group = pool.submit_bulk(tasks.begin(), tasks.end(), cb);
+        BOOST_CHECK( group->wait(5000) );
+        BOOST_CHECK( counter.load() == 1500 );
+        BOOST_CHECK_THROW( pool.submit_bulk(std::vector<AsyncResultPtr>(2000)), AvalonWorkPoolFull );
+        
+        // a stopped pool rejects new jobs instead of stranding them.
+        pool.stop();
+        AsyncResultPtr late(new AsyncResult(boost::bind(count_job, _1, boost::ref(counter))));
+        BOOST_CHECK( pool.try_submit(late) == Executor::SUBMIT_FULL );
+        BOOST_CHECK( late->status() == AsyncResult::WAIT );
+    }
+    
+    {
+        WorkPool pool(2);
+        std::vector<AsyncResult::Task> tasks(500, boost::bind(count_job, _1, boost::ref(counter)));
+        JoinResult::Ptr group = pool.submit_bulk(tasks.begin(), tasks.end(), cb);
+        BOOST_CHECK( group->wait(5000) );
+        BOOST_CHECK( counter.load() == 2000 );
+        pool.stop();
+    }
+    
+    // a full ring rejects jobs, and stop() cancels the queued ones.
+    {
+        LockFreeWorkPool pool(0, 2);
+        AsyncResultPtr a = pool.submit(boost::bind(count_job, _1, boost::ref(counter)), cb);
+        AsyncResultPtr b = pool.submit(boost::bind(count_job, _1, boost::ref(counter)), cb);
+        BOOST_CHECK_THROW( pool.submit(boost::bind(count_job, _1, boost::ref(counter)), cb), 
+                           AvalonWorkPoolFull );
+        AsyncResultPtr c(new AsyncResult(boost::bind(count_job, _1, boost::ref(counter))));
+        BOOST_CHECK( pool.try_submit(c) == Executor::SUBMIT_FULL );
+        BOOST_CHECK( pool.submit_wait(c, 20) == Executor::SUBMIT_TIMEOUT );
+        BOOST_CHECK( c->status() == AsyncResult::WAIT );
+        pool.stop();
+        BOOST_CHECK( a->status() == AsyncResult::CANCELLED );
+        BOOST_CHECK( b->status() == AsyncResult::CANCELLED );
+    }
+}
+
+void sleep_job(AsyncResult& ar, size_t milliseconds)
+{
+    boost::this_thread::sleep(boost::posix_time::milliseconds(milliseconds));
+}
+
+BOOST_AUTO_TEST_CASE( back_pressure )
+{
+    // a blocked producer resumes when the running job leaves the queue.
+    WorkPool pool(1, 1);
+    AsyncResultPtr slow = pool.submit(boost::bind(sleep_job, _1, 50), cb);
+    AsyncResultPtr next(new AsyncResult(boost::bind(sleep_job, _1, 0)));
+    BOOST_CHECK( pool.try_submit(next) == Executor::SUBMIT_FULL );
+    BOOST_CHECK( pool.submit_wait(next, 5000) == Executor::SUBMIT_OK );
+    BOOST_CHECK( slow->status() == AsyncResult::SUCCESS );
+    BOOST_CHECK( next->wait(5000) );
+    
+    // so does one waiting for a free cell of the ring.
+    LockFreeWorkPool ring(1, 1);
+    std::vector<AsyncResultPtr> jobs;
+    for (int i=0; i<3; i++) {
+        jobs.push_back(AsyncResultPtr(new AsyncResult(boost::bind(sleep_job, _1, i ? 0 : 50))));
+        BOOST_CHECK( ring.submit_wait(jobs.back()) == Executor::SUBMIT_OK );
+    }
+    BOOST_CHECK( jobs[2]->wait(5000) );
+    BOOST_CHECK( jobs[1]->status() == AsyncResult::SUCCESS );
+    
+    // a finished job, dropped as soon as it is queued, does not deadlock 
+    // its blocked producer.
+    slow = pool.submit(boost::bind(sleep_job, _1, 50), cb);
+    AsyncResultPtr cancelled(new AsyncResult(boost::bind(sleep_job, _1, 0)));
+    BOOST_CHECK( cancelled->cancel() );
+    BOOST_CHECK( pool.submit_wait(cancelled, 5000) == Executor::SUBMIT_OK );
+    BOOST_CHECK( slow->wait(5000) );
+    pool.stop();
+}
+
 BOOST_AUTO_TEST_CASE( async_result_data )
 {
     int i = 0;
@@ -107,6 +212,124 @@ BOOST_AUTO_TEST_CASE( async_result_data )
     
 }
 
+BOOST_AUTO_TEST_CASE( async_result_pool )
+{
+    // the memory of a released AsyncResult is recycled by the same thread.
+    AsyncResult* raw;
+    {
+        AsyncResultPtr ar(new AsyncResult(f));
+        raw = ar.get();
+    }
+    AsyncResultPtr ar(new AsyncResult(f));
+    BOOST_CHECK( ar.get() == raw );
+    
+    AsyncResultPtr copy = ar;
+    ar.reset();
+    BOOST_CHECK( copy->status() == AsyncResult::WAIT );
+}
+
+void count_call(int& calls)
+{
+    calls++;
+}
+
+void cancellable_job(AsyncResult& ar, boost::atomic<bool>& started, AsyncResultPtr& child)
+{
+    child.reset(new AsyncResult(f));
+    started.store(true);
+    while (!ar.cancel_requested()) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    ar.throw_if_cancelled();
+}
+
+BOOST_AUTO_TEST_CASE( cancel_token )
+{
+    // cancellation runs the callbacks, and reaches the children only.
+    int calls = 0;
+    CancelToken::Ptr parent = CancelToken::create();
+    CancelToken::Ptr child = CancelToken::create(parent);
+    CancelToken::Registration kept = child->add_callback(boost::bind(count_call, boost::ref(calls)));
+    CancelToken::Registration removed = child->add_callback(boost::bind(count_call, boost::ref(calls)));
+    BOOST_CHECK( child->remove_callback(removed) );
+    BOOST_CHECK( CancelToken::create(child)->cancel() );
+    BOOST_CHECK( !child->cancelled() );
+    BOOST_CHECK( parent->cancel() );
+    BOOST_CHECK( !parent->cancel() );
+    BOOST_CHECK( child->cancelled() && calls == 1 );
+    BOOST_CHECK( !child->remove_callback(kept) );
+    BOOST_CHECK( CancelToken::create(parent)->cancelled() );
+    BOOST_CHECK( child->add_callback(boost::bind(count_call, boost::ref(calls))) == 0 );
+    BOOST_CHECK( calls == 2 );
+    
+    // a deep tree is cancelled and freed without recursion.
+    CancelToken::Ptr root = CancelToken::create();
+    CancelToken::Ptr leaf = root;
+    for (int i=0; i<100000; i++) {
+        leaf = CancelToken::create(leaf);
+    }
+    BOOST_CHECK( root->cancel() );
+    BOOST_CHECK( leaf->cancelled() );
+    root.reset();
+    leaf.reset();
+    
+    // a running task stops on request, and so do the jobs it spawned.
+    LockFreeWorkPool pool(1, 16);
+    boost::atomic<bool> started(false);
+    AsyncResultPtr spawned;
+    AsyncResultPtr job = pool.submit(boost::bind(cancellable_job, _1, boost::ref(started), 
+                                                 boost::ref(spawned)), cb);
+    AsyncResultPtr next = job->then(f);
+    while (!started.load()) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    BOOST_CHECK( !spawned->cancel_requested() );
+    BOOST_CHECK( !job->cancel() );
+    BOOST_CHECK( spawned->cancel_requested() );
+    BOOST_CHECK( job->wait(5000) );
+    BOOST_CHECK( job->status() == AsyncResult::CANCELLED );
+    BOOST_CHECK( !spawned->execute() );
+    BOOST_CHECK( spawned->status() == AsyncResult::CANCELLED );
+    BOOST_CHECK( next->wait(5000) );
+    BOOST_CHECK( next->status() == AsyncResult::CANCELLED );
+}
+
+int answer(AsyncResult& ar)
+{
+    return 42;
+}
+
+std::string greet(AsyncResult& ar)
+{
+    return "hello";
+}
+
+BOOST_AUTO_TEST_CASE( future )
+{
+    {
+        Future<int>::Ptr ft(new Future<int>(answer));
+        BOOST_CHECK( !ft->has_value() );
+        BOOST_CHECK_THROW( ft->value(), AvalonOperationForbid );
+        BOOST_CHECK( ft->execute() );
+        BOOST_CHECK( ft->status() == AsyncResult::SUCCESS );
+        BOOST_CHECK( ft->value() == 42 );
+        BOOST_CHECK( ft->take() == 42 );
+        BOOST_CHECK_THROW( ft->take(), AvalonOperationForbid );
+    }
+    {
+        LockFreeWorkPool pool(2, 16);
+        Future<std::string>::Ptr ft(new Future<std::string>(greet));
+        pool.submit(ft);
+        BOOST_CHECK( ft->wait(5000) );
+        BOOST_CHECK( ft->take() == "hello" );
+        
+        // the type-erased result API rejects a wrong type.
+        AsyncResultPtr ar = pool.submit(f, cb);
+        BOOST_CHECK( ar->wait(5000) );
+        BOOST_CHECK( !ar->get_result<std::string>() );
+    }
+}
+
 BOOST_AUTO_TEST_CASE( async_result )
 {
     // test basic AsyncResult.
@@ -156,6 +379,24 @@ BOOST_AUTO_TEST_CASE( async_result )
         BOOST_CHECK( CHECK_RESULT(ar, BIT_5) );
         BOOST_CHECK( flag );
     }
+    // test expiry.
+    {
+        MAKE_ASYNC_RESULT(f);
+        ar.set_deadline(Clock::now());
+        BOOST_CHECK( !ar.execute() );
+        BOOST_CHECK( ar.wait() );
+        
+        BOOST_CHECK( ar.status() == AsyncResult::EXPIRED );
+        BOOST_CHECK( CHECK_RESULT(ar, BIT_6) );
+        BOOST_CHECK( flag );
+        BOOST_CHECK( !ar.cancel() );
+    }
+    {
+        MAKE_ASYNC_RESULT(f);
+        ar.set_deadline(deadline_after(60000));
+        BOOST_CHECK( ar.execute() );
+        BOOST_CHECK( ar.status() == AsyncResult::SUCCESS );
+    }
     // test wait timeout.
     {
         MAKE_ASYNC_RESULT(f);
@@ -178,6 +419,11 @@ BOOST_AUTO_TEST_CASE( async_result )
         flag = false;
         ar.add_all( boost::bind(cb2, _1, boost::ref(flag)) );
         BOOST_CHECK(flag);
+        
+        // callbacks of other status are not executed.
+        flag = false;
+        ar.add_cancel( boost::bind(cb2, _1, boost::ref(flag)) );
+        BOOST_CHECK(!flag);
     }
 }
 
@@ -19,10 +19,217 @@
 
 
 #include "asyncresult.h"
+#include "errors.h"
+#include "executor.h"
+#include "tracer.h"
+#include <vector>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scope_exit.hpp>
+#include <boost/thread/tss.hpp>
 
 BEGIN_AVALON_NS2(thread)
 
+namespace {
+    /// A free memory block.
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+    
+    /// The block size served by the free lists.
+    /**
+     * One extra cache line so that small derived classes are pooled too.
+     */
+    const size_t POOL_BLOCK_SIZE = 
+        (sizeof(AsyncResult) / AVALON_CACHE_LINE + 2) * AVALON_CACHE_LINE;
+    
+    /// The number of blocks moved between a thread and the depot at once.
+    const size_t POOL_BATCH = 64;
+    
+    /// The maximum number of blocks cached by a thread.
+    const size_t POOL_LOCAL_LIMIT = POOL_BATCH * 4;
+    
+    /// The maximum number of batches kept by the depot.
+    const size_t POOL_DEPOT_LIMIT = 1024;
+    
+    /// The shared depot of block batches.
+    /**
+     * Blocks freed by a worker thread flow back to producer threads 
+     * through here, one batch per lock.
+     */
+    class Depot
+    {
+    public:
+        void push(FreeBlock* batch)
+        {
+            {
+                boost::mutex::scoped_lock locker(lock_);
+                if (batches_.size() < POOL_DEPOT_LIMIT) {
+                    batches_.push_back(batch);
+                    return;
+                }
+            }
+            while (batch) {
+                FreeBlock* next = batch->next;
+                ::operator delete(batch);
+                batch = next;
+            }
+        }
+        
+        FreeBlock* pop()
+        {
+            boost::mutex::scoped_lock locker(lock_);
+            if (batches_.empty())
+                return NULL;
+            FreeBlock* ret = batches_.back();
+            batches_.pop_back();
+            return ret;
+        }
+        
+    protected:
+        boost::mutex lock_;
+        std::vector<FreeBlock*> batches_;
+    };
+    
+    /// Never destroyed, for threads may exit after static destruction.
+    Depot& depot()
+    {
+        static Depot* instance = new Depot();
+        return *instance;
+    }
+    
+    /// The per-thread free list.
+    struct LocalCache
+    {
+        FreeBlock* head;
+        size_t count;
+    };
+    
+    /// Give the blocks back to the depot on thread exit.
+    void flush_cache(LocalCache* cache);
+    
+    /// The fast path pointer to the thread cache.
+    __thread LocalCache* local_cache = NULL;
+    
+    /// Whether the thread cache has been flushed on exit.
+    __thread bool local_cache_closed = false;
+    
+    /// Only used to get notified on thread exit.
+    boost::thread_specific_ptr<LocalCache> local_cache_owner(flush_cache);
+    
+    void flush_cache(LocalCache* cache)
+    {
+        local_cache = NULL;
+        local_cache_closed = true;
+        while (cache->head) {
+            FreeBlock* batch = cache->head;
+            FreeBlock* tail = batch;
+            for (size_t i=1; i<POOL_BATCH && tail->next; i++) {
+                tail = tail->next;
+            }
+            cache->head = tail->next;
+            tail->next = NULL;
+            depot().push(batch);
+        }
+        delete cache;
+    }
+    
+    LocalCache* get_cache()
+    {
+        if (local_cache || local_cache_closed)
+            return local_cache;
+        local_cache = new LocalCache();
+        local_cache->head = NULL;
+        local_cache->count = 0;
+        local_cache_owner.reset(local_cache);
+        return local_cache;
+    }
+    
+    /// The job running in current thread.
+    __thread AsyncResult* running_job = NULL;
+    
+    /// The inline continuations queued behind the running one.
+    struct InlineQueue
+    {
+        AsyncResult* head;
+        AsyncResult* tail;
+    };
+    
+    /// The queue of the outermost inline continuation in current thread.
+    __thread InlineQueue* inline_queue = NULL;
+    
+    /// Make a job current while its task runs.
+    /**
+     * The task may suspend on a coroutine and resume on another thread, 
+     * so the variable is only touched through the out-of-line accessors, 
+     * whose address of it is never cached across the task.
+     */
+    struct RunningScope
+    {
+        AsyncResult* outer;
+        
+        explicit RunningScope(AsyncResult* ar) : outer(AsyncResult::swap_current(ar))
+        {
+        }
+        
+        ~RunningScope()
+        {
+            AsyncResult::swap_current(outer);
+        }
+    };
+}
+
+void* AsyncResult::operator new(std::size_t size)
+{
+    if (size > POOL_BLOCK_SIZE)
+        return ::operator new(size);
+    
+    // Any block may be recycled later, so always take the full size.
+    LocalCache* cache = get_cache();
+    if (!cache)
+        return ::operator new(POOL_BLOCK_SIZE);
+    if (!cache->head) {
+        cache->head = depot().pop();
+        if (!cache->head)
+            return ::operator new(POOL_BLOCK_SIZE);
+        cache->count = 0;
+        for (FreeBlock* b = cache->head; b; b = b->next) {
+            cache->count++;
+        }
+    }
+    FreeBlock* block = cache->head;
+    cache->head = block->next;
+    cache->count--;
+    return block;
+}
+
+void AsyncResult::operator delete(void* p, std::size_t size)
+{
+    LocalCache* cache = size <= POOL_BLOCK_SIZE ? get_cache() : NULL;
+    if (!cache) {
+        ::operator delete(p);
+        return;
+    }
+    
+    FreeBlock* block = (FreeBlock*)p;
+    block->next = cache->head;
+    cache->head = block;
+    if (++cache->count < POOL_LOCAL_LIMIT)
+        return;
+    
+    // hand a batch over to the depot.
+    FreeBlock* tail = cache->head;
+    for (size_t i=1; i<POOL_BATCH; i++) {
+        tail = tail->next;
+    }
+    FreeBlock* batch = cache->head;
+    cache->head = tail->next;
+    tail->next = NULL;
+    cache->count -= POOL_BATCH;
+    depot().push(batch);
+}
+
 AsyncResult::ResultBase::ResultBase()
 {
 }
@@ -33,62 +240,113 @@ AsyncResult::ResultBase::~ResultBase()
 
 AsyncResult::AsyncResult ( const avalon::thread::AsyncResult::Task& task )
  :  lock_(), 
+    wait_lock_(),
     cond_(), 
+    waiters_(0),
     status_(WAIT),
+    refs_(0),
     task_(task), 
     callbacks_(), 
     exception_(), 
+    parent_(),
+    executor_(NULL),
+    deadline_(Clock::time_point::max()),
+    queued_at_(),
+    trace_id_(0),
+    slot_key_(0),
+    token_(NULL),
+    inherited_(running_job ? running_job->token() : CancelToken::Ptr()),
+    queue_next_(NULL),
     result_()
 {
 }
 
 AsyncResult::Status AsyncResult::status()
 {
-    Lock::scoped_lock locker(lock_);
-    return status_;
+    return (Status)status_.load(boost::memory_order_acquire);
+}
+
+bool AsyncResult::done()
+{
+    int status = status_.load(boost::memory_order_seq_cst);
+    return status != WAIT && status != RUNNING;
 }
 
 AsyncResult::~AsyncResult()
 {
     cancel();
+    CancelToken* token = token_.load(boost::memory_order_acquire);
+    if (token)
+        intrusive_ptr_release(token);
 }
 
 const avalon::AvalonException* AsyncResult::exception()
 {
-    Lock::scoped_lock locker(lock_);
+    if (status_.load(boost::memory_order_acquire) != ERROR)
+        return NULL;
     return exception_.get();
 }
 
-void AsyncResult::set_success()
+bool AsyncResult::transit(Status from, Status to)
 {
-    bool should_call = false;
-    {
-        Lock::scoped_lock locker(lock_);
-        if (status_ == RUNNING) {
-            should_call = true;
-            status_ = SUCCESS;
-        }
+    int expected = from;
+    return status_.compare_exchange_strong(expected, to, boost::memory_order_seq_cst);
+}
+
+void AsyncResult::finish(unsigned int flag)
+{
+    // The status is stored with seq_cst before loading waiters_, and 
+    // wait() increases waiters_ before loading the status. So either 
+    // we see the waiter, or the waiter sees the final status.
+    if (waiters_.load(boost::memory_order_seq_cst)) {
+        WaitLock::scoped_lock locker(wait_lock_);
+        cond_.notify_all();
     }
-    if (should_call) {
-        call_callback(CALLBACK_SUCCESS);
+    if (!trace_id_) {
+        call_callback(flag);
+        return;
     }
+    Tracer::on_event(Tracer::CALLBACK_BEGIN, *this);
+    call_callback(flag);
+    Tracer::on_event(Tracer::CALLBACK_END, *this);
 }
 
-void AsyncResult::set_interrupt()
+unsigned int AsyncResult::status_flag(int status)
 {
-    bool should_call = false;
-    {
-        Lock::scoped_lock locker(lock_);
-        if (status_ == RUNNING) {
-            should_call = true;
-            status_ = INTERRUPTED;
-        }
-    }
-    if (should_call) {
-        call_callback(CALLBACK_INTERRUPT);
+    switch (status) {
+        case SUCCESS:
+            return CALLBACK_SUCCESS;
+        case ERROR:
+            return CALLBACK_ERROR;
+        case CANCELLED:
+            return CALLBACK_CANCEL;
+        case INTERRUPTED:
+            return CALLBACK_INTERRUPT;
+        case EXPIRED:
+            return CALLBACK_EXPIRE;
+        default:
+            return 0;
     }
 }
 
+void AsyncResult::set_success()
+{
+    if (transit(RUNNING, SUCCESS))
+        finish(CALLBACK_SUCCESS);
+}
+
+void AsyncResult::set_interrupt()
+{
+    if (transit(RUNNING, INTERRUPTED))
+        finish(CALLBACK_INTERRUPT);
+}
+
+void AsyncResult::set_cancelled()
+{
+    if (transit(RUNNING, CANCELLED))
+        finish(CALLBACK_CANCEL);
+}
+
 void AsyncResult::set_error()
 {
     set_error(NULL);
@@ -96,44 +354,41 @@ void AsyncResult::set_error()
 
 void AsyncResult::set_error ( const avalon::AvalonException* err )
 {
-    bool should_call = false;
-    {
-        Lock::scoped_lock locker(lock_);
-        if (status_ == RUNNING) {
-            should_call = true;
-            status_ = ERROR;
-        }
-        if (err) {
-            exception_.reset(new AvalonException(*err));
-        } else {
-            exception_.reset();
-        }
-    }
-    if (should_call) {
-        call_callback(CALLBACK_ERROR);
+    // Only the executing thread owns a RUNNING job, so it is safe to 
+    // write the exception before publishing the status.
+    if (status_.load(boost::memory_order_acquire) != RUNNING)
+        return;
+    if (err) {
+        exception_.reset(new AvalonException(*err));
+    } else {
+        exception_.reset();
     }
+    if (transit(RUNNING, ERROR))
+        finish(CALLBACK_ERROR);
 }
 
 bool AsyncResult::set_cancel()
 {
-    cancel();
+    return cancel();
 }
 
 void AsyncResult::clear_result()
 {
-    Lock::scoped_lock locker(lock_);
-    result_.reset();
+    boost::shared_ptr<ResultBase> result;
+    {
+        Lock::scoped_lock locker(lock_);
+        result.swap(result_);
+    }
 }
 
 void AsyncResult::call_callback(unsigned int flag)
 {
-    cond_.notify_all();
-    
+    // Take the list away instead of copying it. boost::function swaps 
+    // its storage, so neither allocation nor deep copy happens here.
     CallbackList callbacks;
     {
         Lock::scoped_lock locker(lock_);
-        callbacks = callbacks_;
-        callbacks_.clear();
+        callbacks.swap(callbacks_);
     }
     BOOST_FOREACH(CallbackListItem& it, callbacks)
     {
@@ -148,16 +403,20 @@ void AsyncResult::call_callback(unsigned int flag)
 }
 
 void AsyncResult::add_callback(const Callback& callback, unsigned int flag) {
-    bool should_call = false;
+    int status;
     {
+        // finish() changes the status before taking the lock, so that 
+        // a callback is either pushed before the list is taken away, or 
+        // sees the final status here.
         Lock::scoped_lock locker(lock_);
-        if (status_ == WAIT || status_ == RUNNING) {
+        status = status_.load(boost::memory_order_acquire);
+        if (status == WAIT || status == RUNNING) {
             callbacks_.push_back(std::make_pair(flag, callback));
-        } else {
-            should_call = true;
+            return;
         }
     }
-    if (should_call) callback(*this);
+    if (flag & status_flag(status)) 
+        callback(*this);
 }
 
 void AsyncResult::add_all ( const avalon::thread::AsyncResult::Callback& callback )
@@ -185,60 +444,305 @@ void AsyncResult::add_interrupt ( const avalon::thread::AsyncResult::Callback& c
     add_callback(callback, CALLBACK_INTERRUPT);
 }
 
+void AsyncResult::add_expire ( const avalon::thread::AsyncResult::Callback& callback )
+{
+    add_callback(callback, CALLBACK_EXPIRE);
+}
+
 bool AsyncResult::cancel()
 {
-    bool should_call = false;
-    {
-        Lock::scoped_lock locker(lock_);
-        if (status_ == WAIT) {
-            should_call = true;
-            status_ = CANCELLED;
-        }
-    }
-    if (should_call) {
-        call_callback(CALLBACK_CANCEL);
+    if (transit(WAIT, CANCELLED)) {
+        // The task will never run, and nobody else touches it after WAIT.
+        task_.clear();
+        CancelToken* token = token_.load(boost::memory_order_acquire);
+        if (token)
+            token->cancel();
+        finish(CALLBACK_CANCEL);
+        return true;
     }
-    return should_call;
+    
+    // A running task can only be asked to stop.
+    if (status_.load(boost::memory_order_acquire) == RUNNING)
+        token()->cancel();
+    return false;
+}
+
+CancelToken::Ptr AsyncResult::token()
+{
+    CancelToken* token = token_.load(boost::memory_order_acquire);
+    if (token)
+        return token;
+    
+    CancelToken::Ptr created = CancelToken::create(inherited_);
+    intrusive_ptr_add_ref(created.get());
+    if (token_.compare_exchange_strong(token, created.get(), boost::memory_order_acq_rel))
+        return created;
+    
+    // Another thread won, and created is disposed.
+    intrusive_ptr_release(created.get());
+    return token;
+}
+
+bool AsyncResult::cancel_requested() const
+{
+    CancelToken* token = token_.load(boost::memory_order_acquire);
+    if (token)
+        return token->cancelled();
+    return inherited_ && inherited_->cancelled();
+}
+
+CancelToken::Ptr AsyncResult::nearest_token() const
+{
+    CancelToken* token = token_.load(boost::memory_order_acquire);
+    if (token)
+        return token;
+    return inherited_;
+}
+
+void AsyncResult::throw_if_cancelled() const
+{
+    if (cancel_requested())
+        AVALON_THROW(AvalonJobCancelled);
+}
+
+BOOST_NOINLINE AsyncResult* AsyncResult::current()
+{
+    return running_job;
+}
+
+BOOST_NOINLINE AsyncResult* AsyncResult::swap_current(AsyncResult* job)
+{
+    AsyncResult* ret = running_job;
+    running_job = job;
+    return ret;
+}
+
+void AsyncResult::orphan()
+{
+    inherited_.reset();
+}
+
+void AsyncResult::set_deadline(const Clock::time_point& deadline)
+{
+    deadline_ = deadline;
+}
+
+Clock::time_point AsyncResult::deadline() const
+{
+    return deadline_;
+}
+
+void AsyncResult::set_queued_at(const Clock::time_point& when)
+{
+    queued_at_ = when;
+}
+
+Clock::time_point AsyncResult::queued_at() const
+{
+    return queued_at_;
+}
+
+void AsyncResult::set_trace_id(boost::uint64_t id)
+{
+    trace_id_ = id;
+}
+
+boost::uint64_t AsyncResult::trace_id() const
+{
+    return trace_id_;
+}
+
+void AsyncResult::set_slot_key(boost::uint64_t key)
+{
+    slot_key_ = key;
+}
+
+boost::uint64_t AsyncResult::slot_key() const
+{
+    return slot_key_;
 }
 
 bool AsyncResult::execute()
 {
-    bool should_call = false;
-    {
-        Lock::scoped_lock locker(lock_);
-        if (status_ == WAIT) {
-            should_call = true;
-            status_ = RUNNING;
-        }
+    // Only read the clock for jobs which do have a deadline.
+    if (deadline_ != Clock::time_point::max() && Clock::now() >= deadline_) {
+        if (transit(WAIT, EXPIRED))
+            finish(CALLBACK_EXPIRE);
+        return false;
+    }
+    if (cancel_requested()) {
+        if (transit(WAIT, CANCELLED))
+            finish(CALLBACK_CANCEL);
+        return false;
     }
-    if (should_call) {
-        try {
+    if (!transit(WAIT, RUNNING))
+        return false;
+    Tracer::Scope trace(*this);
+    try {
+        {
+            RunningScope running(this);
             task_(*this);
-            set_success();
-        } catch (AvalonException& err) {
-            set_error(&err);
-        } catch (boost::thread_interrupted) {
-            set_interrupt();
-            throw;
-        } catch (...) {
-            set_error();
         }
+        // Only the task reads it, and the chain before must not be pinned.
+        parent_.reset();
+        set_success();
+    } catch (AvalonJobCancelled&) {
+        set_cancelled();
+    } catch (AvalonException& err) {
+        set_error(&err);
+    } catch (boost::thread_interrupted) {
+        set_interrupt();
+        throw;
+    } catch (...) {
+        set_error();
     }
-    return should_call;
+    parent_.reset();
+    return true;
 }
 
-bool AsyncResult::wait(size_t timeout)
+void AsyncResult::fail(const AvalonException* err)
 {
-    Lock::scoped_lock locker(lock_);
-    if (status_ != WAIT && status_ != RUNNING) {
-        return true;
+    // Take the job as if executing it, so nobody else touches exception_.
+    if (transit(WAIT, RUNNING))
+        set_error(err);
+}
+
+AsyncResultPtr AsyncResult::chain(const AsyncResultPtr& child)
+{
+    // A stack or member AsyncResult would be deleted by parent_.
+    if (refs_.load(boost::memory_order_relaxed) <= 0)
+        AVALON_THROW(AvalonOperationForbid);
+    
+    child->parent_ = this;
+    child->inherited_ = nearest_token();
+    // The callback keeps the continuation alive until this job finishes.
+    add_callback(boost::bind(&AsyncResult::continue_handler, child, _1), CALLBACK_ALL);
+    return child;
+}
+
+AsyncResultPtr AsyncResult::then(Executor& executor, const Task& task, ContinueMode mode)
+{
+    // Owned before chain() may throw.
+    AsyncResultPtr child(new AsyncResult(task));
+    // An inline continuation of a finished job would run on the caller's 
+    // thread, so submit it instead.
+    if (mode == CONTINUE_SUBMIT || done())
+        child->executor_ = &executor;
+    return chain(child);
+}
+
+AsyncResultPtr AsyncResult::then(const Task& task)
+{
+    return chain(AsyncResultPtr(new AsyncResult(task)));
+}
+
+const AsyncResultPtr& AsyncResult::parent() const
+{
+    return parent_;
+}
+
+void AsyncResult::continue_handler(AsyncResult& parent)
+{
+    switch (parent.status()) {
+        case SUCCESS:
+            // The continuation shares no token with a parent asked to stop.
+            if (!parent.cancel_requested())
+                break;
+            cancel();
+            parent_.reset();
+            return;
+        case ERROR:
+            fail(parent.exception());
+            parent_.reset();
+            return;
+        default:
+            cancel();
+            parent_.reset();
+            return;
+    }
+    
+    if (!executor_) {
+        run_inline();
+        return;
+    }
+    try {
+        executor_->submit(AsyncResultPtr(this));
+    } catch (AvalonException& err) {
+        // e.g. the pool is full.
+        fail(&err);
+        parent_.reset();
+    }
+}
+
+void AsyncResult::run_inline()
+{
+    // A continuation finished by another one waits for it to return.
+    if (InlineQueue* queue = inline_queue) {
+        intrusive_ptr_add_ref(this);
+        queue_next_ = NULL;
+        if (queue->tail)
+            queue->tail->queue_next_ = this;
+        else
+            queue->head = this;
+        queue->tail = this;
+        return;
+    }
+    
+    InlineQueue queue = { NULL, NULL };
+    inline_queue = &queue;
+    BOOST_SCOPE_EXIT( (&queue) ) {
+        inline_queue = NULL;
+        // Only left over if a task was interrupted.
+        while (AsyncResult* job = queue.head) {
+            queue.head = job->queue_next_;
+            job->queue_next_ = NULL;
+            AsyncResultPtr p(job, false);
+            p->cancel();
+        }
+    } BOOST_SCOPE_EXIT_END
+    
+    dispatch_inline();
+    while (AsyncResult* job = queue.head) {
+        queue.head = job->queue_next_;
+        if (!queue.head)
+            queue.tail = NULL;
+        job->queue_next_ = NULL;
+        AsyncResultPtr p(job, false);
+        p->dispatch_inline();
     }
-    if (timeout)
-        return cond_.timed_wait(locker, boost::posix_time::milliseconds(timeout));
-    else {
-        cond_.wait(locker);
+}
+
+void AsyncResult::dispatch_inline()
+{
+    Tracer::on_submit(*this);
+    execute();
+    parent_.reset();
+}
+
+bool AsyncResult::wait(size_t timeout)
+{
+    if (done())
         return true;
+    
+    WaitLock::scoped_lock locker(wait_lock_);
+    waiters_.fetch_add(1, boost::memory_order_seq_cst);
+    bool ret = true;
+    if (timeout) {
+        boost::system_time until = boost::get_system_time() 
+                                    + boost::posix_time::milliseconds(timeout);
+        while (!done()) {
+            if (!cond_.timed_wait(locker, until)) {
+                ret = done();
+                break;
+            }
+        }
+    } else {
+        while (!done()) {
+            cond_.wait(locker);
+        }
     }
+    waiters_.fetch_sub(1, boost::memory_order_relaxed);
+    return ret;
 }
 
 
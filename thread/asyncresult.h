@@ -23,17 +23,29 @@
 
 #include "../define.h"
 
-#include <list>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/container/small_vector.hpp>
 #include <boost/function.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/detail/spinlock.hpp>
 
 #include "../errors.h"
+#include "canceltoken.h"
+#include "clock.h"
 
 BEGIN_AVALON_NS2(thread)
 
+class Executor;
+class AsyncResult;
+
+/// The job's AsyncResult pointer.
+typedef boost::intrusive_ptr<AsyncResult> AsyncResultPtr;
+
 /// The async result.
 /**
  * This class manages an asynchronous function call, as well as 
@@ -41,6 +53,16 @@ BEGIN_AVALON_NS2(thread)
  * 
  * It is the caller's responsibility to keep AsyncResult alive 
  * when the task is running.
+ * 
+ * AsyncResult is reference counted intrusively by AsyncResultPtr, and 
+ * its memory is recycled through thread-local free lists, so that a 
+ * steady stream of jobs does not hit the allocator. Only AsyncResult 
+ * created by new may be managed by AsyncResultPtr.
+ * 
+ * The free lists are shared by all executors, for a job is created 
+ * before it is submitted, and may be submitted to any executor. A Task 
+ * or Callback whose functor outgrows the small buffer of boost::function 
+ * still allocates, and so do callbacks beyond CALLBACK_INLINE.
  */
 class AsyncResult
     : private boost::noncopyable
@@ -71,7 +93,28 @@ public:
         CANCELLED = 4,
         
         /// The thread in which the task is executed has been interrupted.
-        INTERRUPTED = 5
+        INTERRUPTED = 5,
+        
+        /// The task has been dropped, for its deadline passed before execution.
+        EXPIRED = 6
+    };
+    
+    /// The continuation scheduling mode.
+    enum ContinueMode
+    {
+        /// Run the continuation on the thread which finishes this job.
+        /**
+         * For trivially cheap continuations. If this job has already 
+         * finished, the continuation is submitted to the executor.
+         */
+        CONTINUE_INLINE = 0,
+        
+        /// Submit the continuation to the executor.
+        /**
+         * A ThreadPool in WORK_STEALING mode puts it in the finishing 
+         * worker's own deque, so it runs on the same core.
+         */
+        CONTINUE_SUBMIT = 1
     };
     
     /// The base class for Result.
@@ -124,18 +167,39 @@ public:
     explicit AsyncResult(const Task& task);
     
     /// Dispose the AsyncResult.
-    ~AsyncResult();
+    virtual ~AsyncResult();
+    
+    /// Allocate memory from the free lists of the calling thread.
+    /**
+     * Blocks freed on other threads come back through a process-wide 
+     * depot, in batches.
+     */
+    static void* operator new(std::size_t size);
+    
+    /// Return memory to the free lists.
+    static void operator delete(void* p, std::size_t size);
     
     /// The result status.
     /**
      * It is safe to take actions when the status is SUCCESS, ERROR or CANCELLED.
+     * 
+     * This is a plain atomic load, so it is cheap to poll.
      */
     Status status();
     
+    /// Whether the job has reached a final status.
+    bool done();
+    
     /// The result exception.
+    /**
+     * @return NULL unless the status is ERROR.
+     */
     const AvalonException* exception();
     
     /// Get the result data.
+    /**
+     * @return NULL if there is no result, or the result is not a T.
+     */
     template <typename T>
     typename Result<T>::DataPtr get_result();
     
@@ -157,13 +221,69 @@ public:
     
     /// Set the status to cancelled, and execute callbacks.
     /**
-     * If the job has already executed, or is running, then the method 
-     * do nothing.
+     * If the job is running, its token is cancelled instead, so that the 
+     * task can stop early. If the job has already executed, then the 
+     * method do nothing.
+     * 
+     * A job cancelled while waiting releases its task at once, so a 
+     * queue which still holds the job does not keep the closure alive.
      * 
      * @return true if did cancel, otherwise false.
      */
     bool cancel();
     
+    /// The cancellation token of the job.
+    /**
+     * Created on first use. It is a child of the token of the job which 
+     * was running on the constructing thread, so cancelling a job reaches 
+     * the jobs it spawned. A job which spawns creates its token once; the 
+     * spawned jobs only share it until they need their own.
+     * 
+     * A continuation inherits the nearest existing token of the job it 
+     * is chained to, and is cancelled if that job's cancellation was 
+     * requested when it finishes, so chaining allocates no token.
+     */
+    CancelToken::Ptr token();
+    
+    /// Whether cancellation of the job has been requested.
+    /**
+     * One or two atomic loads, cheap enough to poll in a task loop. 
+     * A job whose cancellation is requested before it starts becomes 
+     * CANCELLED without being executed.
+     */
+    bool cancel_requested() const;
+    
+    /// Stop the task if cancellation has been requested.
+    /**
+     * The job then finishes with CANCELLED, instead of ERROR.
+     * 
+     * @throw AvalonJobCancelled.
+     */
+    void throw_if_cancelled() const;
+    
+    /// The job running on the calling thread.
+    /**
+     * @return NULL if called outside a task.
+     */
+    static AsyncResult* current();
+    
+    /// Replace the job running on the calling thread.
+    /**
+     * For schedulers which switch stacks within a thread, so that each 
+     * stack keeps its own current job.
+     * 
+     * @return The job which was current.
+     */
+    static AsyncResult* swap_current(AsyncResult* job);
+    
+    /// Forget the token inherited from the spawning job.
+    /**
+     * For the internal jobs of schedulers, which belong to no caller, 
+     * and must not be dropped when the caller is cancelled. Call it 
+     * before the job is submitted, or its token used.
+     */
+    void orphan();
+    
     /// Add callback on success.
     /**
      * Add the callback to callback list if current status is 
@@ -196,6 +316,14 @@ public:
      */
     void add_interrupt(const Callback& callback);
     
+    /// Add callback on expire.
+    /**
+     * Add the callback to callback list if current status is 
+     * WAIT or RUNNING, otherwise execute the callback immediately 
+     * if the status is EXPIRED.
+     */
+    void add_expire(const Callback& callback);
+    
     /// Add calback on all events.
     /**
      * Add the callback to callback list if current status is 
@@ -208,10 +336,93 @@ public:
      * Only if the AsyncResult's status is WAIT, then the task will be called.
      * And, according to the status, callbacks will be executed.
      * 
+     * If the deadline has passed, the job becomes EXPIRED instead, and 
+     * the task is not called.
+     * 
      * @return True if really executed, otherwise false.
      */
     bool execute();
     
+    /// Set the time after which the job is dropped instead of executed.
+    /**
+     * Should be set before submitting. Pools check it when the job is 
+     * taken from the queue, so a job which waited too long costs no 
+     * more than a clock read.
+     */
+    void set_deadline(const Clock::time_point& deadline);
+    
+    /// The deadline.
+    /**
+     * @return Clock::time_point::max() if there is no deadline.
+     */
+    Clock::time_point deadline() const;
+    
+    /// Record the time the job entered a queue.
+    /**
+     * Set by executors which measure queue wait.
+     */
+    void set_queued_at(const Clock::time_point& when);
+    
+    /// The time the job entered a queue.
+    /**
+     * @return Clock::time_point() if not recorded.
+     */
+    Clock::time_point queued_at() const;
+    
+    /// Set the trace id. Set by Tracer for sampled jobs.
+    void set_trace_id(boost::uint64_t id);
+    
+    /// The trace id.
+    /**
+     * @return Zero if the job is not traced.
+     */
+    boost::uint64_t trace_id() const;
+    
+    /// Set the key of the job in its executor's registry.
+    void set_slot_key(boost::uint64_t key);
+    
+    /// The key of the job in its executor's registry.
+    /**
+     * @return Zero if the job is not registered.
+     */
+    boost::uint64_t slot_key() const;
+    
+    /// Chain a continuation, which is executed after this job succeeded.
+    /**
+     * If this job finishes with ERROR, the continuation finishes with 
+     * the same exception without being executed. If this job is cancelled, 
+     * interrupted or expired, the continuation is cancelled.
+     * 
+     * The continuation's task may reach this job via parent(). This job 
+     * must be managed by AsyncResultPtr.
+     * 
+     * @param executor The executor to run the continuation.
+     * @param task The continuation.
+     * @param mode Whether to run inline or submit to the executor.
+     * @return The continuation's AsyncResult.
+     * @throw AvalonOperationForbid If this job is not managed by AsyncResultPtr.
+     */
+    AsyncResultPtr then(Executor& executor, const Task& task, 
+                        ContinueMode mode = CONTINUE_SUBMIT);
+    
+    /// Chain a continuation, which is always executed inline.
+    /**
+     * The continuation runs on the thread which finishes this job, or on 
+     * the caller's thread if this job has already finished. Inline 
+     * continuations finished by another inline continuation are run one 
+     * after another, so a long chain does not grow the stack.
+     */
+    AsyncResultPtr then(const Task& task);
+    
+    /// The job this continuation is chained to.
+    /**
+     * Released once the continuation has run or been dropped, so a chain 
+     * does not pin the jobs before it.
+     * 
+     * @return NULL if this job is not a continuation, or it is over.
+     */
+    const AsyncResultPtr& parent() const;
+    
     /// Wait for the job to be finished.
     /**
      * Wait only if the AsyncResult's status is RUNNING or WAIT. When timeout 
@@ -225,33 +436,40 @@ public:
 protected:
     /// The lock type.
     /**
-     * At first I attempted to use spinlock, just as shared_ptr or some 
-     * other objects. But later I realized, that AsyncResult may be used 
-     * in many * many threads.
-     * 
-     * According to a brief test,
-     * http://www.searchtb.com/2011/01/pthreads-mutex-vs-pthread-spinlock.html,
-     * the efficiency decreased dramatically even if there are only about 10 
-     * threads. 
-     * 
-     * Even in single-thread environment, the speed of mutex is just ok for 
-     * server applications. In test/speed_workpool.cpp, 10,000,000 mutex lock 
-     * uses 0.6s on my laptop.
-     * 
-     * Another reason is, mutex supports condition_variable.
+     * The status is an atomic state machine: WAIT -> RUNNING -> {SUCCESS, 
+     * ERROR, INTERRUPTED}, or WAIT -> {CANCELLED, EXPIRED}. Each transition 
+     * is a single compare-and-swap, so status() never takes a lock.
      * 
-     * So I chose mutex later.
+     * This lock only guards the callback list and the result object. 
+     * Each is touched a few times during the job's life, so contention 
+     * is rare and a spinlock is enough.
      */
-    typedef boost::mutex Lock;
+    typedef boost::detail::spinlock Lock;
     
-    /// The spin lock for status.
+    /// The lock type for waiting.
+    /**
+     * Only taken by wait(), and by the finishing thread if somebody is 
+     * actually waiting. mutex supports condition_variable.
+     */
+    typedef boost::mutex WaitLock;
+    
+    /// The spin lock for callbacks and result.
     Lock lock_;
     
+    /// The lock for cond_.
+    WaitLock wait_lock_;
+    
     /// The condition variable to notify that the job has been done.
     boost::condition_variable cond_;
     
+    /// The number of threads blocked in wait().
+    boost::atomic<unsigned int> waiters_;
+    
     /// The status.
-    Status status_;
+    boost::atomic<int> status_;
+    
+    /// The reference count for AsyncResultPtr.
+    boost::atomic<int> refs_;
     
     /// The function call.
     Task task_;
@@ -268,15 +486,30 @@ protected:
     /// The interrupt callback flag.
     static const unsigned int CALLBACK_INTERRUPT = 0x8;
     
+    /// The expire callback flag.
+    static const unsigned int CALLBACK_EXPIRE = 0x10;
+    
     /// The full callback flag.
     static const unsigned int CALLBACK_ALL = CALLBACK_SUCCESS | CALLBACK_ERROR
-                                                | CALLBACK_CANCEL | CALLBACK_INTERRUPT;
+                                                | CALLBACK_CANCEL | CALLBACK_INTERRUPT
+                                                | CALLBACK_EXPIRE;
     
     /// The callback list item.
     typedef std::pair<unsigned int, Callback> CallbackListItem;
     
+    /// The number of callbacks stored inline.
+    /**
+     * Nearly every job has a user callback and a pool handler, plus 
+     * maybe a continuation.
+     */
+    static const size_t CALLBACK_INLINE = 3;
+    
     /// The callback list type.
-    typedef std::list<CallbackListItem> CallbackList;
+    /**
+     * The first few callbacks are stored inside AsyncResult, so adding 
+     * them does not allocate.
+     */
+    typedef boost::container::small_vector<CallbackListItem, CALLBACK_INLINE> CallbackList;
     
     /// The callback list.
     CallbackList callbacks_;
@@ -284,6 +517,33 @@ protected:
     /// The error object.
     boost::shared_ptr<AvalonException> exception_;
     
+    /// The job this continuation is chained to.
+    AsyncResultPtr parent_;
+    
+    /// The executor to run this continuation. NULL means inline.
+    Executor* executor_;
+    
+    /// The deadline. max() means none.
+    Clock::time_point deadline_;
+    
+    /// The time the job entered a queue.
+    Clock::time_point queued_at_;
+    
+    /// The trace id. Zero means not traced.
+    boost::uint64_t trace_id_;
+    
+    /// The registry key. Zero means none.
+    boost::uint64_t slot_key_;
+    
+    /// The token of the job, holding a reference. NULL until used.
+    boost::atomic<CancelToken*> token_;
+    
+    /// The token inherited from the spawning or preceding job.
+    CancelToken::Ptr inherited_;
+    
+    /// The next job in a JobQueue, or in the inline continuation queue.
+    AsyncResult* queue_next_;
+    
     /// The result object.
     boost::shared_ptr<ResultBase> result_;
     
@@ -302,6 +562,27 @@ protected:
     /// Set the status to interrupted, and execute callbacks.
     void set_interrupt();
     
+    /// Set the status of a running job to cancelled, and execute callbacks.
+    void set_cancelled();
+    
+    /// Set the error of a waiting job without executing it.
+    void fail(const AvalonException* err);
+    
+    /// The own token if created, otherwise the inherited one.
+    CancelToken::Ptr nearest_token() const;
+    
+    /// Chain a continuation to this job.
+    AsyncResultPtr chain(const AsyncResultPtr& child);
+    
+    /// The parent callback to start this continuation.
+    void continue_handler(AsyncResult& parent);
+    
+    /// Run this continuation inline, or queue it if one is running already.
+    void run_inline();
+    
+    /// Execute this continuation inline and release its parent.
+    void dispatch_inline();
+    
     /// Add calback on all events.
     /**
      * Add the callback to callback list if current status is 
@@ -309,12 +590,40 @@ protected:
      */
     void add_callback(const Callback& callback, unsigned int flag);
     
+    /// Change the status from one to another atomically.
+    /**
+     * @return true if the status was from and has been changed.
+     */
+    bool transit(Status from, Status to);
+    
+    /// Wake up waiters and execute callbacks, after a final status is set.
+    void finish(unsigned int flag);
+    
     /// Execute the callbacks match flag modifier.
     void call_callback(unsigned int flag);
+    
+    /// Get the callback flag for a final status.
+    static unsigned int status_flag(int status);
+    
+    friend class JobQueue;
+    friend void intrusive_ptr_add_ref(AsyncResult* p);
+    friend void intrusive_ptr_release(AsyncResult* p);
 };
 
-/// The job's AsyncResult shared_ptr.
-typedef boost::shared_ptr<AsyncResult> AsyncResultPtr;
+/// Increase the reference count.
+inline void intrusive_ptr_add_ref(AsyncResult* p)
+{
+    p->refs_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+/// Decrease the reference count, and dispose the AsyncResult on zero.
+inline void intrusive_ptr_release(AsyncResult* p)
+{
+    if (p->refs_.fetch_sub(1, boost::memory_order_release) == 1) {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        delete p;
+    }
+}
 
 END_AVALON_NS2
 
@@ -33,7 +33,8 @@ AsyncResult::Result<T>::Result(const AsyncResult::Result<T>& other)
 template <typename T>
 AsyncResult::Result<T>& AsyncResult::Result<T>::operator=(const AsyncResult::Result<T>& other)
 {
-    result_ = other._result;
+    result_ = other.result_;
+    return *this;
 }
 
 template <typename T>
@@ -63,7 +64,7 @@ template <typename T>
 typename AsyncResult::Result<T>::DataPtr AsyncResult::get_result()
 {
     Lock::scoped_lock locker(lock_);
-    Result<T>* res = (Result<T>*)result_.get();
+    Result<T>* res = dynamic_cast<Result<T>*>(result_.get());
     if (!res) 
         return typename AsyncResult::Result<T>::DataPtr();
     return res->data();
@@ -72,15 +73,18 @@ typename AsyncResult::Result<T>::DataPtr AsyncResult::get_result()
 template <typename T>
 void AsyncResult::set_result(T* data)
 {
+    // release the old result out of the spinlock.
+    boost::shared_ptr<ResultBase> result(new Result<T>(data));
     Lock::scoped_lock locker(lock_);
-    result_.reset(new Result<T>(data));
+    result_.swap(result);
 }
 
 template <typename T>
 void AsyncResult::set_result(const typename Result<T>::DataPtr &data)
 {
+    boost::shared_ptr<ResultBase> result(new Result<T>(data));
     Lock::scoped_lock locker(lock_);
-    result_.reset(new Result<T>(data));
+    result_.swap(result);
 }
 
 END_AVALON_NS2
@@ -0,0 +1,167 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "autoscaler.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/chrono/duration.hpp>
+
+#include "errors.h"
+
+BEGIN_AVALON_NS2(thread)
+
+AutoScaler::Options::Options()
+ :  min_workers(1),
+    max_workers(16),
+    interval(100),
+    grow_wait(10.0),
+    shrink_utilisation(0.3),
+    grow_samples(2),
+    shrink_samples(10),
+    grow_step(2),
+    shrink_step(1)
+{
+}
+
+AutoScaler::AutoScaler(ThreadPool& pool, const Options& options)
+ :  pool_(pool),
+    options_(options),
+    grow_streak_(0),
+    shrink_streak_(0),
+    lock_(),
+    cond_(),
+    stopping_(false),
+    thread_()
+{
+    if (options_.min_workers < 1 || options_.min_workers > options_.max_workers)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("options") );
+    // add_workers() would throw from the scaler thread otherwise.
+    if (pool_.mode() == ThreadPool::WORK_STEALING && 
+        options_.max_workers > ThreadPool::MAX_STEALING_WORKERS)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("options") );
+    pool_.set_timing(true);
+    pool_.take_load_stats();
+}
+
+AutoScaler::~AutoScaler()
+{
+    stop();
+}
+
+void AutoScaler::start()
+{
+    Lock::scoped_lock locker(lock_);
+    if (thread_)
+        return;
+    stopping_ = false;
+    thread_.reset(new boost::thread(boost::bind(&AutoScaler::run_thread, this)));
+}
+
+void AutoScaler::stop()
+{
+    boost::shared_ptr<boost::thread> thread;
+    {
+        Lock::scoped_lock locker(lock_);
+        if (!thread_ || stopping_)
+            return;
+        stopping_ = true;
+        thread = thread_;
+        cond_.notify_all();
+    }
+    thread->join();
+    
+    Lock::scoped_lock locker(lock_);
+    thread_.reset();
+}
+
+const AutoScaler::Options& AutoScaler::options() const
+{
+    return options_;
+}
+
+int AutoScaler::sample()
+{
+    typedef boost::chrono::duration<double, boost::milli> Milliseconds;
+    ThreadPool::LoadStats stats = pool_.take_load_stats();
+    size_t workers = stats.workers;
+    
+    // Bounds first, e.g. after the pool was resized by hand.
+    if (workers < options_.min_workers) {
+        pool_.add_workers(options_.min_workers - workers);
+        return (int)(options_.min_workers - workers);
+    }
+    if (workers > options_.max_workers) {
+        pool_.reduce_workers(workers - options_.max_workers);
+        return -(int)(workers - options_.max_workers);
+    }
+    
+    double wait = stats.executed ? 
+        Milliseconds(stats.wait_time).count() / stats.executed : 0.0;
+    double utilisation = stats.elapsed.count() > 0 ?
+        Milliseconds(stats.busy_time).count() 
+            / (Milliseconds(stats.elapsed).count() * workers) : 0.0;
+    
+    // Jobs queued but none finished within the interval also means 
+    // the pool is behind.
+    bool behind = wait >= options_.grow_wait || (!stats.executed && stats.jobs > workers);
+    if (behind && workers < options_.max_workers) {
+        shrink_streak_ = 0;
+        if (++grow_streak_ < options_.grow_samples)
+            return 0;
+        grow_streak_ = 0;
+        size_t n = std::min(options_.grow_step, options_.max_workers - workers);
+        pool_.add_workers(n);
+        return (int)n;
+    }
+    
+    grow_streak_ = 0;
+    bool idle = utilisation < options_.shrink_utilisation && wait < options_.grow_wait / 2;
+    if (idle && workers > options_.min_workers) {
+        if (++shrink_streak_ < options_.shrink_samples)
+            return 0;
+        shrink_streak_ = 0;
+        size_t n = std::min(options_.shrink_step, workers - options_.min_workers);
+        pool_.reduce_workers(n);
+        return -(int)n;
+    }
+    shrink_streak_ = 0;
+    return 0;
+}
+
+void AutoScaler::run_thread()
+{
+    boost::unique_lock<Lock> locker(lock_);
+    while (!stopping_) {
+        cond_.wait_for(locker, boost::chrono::milliseconds(options_.interval));
+        if (stopping_)
+            break;
+        locker.unlock();
+        try {
+            sample();
+        } catch (AvalonException&) {
+            // e.g. the pool refused to grow; try again next interval.
+        }
+        locker.lock();
+    }
+}
+
+END_AVALON_NS2
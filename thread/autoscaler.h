@@ -0,0 +1,147 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_AUTOSCALER_H
+#define THREAD_AUTOSCALER_H
+
+#include "../define.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "threadpool.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// Resize a ThreadPool according to its load.
+/**
+ * Every interval, the scaler takes the pool's load counters. The mean 
+ * queue wait of the executed jobs decides when to grow, and the worker 
+ * utilisation (busy time / workers / elapsed) decides when to shrink. 
+ * A decision needs several samples in a row, and the pool must be well 
+ * below the grow threshold to shrink, so the size does not flap.
+ * 
+ * Retired workers exit between two jobs, without exceptions.
+ */
+class AutoScaler : private boost::noncopyable
+{
+public:
+    /// The scaling options.
+    struct Options
+    {
+        /// Create the default options.
+        Options();
+        
+        /// The minimum worker count.
+        size_t min_workers;
+        
+        /// The maximum worker count.
+        size_t max_workers;
+        
+        /// The milliseconds between two samples.
+        size_t interval;
+        
+        /// The mean queue wait in milliseconds, above which to grow.
+        double grow_wait;
+        
+        /// The utilisation, below which to shrink.
+        double shrink_utilisation;
+        
+        /// The samples in a row needed to grow.
+        size_t grow_samples;
+        
+        /// The samples in a row needed to shrink.
+        size_t shrink_samples;
+        
+        /// The workers added at once.
+        size_t grow_step;
+        
+        /// The workers removed at once.
+        size_t shrink_step;
+    };
+    
+    /// Create a scaler of the pool.
+    /**
+     * Enables the load counters of the pool.
+     * 
+     * @throw AvalonInvalidArgument if the worker bounds are empty, or 
+     *      beyond what the pool can hold.
+     */
+    explicit AutoScaler(ThreadPool& pool, const Options& options = Options());
+    
+    /// Stop the scaler.
+    ~AutoScaler();
+    
+    /// Start sampling in a background thread.
+    void start();
+    
+    /// Stop sampling.
+    void stop();
+    
+    /// Take one sample, and resize the pool if needed.
+    /**
+     * Called by the background thread, but may also be driven by hand.
+     * 
+     * @return The worker count change.
+     */
+    int sample();
+    
+    /// The options.
+    const Options& options() const;
+    
+protected:
+    /// The lock type.
+    typedef boost::mutex Lock;
+    
+    /// The pool.
+    ThreadPool& pool_;
+    
+    /// The options.
+    const Options options_;
+    
+    /// The samples in a row which wanted to grow.
+    size_t grow_streak_;
+    
+    /// The samples in a row which wanted to shrink.
+    size_t shrink_streak_;
+    
+    /// Guards the thread state.
+    Lock lock_;
+    
+    /// Notifies the thread to exit.
+    boost::condition_variable cond_;
+    
+    /// Whether the thread should exit.
+    bool stopping_;
+    
+    /// The sampling thread.
+    boost::shared_ptr<boost::thread> thread_;
+    
+    /// The sampling loop.
+    void run_thread();
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_AUTOSCALER_H
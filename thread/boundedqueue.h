@@ -0,0 +1,110 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef THREAD_BOUNDEDQUEUE_H
+#define THREAD_BOUNDEDQUEUE_H
+
+#include "../define.h"
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The lock-free bounded multi-producer multi-consumer queue.
+/**
+ * This is Dmitry Vyukov's bounded MPMC queue. Each cell carries a
+ * sequence number, so that a push or pop costs one CAS on the position
+ * counter, and no memory is allocated after construction.
+ *
+ * The cell is exclusively owned between the CAS and the sequence store,
+ * so T can be any copyable type (e.g. AsyncResultPtr).
+ */
+template <typename T>
+class BoundedQueue : private boost::noncopyable
+{
+public:
+    /// Create a new queue.
+    /**
+     * @param capacity The queue capacity. Will be rounded up to power of 2.
+     */
+    explicit BoundedQueue(size_t capacity);
+
+    /// Dispose the queue.
+    ~BoundedQueue();
+
+    /// Push an item.
+    /**
+     * @return false if the queue is full.
+     */
+    bool push(const T& item);
+
+    /// Pop an item.
+    /**
+     * @return false if the queue is empty.
+     */
+    bool pop(T& item);
+
+    /// Approximate item count.
+    size_t size() const;
+
+    /// Whether the queue looks empty.
+    bool empty() const;
+
+    /// The queue capacity.
+    size_t capacity() const;
+
+protected:
+    /// The queue cell.
+    struct Cell
+    {
+        boost::atomic<size_t> sequence;
+        T data;
+    };
+
+    char pad0_[AVALON_CACHE_LINE];
+
+    /// The cells.
+    Cell* const buffer_;
+
+    /// The index mask.
+    const size_t mask_;
+
+    char pad1_[AVALON_CACHE_LINE];
+
+    /// The next position to push.
+    boost::atomic<size_t> enqueue_pos_;
+
+    char pad2_[AVALON_CACHE_LINE];
+
+    /// The next position to pop.
+    boost::atomic<size_t> dequeue_pos_;
+
+    char pad3_[AVALON_CACHE_LINE];
+
+    /// Round up to power of 2.
+    static size_t round_up(size_t n);
+};
+
+END_AVALON_NS2
+
+#include "boundedqueue.tpl.h"
+
+#endif // THREAD_BOUNDEDQUEUE_H
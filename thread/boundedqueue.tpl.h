@@ -0,0 +1,125 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef THREAD_BOUNDEDQUEUE_TPL_H
+#define THREAD_BOUNDEDQUEUE_TPL_H
+
+#include "boundedqueue.h"
+
+#include <boost/swap.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+template <typename T>
+size_t BoundedQueue<T>::round_up(size_t n)
+{
+    size_t ret = 2;
+    while (ret < n) ret <<= 1;
+    return ret;
+}
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+ :  buffer_(new Cell[round_up(capacity)]),
+    mask_(round_up(capacity) - 1),
+    enqueue_pos_(0),
+    dequeue_pos_(0)
+{
+    for (size_t i=0; i<=mask_; i++) {
+        buffer_[i].sequence.store(i, boost::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+BoundedQueue<T>::~BoundedQueue()
+{
+    delete[] buffer_;
+}
+
+template <typename T>
+bool BoundedQueue<T>::push(const T& item)
+{
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(boost::memory_order_relaxed);
+    for (;;) {
+        cell = &buffer_[pos & mask_];
+        size_t seq = cell->sequence.load(boost::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos_.load(boost::memory_order_relaxed);
+        }
+    }
+    cell->data = item;
+    cell->sequence.store(pos + 1, boost::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool BoundedQueue<T>::pop(T& item)
+{
+    Cell* cell;
+    size_t pos = dequeue_pos_.load(boost::memory_order_relaxed);
+    for (;;) {
+        cell = &buffer_[pos & mask_];
+        size_t seq = cell->sequence.load(boost::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, boost::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = dequeue_pos_.load(boost::memory_order_relaxed);
+        }
+    }
+    // do not keep a reference in the cell.
+    boost::swap(item, cell->data);
+    cell->data = T();
+    cell->sequence.store(pos + mask_ + 1, boost::memory_order_release);
+    return true;
+}
+
+template <typename T>
+size_t BoundedQueue<T>::size() const
+{
+    size_t head = dequeue_pos_.load(boost::memory_order_relaxed);
+    size_t tail = enqueue_pos_.load(boost::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+template <typename T>
+bool BoundedQueue<T>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename T>
+size_t BoundedQueue<T>::capacity() const
+{
+    return mask_ + 1;
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_BOUNDEDQUEUE_TPL_H
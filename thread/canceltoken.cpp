@@ -0,0 +1,168 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "canceltoken.h"
+
+BEGIN_AVALON_NS2(thread)
+
+CancelToken::CancelToken(const Ptr& parent)
+ :  cancelled_(false),
+    refs_(0),
+    lock_(),
+    callbacks_(),
+    next_registration_(1),
+    parent_(parent),
+    children_(NULL),
+    prev_(NULL),
+    next_(NULL)
+{
+}
+
+CancelToken::~CancelToken()
+{
+    CancelToken* parent = parent_.detach();
+    unlink(parent);
+    
+    // Release the ancestors in a loop, for a deep tree would be freed 
+    // recursively. A detached token does nothing in its destructor.
+    while (parent && parent->refs_.fetch_sub(1, boost::memory_order_release) == 1) {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        CancelToken* grand = parent->parent_.detach();
+        parent->unlink(grand);
+        delete parent;
+        parent = grand;
+    }
+}
+
+void CancelToken::unlink(CancelToken* parent)
+{
+    if (!parent) return;
+    Lock::scoped_lock locker(parent->lock_);
+    if (prev_)
+        prev_->next_ = next_;
+    else
+        parent->children_ = next_;
+    if (next_)
+        next_->prev_ = prev_;
+}
+
+CancelToken::Ptr CancelToken::create(const Ptr& parent)
+{
+    Ptr ret(new CancelToken(parent));
+    if (!parent)
+        return ret;
+    
+    // The parent sets its flag before walking the children, so either it 
+    // finds this child, or this child finds the flag.
+    bool cancelled;
+    {
+        Lock::scoped_lock locker(parent->lock_);
+        ret->next_ = parent->children_;
+        if (parent->children_)
+            parent->children_->prev_ = ret.get();
+        parent->children_ = ret.get();
+        cancelled = parent->cancelled();
+    }
+    if (cancelled)
+        ret->cancel();
+    return ret;
+}
+
+bool CancelToken::cancel()
+{
+    bool expected = false;
+    if (!cancelled_.compare_exchange_strong(expected, true))
+        return false;
+    
+    // Descendants are walked with an explicit stack, for a deep tree 
+    // would overflow the thread's.
+    std::vector<Ptr> pending;
+    fire(pending);
+    while (!pending.empty()) {
+        Ptr token;
+        token.swap(pending.back());
+        pending.pop_back();
+        expected = false;
+        if (token->cancelled_.compare_exchange_strong(expected, true))
+            token->fire(pending);
+    }
+    return true;
+}
+
+void CancelToken::fire(std::vector<Ptr>& children)
+{
+    Callbacks callbacks;
+    {
+        Lock::scoped_lock locker(lock_);
+        callbacks.swap(callbacks_);
+        for (CancelToken* child = children_; child; child = child->next_) {
+            if (try_add_ref(child))
+                children.push_back(Ptr(child, false));
+        }
+    }
+    
+    for (size_t i=0; i<callbacks.size(); i++) {
+        callbacks[i].second();
+    }
+}
+
+CancelToken::Registration CancelToken::add_callback(const Callback& callback)
+{
+    {
+        Lock::scoped_lock locker(lock_);
+        if (!cancelled()) {
+            Registration ret = next_registration_++;
+            callbacks_.push_back(std::make_pair(ret, callback));
+            return ret;
+        }
+    }
+    callback();
+    return 0;
+}
+
+bool CancelToken::remove_callback(Registration registration)
+{
+    Lock::scoped_lock locker(lock_);
+    for (Callbacks::iterator it=callbacks_.begin(); it!=callbacks_.end(); it++) {
+        if (it->first == registration) {
+            callbacks_.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+const CancelToken::Ptr& CancelToken::parent() const
+{
+    return parent_;
+}
+
+bool CancelToken::try_add_ref(CancelToken* p)
+{
+    int refs = p->refs_.load(boost::memory_order_relaxed);
+    while (refs > 0) {
+        if (p->refs_.compare_exchange_weak(refs, refs + 1, boost::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+END_AVALON_NS2
@@ -0,0 +1,172 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_CANCELTOKEN_H
+#define THREAD_CANCELTOKEN_H
+
+#include "../define.h"
+
+#include <vector>
+#include <utility>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/detail/spinlock.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// A cooperative cancellation request.
+/**
+ * A running task cannot be stopped from outside, but it can poll 
+ * cancelled(), which is one atomic load, and return early. Callbacks 
+ * can be registered to wake up whatever the task is blocked on.
+ * 
+ * Tokens form a tree: cancelling a token cancels all its descendants, 
+ * but not its parent. A child keeps its parent alive, and the parent 
+ * only knows its children weakly, so abandoned subtrees are freed.
+ */
+class CancelToken : private boost::noncopyable
+{
+public:
+    /// The CancelToken pointer type.
+    typedef boost::intrusive_ptr<CancelToken> Ptr;
+    
+    /// The cancellation callback type.
+    typedef boost::function<void ()> Callback;
+    
+    /// The handle of a registered callback.
+    typedef boost::uint64_t Registration;
+    
+    /// Create a token.
+    /**
+     * @param parent The token whose cancellation reaches this one. 
+     *      If it is already cancelled, so is the new token.
+     */
+    static Ptr create(const Ptr& parent = Ptr());
+    
+    /// Dispose the token, and unlink it from its parent.
+    ~CancelToken();
+    
+    /// Whether cancellation has been requested.
+    bool cancelled() const
+    {
+        return cancelled_.load(boost::memory_order_acquire);
+    }
+    
+    /// Request cancellation.
+    /**
+     * Runs the callbacks on the calling thread, then cancels the 
+     * descendants, in a loop rather than recursively. Later calls do 
+     * nothing.
+     * 
+     * @return true if this call did cancel.
+     */
+    bool cancel();
+    
+    /// Register a callback on cancellation.
+    /**
+     * If the token is already cancelled, the callback is executed 
+     * immediately.
+     * 
+     * @return The handle to remove the callback, or zero if it has run.
+     */
+    Registration add_callback(const Callback& callback);
+    
+    /// Remove a callback.
+    /**
+     * @return false if the callback has run, or is running.
+     */
+    bool remove_callback(Registration registration);
+    
+    /// The parent token.
+    const Ptr& parent() const;
+    
+private:
+    /// The lock type. Held only to touch the lists.
+    typedef boost::detail::spinlock Lock;
+    
+    /// The callback list type.
+    typedef std::vector< std::pair<Registration, Callback> > Callbacks;
+    
+    /// Whether cancellation has been requested.
+    boost::atomic<bool> cancelled_;
+    
+    /// The reference count.
+    boost::atomic<int> refs_;
+    
+    /// The lock of callbacks_ and the children list.
+    mutable Lock lock_;
+    
+    /// The registered callbacks.
+    Callbacks callbacks_;
+    
+    /// The handle of the next callback.
+    Registration next_registration_;
+    
+    /// The parent token.
+    Ptr parent_;
+    
+    /// The first child. Guarded by lock_.
+    CancelToken* children_;
+    
+    /// The siblings. Guarded by the lock_ of parent_.
+    CancelToken* prev_;
+    CancelToken* next_;
+    
+    /// Create a token.
+    explicit CancelToken(const Ptr& parent);
+    
+    /// Take a reference, unless the token is being disposed.
+    static bool try_add_ref(CancelToken* p);
+    
+    /// Run the callbacks, and take references to the children.
+    /**
+     * The flag must have been set by the caller.
+     */
+    void fire(std::vector<Ptr>& children);
+    
+    /// Remove this token from the children list of parent.
+    void unlink(CancelToken* parent);
+    
+    friend void intrusive_ptr_add_ref(CancelToken* p);
+    friend void intrusive_ptr_release(CancelToken* p);
+};
+
+/// Increase the reference count.
+inline void intrusive_ptr_add_ref(CancelToken* p)
+{
+    p->refs_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+/// Decrease the reference count, and dispose the CancelToken on zero.
+inline void intrusive_ptr_release(CancelToken* p)
+{
+    if (p->refs_.fetch_sub(1, boost::memory_order_release) == 1) {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        delete p;
+    }
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_CANCELTOKEN_H
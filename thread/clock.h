@@ -0,0 +1,46 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_CLOCK_H
+#define THREAD_CLOCK_H
+
+#include "../define.h"
+
+#include <boost/chrono/system_clocks.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The monotonic clock for deadlines and timers.
+/**
+ * Not affected by changes of the wall clock, so a deadline never 
+ * jumps back or forth.
+ */
+typedef boost::chrono::steady_clock Clock;
+
+/// The time point after some milliseconds from now.
+inline Clock::time_point deadline_after(size_t milliseconds)
+{
+    return Clock::now() + boost::chrono::milliseconds(milliseconds);
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_CLOCK_H
@@ -0,0 +1,118 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "combinators.h"
+
+#include <boost/bind.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The JoinResult task, which has nothing to do.
+    void join_task(AsyncResult&)
+    {
+    }
+}
+
+JoinResult::JoinResult(const std::vector<AsyncResultPtr>& jobs, Mode mode)
+ :  AsyncResult(join_task),
+    jobs_(jobs),
+    pending_(jobs.size()),
+    first_(NULL),
+    mode_(mode)
+{
+}
+
+JoinResult::~JoinResult()
+{
+}
+
+JoinResult::Ptr JoinResult::create(const std::vector<AsyncResultPtr>& jobs, Mode mode)
+{
+    Ptr ret(new JoinResult(jobs, mode));
+    if (jobs.empty()) {
+        ret->execute();
+        return ret;
+    }
+
+    // Each job keeps the JoinResult alive until its callback is done.
+    for (size_t i=0; i<jobs.size(); i++) {
+        intrusive_ptr_add_ref(ret.get());
+    }
+    for (size_t i=0; i<jobs.size(); i++) {
+        jobs[i]->add_all(boost::bind(&JoinResult::job_handler, ret.get(), _1));
+    }
+    return ret;
+}
+
+const std::vector<AsyncResultPtr>& JoinResult::jobs() const
+{
+    return jobs_;
+}
+
+size_t JoinResult::first() const
+{
+    AsyncResult* first = first_.load(boost::memory_order_acquire);
+    for (size_t i=0; i<jobs_.size(); i++) {
+        if (jobs_[i].get() == first)
+            return i;
+    }
+    return jobs_.size();
+}
+
+size_t JoinResult::pending() const
+{
+    return pending_.load(boost::memory_order_acquire);
+}
+
+size_t JoinResult::cancel_jobs()
+{
+    size_t ret = 0;
+    for (size_t i=0; i<jobs_.size(); i++) {
+        if (jobs_[i]->cancel())
+            ret++;
+    }
+    return ret;
+}
+
+void JoinResult::job_handler(AsyncResult& job)
+{
+    // adopt the reference taken by create().
+    Ptr self(this, false);
+
+    AsyncResult* expected = NULL;
+    bool is_first = first_.compare_exchange_strong(expected, &job, boost::memory_order_acq_rel);
+    bool is_last = pending_.fetch_sub(1, boost::memory_order_acq_rel) == 1;
+
+    if ((mode_ == JOIN_ANY && is_first) || (mode_ == JOIN_ALL && is_last))
+        execute();
+}
+
+JoinResult::Ptr when_all(const std::vector<AsyncResultPtr>& jobs)
+{
+    return JoinResult::create(jobs, JoinResult::JOIN_ALL);
+}
+
+JoinResult::Ptr when_any(const std::vector<AsyncResultPtr>& jobs)
+{
+    return JoinResult::create(jobs, JoinResult::JOIN_ANY);
+}
+
+END_AVALON_NS2
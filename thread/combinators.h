@@ -0,0 +1,138 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef THREAD_COMBINATORS_H
+#define THREAD_COMBINATORS_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+
+#include "asyncresult.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The AsyncResult which finishes after a collection of jobs.
+/**
+ * Each job gets a callback which counts down an atomic counter, and
+ * the job which reaches the target finishes the JoinResult inline. So
+ * no thread is ever blocked for fan-in, and the JoinResult can be
+ * waited on, or chained with then(), like any other job.
+ *
+ * The JoinResult always finishes with SUCCESS, even if some jobs failed
+ * or were cancelled. Check jobs() for each status.
+ */
+class JoinResult : public AsyncResult
+{
+public:
+    /// The JoinResult pointer type.
+    typedef boost::intrusive_ptr<JoinResult> Ptr;
+
+    /// The join mode.
+    enum Mode
+    {
+        /// Finish after all jobs finished.
+        JOIN_ALL = 0,
+
+        /// Finish after any job finished.
+        JOIN_ANY = 1
+    };
+
+    /// Create a JoinResult and attach it to the jobs.
+    static Ptr create(const std::vector<AsyncResultPtr>& jobs, Mode mode);
+
+    /// Dispose the JoinResult.
+    virtual ~JoinResult();
+
+    /// The joined jobs.
+    const std::vector<AsyncResultPtr>& jobs() const;
+
+    /// The index of the job which finished first.
+    /**
+     * Only meaningful after a JOIN_ANY result finished.
+     *
+     * @return jobs().size() if no job has finished.
+     */
+    size_t first() const;
+
+    /// The number of jobs not yet finished.
+    size_t pending() const;
+
+    /// Cancel all jobs which are still waiting.
+    /**
+     * @return The number of jobs cancelled.
+     */
+    size_t cancel_jobs();
+
+protected:
+    /// The joined jobs.
+    std::vector<AsyncResultPtr> jobs_;
+
+    /// The jobs not yet finished.
+    boost::atomic<size_t> pending_;
+
+    /// The job which finished first.
+    boost::atomic<AsyncResult*> first_;
+
+    /// The join mode.
+    const Mode mode_;
+
+    /// Create a JoinResult.
+    JoinResult(const std::vector<AsyncResultPtr>& jobs, Mode mode);
+
+    /// The callback of each job.
+    /**
+     * Bound with a raw pointer; each job holds one reference, which is
+     * released here.
+     */
+    void job_handler(AsyncResult& job);
+};
+
+/// Create an AsyncResult which finishes after all the jobs finished.
+/**
+ * Use jobs() of the result to find out how each job finished.
+ */
+JoinResult::Ptr when_all(const std::vector<AsyncResultPtr>& jobs);
+
+/// Create an AsyncResult which finishes after all the jobs finished.
+template <typename Iterator>
+JoinResult::Ptr when_all(Iterator begin, Iterator end)
+{
+    return when_all(std::vector<AsyncResultPtr>(begin, end));
+}
+
+/// Create an AsyncResult which finishes after any of the jobs finished.
+/**
+ * Use first() of the result to find out which one.
+ */
+JoinResult::Ptr when_any(const std::vector<AsyncResultPtr>& jobs);
+
+/// Create an AsyncResult which finishes after any of the jobs finished.
+template <typename Iterator>
+JoinResult::Ptr when_any(Iterator begin, Iterator end)
+{
+    return when_any(std::vector<AsyncResultPtr>(begin, end));
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_COMBINATORS_H
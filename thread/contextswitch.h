@@ -0,0 +1,71 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_CONTEXTSWITCH_H
+#define THREAD_CONTEXTSWITCH_H
+
+#include "../define.h"
+
+#include <boost/version.hpp>
+
+// The fcontext functions are the low level of Boost.Context, under its 
+// detail namespace. Their transfer_t form appeared in Boost 1.61; this 
+// file is the only place which names them, so a change upstream is 
+// fixed here.
+#if BOOST_VERSION < 106100
+#error "Coroutines need Boost.Context 1.61 or later."
+#endif
+
+#include <boost/context/detail/fcontext.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The saved registers of a suspended context.
+typedef boost::context::detail::fcontext_t MachineContext;
+
+/// What a context switch passes: the context left, and a pointer.
+typedef boost::context::detail::transfer_t ContextTransfer;
+
+/// The entry of a new context, which must never return.
+typedef void (*ContextEntry)(ContextTransfer);
+
+/// Create a context which starts in an entry function.
+/**
+ * @param top The top of the stack, where it starts to grow down.
+ * @param size The usable size of the stack.
+ */
+inline MachineContext make_context(void* top, size_t size, ContextEntry entry)
+{
+    return boost::context::detail::make_fcontext(top, size, entry);
+}
+
+/// Switch to a context, passing it a pointer.
+/**
+ * @return What the context passed when it switched back.
+ */
+inline ContextTransfer jump_context(MachineContext to, void* data)
+{
+    return boost::context::detail::jump_fcontext(to, data);
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_CONTEXTSWITCH_H
@@ -0,0 +1,215 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "coroutine.h"
+
+#include <new>
+#include <boost/bind.hpp>
+
+#include "errors.h"
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The coroutine running on current thread.
+    __thread Coroutine* running_coroutine = NULL;
+    
+    // A coroutine may resume on another thread, so its code must not 
+    // cache the address of a thread local variable across a switch.
+    
+    /// Read running_coroutine.
+    BOOST_NOINLINE Coroutine* get_running()
+    {
+        return running_coroutine;
+    }
+    
+    /// Replace running_coroutine, returning the old one.
+    BOOST_NOINLINE Coroutine* swap_running(Coroutine* co)
+    {
+        Coroutine* ret = running_coroutine;
+        running_coroutine = co;
+        return ret;
+    }
+}
+
+Coroutine::Coroutine(Executor& executor, const AsyncResultPtr& handle, StackPool& stacks)
+ :  refs_(0),
+    executor_(executor),
+    stacks_(stacks),
+    handle_(handle),
+    stack_(),
+    context_(NULL),
+    awaiting_(),
+    finished_(false)
+{
+    stack_.base = NULL;
+    stack_.size = 0;
+}
+
+Coroutine::~Coroutine()
+{
+    // The frames of an abandoned task are not unwound, only unmapped.
+    if (stack_.base)
+        stacks_.release(stack_);
+}
+
+AsyncResultPtr Coroutine::spawn(Executor& executor, const AsyncResult::Task& task,
+                                StackPool& stacks)
+{
+    // The handle keeps the token of the spawning job, as a submitted job.
+    AsyncResultPtr handle(new AsyncResult(task));
+    Ptr co(new Coroutine(executor, handle, stacks));
+    co->schedule(true);
+    return handle;
+}
+
+void Coroutine::await(const AsyncResultPtr& ar)
+{
+    Coroutine* self = get_running();
+    if (!self) {
+        ar->wait();
+        return;
+    }
+    if (ar->done())
+        return;
+    self->awaiting_ = ar;
+    self->suspend();
+    self->handle_->throw_if_cancelled();
+}
+
+void Coroutine::yield()
+{
+    Coroutine* self = get_running();
+    if (!self)
+        return;
+    self->suspend();
+    self->handle_->throw_if_cancelled();
+}
+
+Coroutine* Coroutine::current()
+{
+    return get_running();
+}
+
+AsyncResultPtr Coroutine::handle() const
+{
+    return handle_;
+}
+
+void Coroutine::schedule(bool first)
+{
+    AsyncResultPtr slice(new AsyncResult(boost::bind(&Coroutine::slice_task, Ptr(this), _1)));
+    // The slice belongs to no caller; the handle carries the cancellation.
+    slice->orphan();
+    if (executor_.try_submit(slice) != Executor::SUBMIT_OK) {
+        handle_->cancel();
+        if (first)
+            AVALON_THROW(AvalonThreadPoolIsFull);
+        run_slice();
+        return;
+    }
+    
+    // After submitting, so a rejected slice does not call back.
+    slice->add_all(boost::bind(&Coroutine::slice_handler, Ptr(this), _1));
+}
+
+void Coroutine::run_slice()
+{
+    if (!stack_.base) {
+        // Never started: a cancelled handle needs no stack.
+        if (handle_->done())
+            return;
+        try {
+            stack_ = stacks_.allocate();
+        } catch (std::bad_alloc&) {
+            handle_->cancel();
+            return;
+        }
+        context_ = make_context(stack_.top(), stack_.size, &Coroutine::entry);
+    }
+    
+    Coroutine* outer = swap_running(this);
+    AsyncResult* outer_job = AsyncResult::current();
+    ContextTransfer t = jump_context(context_, this);
+    context_ = t.fctx;
+    AsyncResult::swap_current(outer_job);
+    swap_running(outer);
+    
+    if (finished_) {
+        stacks_.release(stack_);
+        stack_.base = NULL;
+        return;
+    }
+    AsyncResultPtr awaited;
+    awaited.swap(awaiting_);
+    // Last, for the callback may resume the task on another thread at once.
+    if (awaited)
+        awaited->add_all(boost::bind(&Coroutine::wake, Ptr(this), _1));
+    else
+        schedule(false);
+}
+
+void Coroutine::slice_task(AsyncResult& slice)
+{
+    run_slice();
+}
+
+void Coroutine::slice_handler(AsyncResult& slice)
+{
+    // A slice which did not run must still resume the task.
+    if (slice.status() == AsyncResult::SUCCESS)
+        return;
+    handle_->cancel();
+    run_slice();
+}
+
+void Coroutine::wake(AsyncResult& ar)
+{
+    schedule(false);
+}
+
+void Coroutine::suspend()
+{
+    AsyncResult* job = AsyncResult::current();
+    ContextTransfer t = jump_context(context_, NULL);
+    context_ = t.fctx;
+    AsyncResult::swap_current(job);
+}
+
+void Coroutine::entry(ContextTransfer from)
+{
+    Coroutine* self = (Coroutine*)from.data;
+    self->context_ = from.fctx;
+    AsyncResult::swap_current(NULL);
+    {
+        AsyncResult* handle = self->handle_.get();
+        try {
+            handle->execute();
+        } catch (...) {
+            // Only interruption escapes; it has been recorded on the handle.
+        }
+    }
+    self->finished_ = true;
+    // Nothing on this stack is left to destroy.
+    jump_context(self->context_, NULL);
+}
+
+END_AVALON_NS2
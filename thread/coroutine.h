@@ -0,0 +1,174 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_COROUTINE_H
+#define THREAD_COROUTINE_H
+
+#include "../define.h"
+
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "asyncresult.h"
+#include "contextswitch.h"
+#include "executor.h"
+#include "stackpool.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The stackful task, which suspends instead of blocking its worker.
+/**
+ * The task runs on its own stack, in slices submitted to an executor. 
+ * When it awaits a job which is not done, the slice returns and the 
+ * worker picks up other work. The completion of the awaited job submits 
+ * the next slice, which resumes the task where it stopped, maybe on 
+ * another thread. So a task may wait for jobs of its own pool, even of 
+ * a single worker, without a deadlock.
+ * 
+ * Stacks come from a StackPool, and are only taken when the first 
+ * slice runs. A suspended task costs its stack pages it has touched, 
+ * so 100k of them fit in memory.
+ * 
+ * If a slice is rejected or dropped by the executor, the handle is 
+ * cancelled and the task is resumed inline, so it can unwind. Thread 
+ * local variables must not be held across await() or yield(), for the 
+ * thread may change.
+ */
+class Coroutine : private boost::noncopyable
+{
+public:
+    /// The Coroutine pointer type.
+    typedef boost::intrusive_ptr<Coroutine> Ptr;
+    
+    /// Start a task as a coroutine.
+    /**
+     * @param executor The executor of the slices, which must outlive the task.
+     * @param task The task. It is passed the handle.
+     * @param stacks The pool of the stack, which must outlive the task.
+     * @return The handle, which finishes with the task.
+     * @throw AvalonThreadPoolIsFull if the executor rejects the first slice.
+     */
+    static AsyncResultPtr spawn(Executor& executor, const AsyncResult::Task& task,
+                                StackPool& stacks = StackPool::instance());
+    
+    /// Wait for a job, suspending the calling coroutine.
+    /**
+     * Outside a coroutine, it blocks the thread as AsyncResult::wait().
+     * 
+     * @throw AvalonJobCancelled if the coroutine is cancelled meanwhile.
+     */
+    static void await(const AsyncResultPtr& ar);
+    
+    /// Let other jobs run, then resume the calling coroutine.
+    /**
+     * Outside a coroutine, it does nothing.
+     * 
+     * @throw AvalonJobCancelled if the coroutine is cancelled meanwhile.
+     */
+    static void yield();
+    
+    /// The coroutine running on the calling thread.
+    /**
+     * @return NULL if called outside a coroutine.
+     */
+    static Coroutine* current();
+    
+    /// The handle of the task.
+    AsyncResultPtr handle() const;
+    
+    /// Release the stack, if the task did not run to the end.
+    ~Coroutine();
+    
+private:
+    /// The reference count.
+    boost::atomic<size_t> refs_;
+    
+    /// The executor of the slices.
+    Executor& executor_;
+    
+    /// The pool of the stack.
+    StackPool& stacks_;
+    
+    /// The handle, executed on the coroutine stack.
+    AsyncResultPtr handle_;
+    
+    /// The stack, whose base is NULL before the first slice.
+    StackPool::Stack stack_;
+    
+    /// The suspended context of the task, or of the slice in the task.
+    MachineContext context_;
+    
+    /// The job to wait for before the next slice, NULL for a yield.
+    AsyncResultPtr awaiting_;
+    
+    /// Whether the task has returned.
+    bool finished_;
+    
+    /// Create a coroutine.
+    Coroutine(Executor& executor, const AsyncResultPtr& handle, StackPool& stacks);
+    
+    /// Submit a slice.
+    /**
+     * @param first Whether to throw if rejected, instead of resuming inline.
+     */
+    void schedule(bool first);
+    
+    /// Run the task until it suspends or returns.
+    void run_slice();
+    
+    /// The task of a slice.
+    void slice_task(AsyncResult& slice);
+    
+    /// The callback of a slice, which takes over a dropped slice.
+    void slice_handler(AsyncResult& slice);
+    
+    /// The callback of the awaited job.
+    void wake(AsyncResult& ar);
+    
+    /// Switch back to the slice. Called on the coroutine stack.
+    void suspend();
+    
+    /// The entry of the coroutine stack.
+    static void entry(ContextTransfer from);
+    
+    friend void intrusive_ptr_add_ref(Coroutine* p);
+    friend void intrusive_ptr_release(Coroutine* p);
+};
+
+/// Increase the reference count.
+inline void intrusive_ptr_add_ref(Coroutine* p)
+{
+    p->refs_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+/// Decrease the reference count, and dispose the Coroutine on zero.
+inline void intrusive_ptr_release(Coroutine* p)
+{
+    if (p->refs_.fetch_sub(1, boost::memory_order_release) == 1) {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        delete p;
+    }
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_COROUTINE_H
@@ -34,6 +34,9 @@ class AvalonThreadPoolIsNotRunning : public AvalonOperationForbid {};
 /// The ThreadPool is Full.
 class AvalonThreadPoolIsFull : public AvalonOperationForbid {};
 
+/// The job stopped on a cancellation request.
+class AvalonJobCancelled : public AvalonException {};
+
 
 END_AVALON_NS2
 
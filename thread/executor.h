@@ -0,0 +1,94 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef THREAD_EXECUTOR_H
+#define THREAD_EXECUTOR_H
+
+#include "../define.h"
+
+#include <vector>
+
+#include "asyncresult.h"
+#include "combinators.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The job executor interface.
+/**
+ * Implemented by WorkPoolBase and ThreadPool, so that facilities built
+ * on AsyncResult (e.g. continuations) can schedule jobs on any pool.
+ */
+class Executor
+{
+public:
+    /// The result of a non-throwing submission.
+    enum SubmitStatus
+    {
+        /// The job is queued.
+        SUBMIT_OK = 0,
+        /// The queue is full, and the job is not queued.
+        SUBMIT_FULL = 1,
+        /// The queue stayed full until the timeout, and the job is not queued.
+        SUBMIT_TIMEOUT = 2
+    };
+    
+    /// Dispose the executor.
+    virtual ~Executor();
+
+    /// Add a prepared AsyncResult to the job queue.
+    /**
+     * Callbacks should be added before submitting.
+     *
+     * @param ar The job to execute.
+     * @return ar.
+     */
+    virtual AsyncResultPtr submit(const AsyncResultPtr& ar) = 0;
+    
+    /// Add a prepared AsyncResult to the job queue, unless it is full.
+    /**
+     * Unlike submit(), a full queue is reported by the return value, so 
+     * an overloaded producer does not pay for building and unwinding an 
+     * exception. The job is left untouched when it is not queued.
+     * 
+     * The default implementation catches the exception of submit(). 
+     * Executors with a queue limit should override it.
+     * 
+     * @param ar The job to execute.
+     * @return SUBMIT_OK or SUBMIT_FULL.
+     */
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+
+    /// Add a batch of prepared AsyncResults to the job queue.
+    /**
+     * @param jobs The jobs to execute.
+     * @return The group handle of the batch.
+     */
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs) = 0;
+
+    /// The number of jobs the executor may run at the same time.
+    /**
+     * Zero means the executor has no thread of its own.
+     */
+    virtual size_t concurrency() = 0;
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_EXECUTOR_H
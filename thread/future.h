@@ -0,0 +1,103 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef THREAD_FUTURE_H
+#define THREAD_FUTURE_H
+
+#include "../define.h"
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include "asyncresult.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The typed AsyncResult.
+/**
+ * The task returns a T, which is stored inline in the Future object
+ * rather than in a heap allocated Result<T>. The value is written by
+ * the executing thread before the status becomes SUCCESS, so reading
+ * it needs no lock.
+ *
+ * A Future is still an AsyncResult, so callbacks, cancellation and the
+ * type-erased result API keep working, and it can be submitted to any
+ * workpool which accepts an AsyncResultPtr.
+ */
+template <typename T>
+class Future : public AsyncResult
+{
+public:
+    /// The typed function call type.
+    typedef boost::function<T (AsyncResult&)> ValueTask;
+
+    /// The Future pointer type.
+    typedef boost::intrusive_ptr< Future<T> > Ptr;
+
+    /// Create a new Future.
+    explicit Future(const ValueTask& task);
+
+    /// Dispose the Future and the value.
+    virtual ~Future();
+
+    /// Whether a value is available.
+    bool has_value();
+
+    /// Get a reference to the value.
+    /**
+     * The reference is valid until take() is called.
+     *
+     * @throw AvalonOperationForbid If there is no value.
+     */
+    const T& value();
+
+    /// Move the value out.
+    /**
+     * Only one caller can take the value.
+     *
+     * @throw AvalonOperationForbid If there is no value.
+     */
+    T take();
+
+protected:
+    /// The typed function call.
+    ValueTask value_task_;
+
+    /// The inline value storage.
+    typename boost::aligned_storage<sizeof(T), boost::alignment_of<T>::value>::type storage_;
+
+    /// Whether storage_ holds a value.
+    boost::atomic<bool> stored_;
+
+    /// The task adapter which stores the value.
+    void run(AsyncResult& ar);
+
+    /// Get the value pointer.
+    T* pointer();
+};
+
+END_AVALON_NS2
+
+#include "future.tpl.h"
+
+#endif // THREAD_FUTURE_H
@@ -0,0 +1,90 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef THREAD_FUTURE_TPL_H
+#define THREAD_FUTURE_TPL_H
+
+#include "future.h"
+
+#include <new>
+#include <boost/bind.hpp>
+#include <boost/move/utility.hpp>
+
+#include "../errors.h"
+
+BEGIN_AVALON_NS2(thread)
+
+template <typename T>
+Future<T>::Future(const ValueTask& task)
+ :  AsyncResult(boost::bind(&Future<T>::run, this, _1)),
+    value_task_(task),
+    storage_(),
+    stored_(false)
+{
+}
+
+template <typename T>
+Future<T>::~Future()
+{
+    if (stored_.load(boost::memory_order_acquire))
+        pointer()->~T();
+}
+
+template <typename T>
+T* Future<T>::pointer()
+{
+    return static_cast<T*>(static_cast<void*>(&storage_));
+}
+
+template <typename T>
+void Future<T>::run(AsyncResult& ar)
+{
+    // The status is published after this returns, which releases the value.
+    new (&storage_) T(value_task_(ar));
+    stored_.store(true, boost::memory_order_relaxed);
+}
+
+template <typename T>
+bool Future<T>::has_value()
+{
+    return status() == SUCCESS && stored_.load(boost::memory_order_acquire);
+}
+
+template <typename T>
+const T& Future<T>::value()
+{
+    if (!has_value())
+        AVALON_THROW(AvalonOperationForbid);
+    return *pointer();
+}
+
+template <typename T>
+T Future<T>::take()
+{
+    if (status() != SUCCESS || !stored_.exchange(false, boost::memory_order_acq_rel))
+        AVALON_THROW(AvalonOperationForbid);
+    T* p = pointer();
+    T ret(boost::move(*p));
+    p->~T();
+    return ret;
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_FUTURE_TPL_H
@@ -0,0 +1,71 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "jobqueue.h"
+
+BEGIN_AVALON_NS2(thread)
+
+JobQueue::JobQueue()
+ :  head_(NULL),
+    pending_(NULL)
+{
+}
+
+JobQueue::~JobQueue()
+{
+    while (AsyncResult* job = pop()) {
+        intrusive_ptr_release(job);
+    }
+}
+
+void JobQueue::push(AsyncResult* job)
+{
+    intrusive_ptr_add_ref(job);
+    AsyncResult* head = head_.load(boost::memory_order_relaxed);
+    do {
+        job->queue_next_ = head;
+    } while (!head_.compare_exchange_weak(head, job));
+}
+
+AsyncResult* JobQueue::pop()
+{
+    if (!pending_) {
+        // Reverse the pushed jobs into submission order.
+        AsyncResult* stack = head_.exchange(NULL);
+        while (stack) {
+            AsyncResult* next = stack->queue_next_;
+            stack->queue_next_ = pending_;
+            pending_ = stack;
+            stack = next;
+        }
+    }
+    AsyncResult* ret = pending_;
+    if (ret)
+        pending_ = ret->queue_next_;
+    return ret;
+}
+
+bool JobQueue::has_pushed() const
+{
+    return head_.load() != NULL;
+}
+
+END_AVALON_NS2
@@ -0,0 +1,78 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_JOBQUEUE_H
+#define THREAD_JOBQUEUE_H
+
+#include "../define.h"
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "asyncresult.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The intrusive multi-producer single-consumer job queue.
+/**
+ * Producers push onto a lock-free stack linked through the jobs 
+ * themselves, so a push is one CAS and never allocates. The consumer 
+ * takes the whole stack at once, and reverses it into FIFO order.
+ * 
+ * A job can be in one JobQueue at a time. The queue holds a reference 
+ * to each job.
+ */
+class JobQueue : private boost::noncopyable
+{
+public:
+    /// Create an empty queue.
+    JobQueue();
+    
+    /// Dispose the queue, releasing the jobs left.
+    ~JobQueue();
+    
+    /// Push a job, taking a reference. Safe from any thread.
+    void push(AsyncResult* job);
+    
+    /// Pop the next job, adopting its reference. Only by the consumer.
+    /**
+     * @return NULL if the queue is empty.
+     */
+    AsyncResult* pop();
+    
+    /// Whether jobs were pushed since the consumer last took them.
+    /**
+     * A sequentially consistent load, so that a consumer which is 
+     * about to sleep pairs with the producers.
+     */
+    bool has_pushed() const;
+    
+private:
+    /// The latest pushed job, linked to the earlier ones.
+    boost::atomic<AsyncResult*> head_;
+    
+    /// The jobs taken by the consumer, in FIFO order.
+    AsyncResult* pending_;
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_JOBQUEUE_H
@@ -0,0 +1,338 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The metrics slot of the worker running in current thread.
+    __thread WorkerMetrics* current_metrics = NULL;
+    
+    /// Convert a duration to nanoseconds, clamping negative ones.
+    boost::uint64_t to_nanoseconds(Clock::duration d)
+    {
+        boost::int64_t ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(d).count();
+        return ns > 0 ? (boost::uint64_t)ns : 0;
+    }
+}
+
+HistogramSnapshot::HistogramSnapshot()
+ :  counts_(LatencyHistogram::BUCKET_COUNT, 0),
+    count_(0)
+{
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other)
+{
+    for (size_t i=0; i<counts_.size(); i++) {
+        counts_[i] += other.counts_[i];
+    }
+    count_ += other.count_;
+}
+
+boost::uint64_t HistogramSnapshot::count() const
+{
+    return count_;
+}
+
+boost::uint64_t HistogramSnapshot::percentile(double q) const
+{
+    if (!count_)
+        return 0;
+    q = std::min(std::max(q, 0.0), 1.0);
+    boost::uint64_t rank = std::max((boost::uint64_t)(q * count_ + 0.5), (boost::uint64_t)1);
+    boost::uint64_t seen = 0;
+    for (size_t i=0; i<counts_.size(); i++) {
+        seen += counts_[i];
+        if (seen >= rank)
+            return LatencyHistogram::bucket_high(i);
+    }
+    return max();
+}
+
+boost::uint64_t HistogramSnapshot::max() const
+{
+    for (size_t i=counts_.size(); i>0; i--) {
+        if (counts_[i-1])
+            return LatencyHistogram::bucket_high(i-1);
+    }
+    return 0;
+}
+
+const std::vector<boost::uint64_t>& HistogramSnapshot::counts() const
+{
+    return counts_;
+}
+
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (size_t i=0; i<BUCKET_COUNT; i++) {
+        counts_[i].store(0, boost::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(boost::uint64_t value)
+{
+    boost::atomic<boost::uint64_t>& counter = counts_[bucket_of(value)];
+    counter.store(counter.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::add_to(HistogramSnapshot& snapshot) const
+{
+    for (size_t i=0; i<BUCKET_COUNT; i++) {
+        boost::uint64_t n = counts_[i].load(boost::memory_order_relaxed);
+        snapshot.counts_[i] += n;
+        snapshot.count_ += n;
+    }
+}
+
+size_t LatencyHistogram::bucket_of(boost::uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return (size_t)value;
+    // the magnitude picks the power of 2, the next 3 bits the linear bucket.
+    size_t magnitude = 63 - __builtin_clzll(value);
+    return (magnitude - 2) * SUB_BUCKETS + (size_t)((value >> (magnitude - 3)) & (SUB_BUCKETS - 1));
+}
+
+boost::uint64_t LatencyHistogram::bucket_high(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    size_t magnitude = bucket / SUB_BUCKETS + 2;
+    boost::uint64_t low = (boost::uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (magnitude - 3);
+    return low + (((boost::uint64_t)1 << (magnitude - 3)) - 1);
+}
+
+
+WorkerSnapshot::WorkerSnapshot()
+ :  active(false),
+    running(false),
+    busy(0),
+    wait(0),
+    uptime(0),
+    utilisation(0),
+    wait_latency(),
+    run_latency()
+{
+    std::fill(outcomes, outcomes + STATUS_COUNT, 0);
+}
+
+void WorkerSnapshot::merge(const WorkerSnapshot& other)
+{
+    for (size_t i=0; i<STATUS_COUNT; i++) {
+        outcomes[i] += other.outcomes[i];
+    }
+    busy += other.busy;
+    wait += other.wait;
+    wait_latency.merge(other.wait_latency);
+    run_latency.merge(other.run_latency);
+}
+
+boost::uint64_t WorkerSnapshot::executed() const
+{
+    boost::uint64_t ret = 0;
+    for (size_t i=0; i<STATUS_COUNT; i++) {
+        ret += outcomes[i];
+    }
+    return ret;
+}
+
+
+MetricsSnapshot::MetricsSnapshot()
+ :  taken_at(),
+    jobs(0),
+    queued(0),
+    workers(),
+    total()
+{
+}
+
+
+WorkerMetrics::WorkerMetrics()
+ :  active_(false),
+    running_(false),
+    busy_(0),
+    started_(0),
+    wait_(0),
+    since_(0),
+    busy_base_(0),
+    wait_latency_(),
+    run_latency_()
+{
+    for (size_t i=0; i<WorkerSnapshot::STATUS_COUNT; i++) {
+        outcomes_[i].store(0, boost::memory_order_relaxed);
+    }
+}
+
+void WorkerMetrics::bump(boost::atomic<boost::uint64_t>& counter, boost::uint64_t n)
+{
+    counter.store(counter.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+}
+
+void WorkerMetrics::begin()
+{
+    running_.store(true, boost::memory_order_relaxed);
+}
+
+void WorkerMetrics::end(AsyncResult& job)
+{
+    size_t status = (size_t)job.status();
+    if (status < WorkerSnapshot::STATUS_COUNT)
+        bump(outcomes_[status], 1);
+    running_.store(false, boost::memory_order_relaxed);
+}
+
+void WorkerMetrics::record_wait(Clock::duration wait)
+{
+    if (wait.count() > 0)
+        bump(wait_, wait.count());
+    wait_latency_.record(to_nanoseconds(wait));
+}
+
+void WorkerMetrics::start_run(const Clock::time_point& start)
+{
+    started_.store(start.time_since_epoch().count(), boost::memory_order_relaxed);
+}
+
+void WorkerMetrics::record_run(Clock::duration run)
+{
+    // Cleared before the busy time grows, so collect() may miss the 
+    // running part once, but never counts it twice.
+    started_.store(0, boost::memory_order_release);
+    if (run.count() > 0)
+        busy_.store(busy_.load(boost::memory_order_relaxed) + run.count(), 
+                    boost::memory_order_release);
+    run_latency_.record(to_nanoseconds(run));
+}
+
+void WorkerMetrics::collect(WorkerSnapshot& snapshot, const Clock::time_point& now) const
+{
+    snapshot.active = active_.load(boost::memory_order_relaxed);
+    snapshot.running = snapshot.active && running_.load(boost::memory_order_relaxed);
+    for (size_t i=0; i<WorkerSnapshot::STATUS_COUNT; i++) {
+        snapshot.outcomes[i] = outcomes_[i].load(boost::memory_order_relaxed);
+    }
+    boost::uint64_t busy = busy_.load(boost::memory_order_acquire);
+    // A job longer than the sampling interval counts as busy while it runs.
+    boost::int64_t started = started_.load(boost::memory_order_acquire);
+    if (started && now.time_since_epoch().count() > started)
+        busy += now.time_since_epoch().count() - started;
+    snapshot.busy = Clock::duration(busy);
+    snapshot.wait = Clock::duration(wait_.load(boost::memory_order_relaxed));
+    snapshot.uptime = Clock::duration(0);
+    snapshot.utilisation = 0;
+    if (snapshot.active) {
+        Clock::time_point since(Clock::duration(since_.load(boost::memory_order_relaxed)));
+        snapshot.uptime = now - since;
+        boost::uint64_t base = busy_base_.load(boost::memory_order_relaxed);
+        if (snapshot.uptime.count() > 0 && busy >= base)
+            snapshot.utilisation = std::min((double)(busy - base) / snapshot.uptime.count(), 1.0);
+    }
+    wait_latency_.add_to(snapshot.wait_latency);
+    run_latency_.add_to(snapshot.run_latency);
+}
+
+
+ExecutorMetrics::ExecutorMetrics()
+ :  lock_(),
+    workers_()
+{
+}
+
+ExecutorMetrics::~ExecutorMetrics()
+{
+    BOOST_FOREACH(WorkerMetrics* worker, workers_) {
+        delete worker;
+    }
+}
+
+WorkerMetrics* ExecutorMetrics::attach()
+{
+    boost::mutex::scoped_lock locker(lock_);
+    WorkerMetrics* worker = NULL;
+    BOOST_FOREACH(WorkerMetrics* w, workers_) {
+        if (!w->active_.load(boost::memory_order_relaxed)) {
+            worker = w;
+            break;
+        }
+    }
+    if (!worker) {
+        worker = new WorkerMetrics();
+        workers_.push_back(worker);
+    }
+    worker->since_.store(Clock::now().time_since_epoch().count(), boost::memory_order_relaxed);
+    worker->busy_base_.store(worker->busy_.load(boost::memory_order_relaxed), 
+                             boost::memory_order_relaxed);
+    worker->running_.store(false, boost::memory_order_relaxed);
+    worker->active_.store(true, boost::memory_order_relaxed);
+    current_metrics = worker;
+    return worker;
+}
+
+void ExecutorMetrics::detach()
+{
+    WorkerMetrics* worker = current_metrics;
+    if (!worker)
+        return;
+    current_metrics = NULL;
+    boost::mutex::scoped_lock locker(lock_);
+    worker->active_.store(false, boost::memory_order_relaxed);
+}
+
+WorkerMetrics* ExecutorMetrics::current()
+{
+    return current_metrics;
+}
+
+void ExecutorMetrics::collect(MetricsSnapshot& snapshot) const
+{
+    snapshot.taken_at = Clock::now();
+    snapshot.total = WorkerSnapshot();
+    size_t active = 0;
+    double utilisation = 0;
+    
+    boost::mutex::scoped_lock locker(lock_);
+    snapshot.workers.resize(workers_.size());
+    for (size_t i=0; i<workers_.size(); i++) {
+        WorkerSnapshot& worker = snapshot.workers[i];
+        worker = WorkerSnapshot();
+        workers_[i]->collect(worker, snapshot.taken_at);
+        snapshot.total.merge(worker);
+        if (worker.running)
+            snapshot.total.running = true;
+        if (worker.active) {
+            active++;
+            utilisation += worker.utilisation;
+            snapshot.total.uptime += worker.uptime;
+        }
+    }
+    snapshot.total.active = active != 0;
+    snapshot.total.utilisation = active ? utilisation / active : 0;
+}
+
+END_AVALON_NS2
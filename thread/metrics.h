@@ -0,0 +1,303 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+#ifndef THREAD_METRICS_H
+#define THREAD_METRICS_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "asyncresult.h"
+#include "clock.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The bucket counts of a LatencyHistogram, taken at one moment.
+class HistogramSnapshot
+{
+public:
+    /// Create an empty snapshot.
+    HistogramSnapshot();
+    
+    /// Add the counts of another snapshot.
+    void merge(const HistogramSnapshot& other);
+    
+    /// The recorded value count.
+    boost::uint64_t count() const;
+    
+    /// The value at quantile q.
+    /**
+     * @param q The quantile, in [0, 1].
+     * @return The upper bound of the bucket holding the value, or zero 
+     *      if nothing is recorded.
+     */
+    boost::uint64_t percentile(double q) const;
+    
+    /// The upper bound of the highest non-empty bucket.
+    boost::uint64_t max() const;
+    
+    /// The counts, by bucket.
+    const std::vector<boost::uint64_t>& counts() const;
+    
+protected:
+    friend class LatencyHistogram;
+    
+    /// The counts, by bucket.
+    std::vector<boost::uint64_t> counts_;
+    
+    /// The sum of counts_.
+    boost::uint64_t count_;
+};
+
+/// A lock-free latency histogram with log-linear buckets.
+/**
+ * Like HdrHistogram, each power of 2 is split into SUB_BUCKETS linear 
+ * buckets, so any value is reported within 12.5%, and a fixed array 
+ * covers the whole 64-bit range without allocation.
+ * 
+ * Only one thread may record at a time, which needs no read-modify-write. 
+ * Any thread may take a snapshot meanwhile.
+ */
+class LatencyHistogram : private boost::noncopyable
+{
+public:
+    enum
+    {
+        /// The linear buckets per power of 2.
+        SUB_BUCKETS = 8,
+        
+        /// The bucket count: values below SUB_BUCKETS, then 2^3 .. 2^63.
+        BUCKET_COUNT = 62 * SUB_BUCKETS
+    };
+    
+    /// Create an empty histogram.
+    LatencyHistogram();
+    
+    /// Record a value.
+    void record(boost::uint64_t value);
+    
+    /// Add the counts to a snapshot.
+    void add_to(HistogramSnapshot& snapshot) const;
+    
+    /// The bucket of a value.
+    static size_t bucket_of(boost::uint64_t value);
+    
+    /// The largest value of a bucket.
+    static boost::uint64_t bucket_high(size_t bucket);
+    
+protected:
+    /// The counts, by bucket.
+    boost::atomic<boost::uint64_t> counts_[BUCKET_COUNT];
+};
+
+/// The metrics of one worker, taken at one moment.
+struct WorkerSnapshot
+{
+    enum
+    {
+        /// The AsyncResult status count.
+        STATUS_COUNT = AsyncResult::EXPIRED + 1
+    };
+    
+    /// Create an empty snapshot.
+    WorkerSnapshot();
+    
+    /// Add the counters of another worker. Latencies are merged as well.
+    void merge(const WorkerSnapshot& other);
+    
+    /// The number of jobs taken from the queue.
+    boost::uint64_t executed() const;
+    
+    /// Whether a thread is attached to the worker.
+    bool active;
+    
+    /// Whether the worker is executing a job.
+    bool running;
+    
+    /// The jobs taken from the queue, by their status after execution.
+    /**
+     * Jobs cancelled before being dequeued are counted as CANCELLED, 
+     * and those dropped by their deadline as EXPIRED.
+     */
+    boost::uint64_t outcomes[STATUS_COUNT];
+    
+    /// The total time spent in jobs, including the running one.
+    Clock::duration busy;
+    
+    /// The total time jobs waited in the queue.
+    Clock::duration wait;
+    
+    /// The time since the current thread attached.
+    Clock::duration uptime;
+    
+    /// The busy fraction of uptime. For a merged snapshot, the mean of the active workers.
+    double utilisation;
+    
+    /// The enqueue to start latencies, in nanoseconds.
+    HistogramSnapshot wait_latency;
+    
+    /// The start to finish latencies, in nanoseconds.
+    HistogramSnapshot run_latency;
+};
+
+/// The metrics of an executor, taken at one moment.
+struct MetricsSnapshot
+{
+    /// Create an empty snapshot.
+    MetricsSnapshot();
+    
+    /// The time of the snapshot.
+    Clock::time_point taken_at;
+    
+    /// The jobs accepted and not finished, queued or running.
+    size_t jobs;
+    
+    /// The jobs waiting in queues.
+    size_t queued;
+    
+    /// The workers, attached or not.
+    std::vector<WorkerSnapshot> workers;
+    
+    /// The sum of all workers.
+    WorkerSnapshot total;
+};
+
+/// The counters of one worker thread.
+/**
+ * Each worker owns one, padded to its own cache lines, and is the only 
+ * writer. So recording costs plain loads and stores, and workers never 
+ * share a line. Readers only see slightly stale values.
+ */
+class WorkerMetrics : private boost::noncopyable
+{
+public:
+    /// Create a detached worker.
+    WorkerMetrics();
+    
+    /// Mark the start of a job.
+    void begin();
+    
+    /// Record a job after its execution.
+    void end(AsyncResult& job);
+    
+    /// Record the time a job waited in the queue.
+    void record_wait(Clock::duration wait);
+    
+    /// Mark the start of a timed job, whose time counts as busy until it ends.
+    void start_run(const Clock::time_point& start);
+    
+    /// Record the time a job ran, which was started by start_run().
+    void record_run(Clock::duration run);
+    
+    /// Take a snapshot.
+    void collect(WorkerSnapshot& snapshot, const Clock::time_point& now) const;
+    
+protected:
+    friend class ExecutorMetrics;
+    
+    /// Add to a counter, as the only writer.
+    static void bump(boost::atomic<boost::uint64_t>& counter, boost::uint64_t n);
+    
+    char pad0_[AVALON_CACHE_LINE];
+    
+    /// Whether a thread is attached.
+    boost::atomic<bool> active_;
+    
+    /// Whether a job is running.
+    boost::atomic<bool> running_;
+    
+    /// The jobs, by status.
+    boost::atomic<boost::uint64_t> outcomes_[WorkerSnapshot::STATUS_COUNT];
+    
+    /// The busy time of finished jobs, in Clock ticks.
+    boost::atomic<boost::uint64_t> busy_;
+    
+    /// The start of the running timed job, in Clock ticks since epoch. Zero if none.
+    boost::atomic<boost::int64_t> started_;
+    
+    /// The wait time, in Clock ticks.
+    boost::atomic<boost::uint64_t> wait_;
+    
+    /// The attach time, in Clock ticks since epoch.
+    boost::atomic<boost::int64_t> since_;
+    
+    /// The busy time when the current thread attached.
+    boost::atomic<boost::uint64_t> busy_base_;
+    
+    /// The wait latencies.
+    LatencyHistogram wait_latency_;
+    
+    /// The run latencies.
+    LatencyHistogram run_latency_;
+    
+    char pad1_[AVALON_CACHE_LINE];
+};
+
+/// The metrics of an executor.
+/**
+ * Every worker thread attaches to a WorkerMetrics slot when it starts, 
+ * and detaches when it exits. Slots are kept for later threads, so the 
+ * counters never go backwards.
+ * 
+ * Aggregation is done by collect(), so recording stays cheap whether 
+ * anyone reads the metrics or not.
+ */
+class ExecutorMetrics : private boost::noncopyable
+{
+public:
+    /// Create metrics without worker.
+    ExecutorMetrics();
+    
+    /// Dispose all slots.
+    ~ExecutorMetrics();
+    
+    /// Attach the calling thread to a free slot.
+    /**
+     * @return The slot, also returned by current() until detach().
+     */
+    WorkerMetrics* attach();
+    
+    /// Detach the calling thread from its slot.
+    void detach();
+    
+    /// The slot of the calling thread, NULL if it is not attached.
+    static WorkerMetrics* current();
+    
+    /// Take the snapshot of all workers. jobs and queued are left to the executor.
+    void collect(MetricsSnapshot& snapshot) const;
+    
+protected:
+    /// The lock for the slot list.
+    mutable boost::mutex lock_;
+    
+    /// The slots.
+    std::vector<WorkerMetrics*> workers_;
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_METRICS_H
@@ -0,0 +1,109 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "nodepools.h"
+
+BEGIN_AVALON_NS2(thread)
+
+NodePools::NodePools(size_t workers_per_node, size_t max_queue, ThreadPool::Mode mode,
+                     const Topology& topology)
+ :  topology_(topology),
+    pools_()
+{
+    for (size_t i=0; i<topology_.node_count(); i++) {
+        size_t workers = workers_per_node ? workers_per_node : topology_.cpus(i).size();
+        boost::shared_ptr<ThreadPool> pool(new ThreadPool(workers, max_queue, mode));
+        pool->set_placement(Placement::node(i, topology_));
+        pools_.push_back(pool);
+    }
+}
+
+NodePools::~NodePools()
+{
+    stop();
+}
+
+void NodePools::run()
+{
+    for (size_t i=0; i<pools_.size(); i++) {
+        pools_[i]->run();
+    }
+}
+
+void NodePools::stop()
+{
+    for (size_t i=0; i<pools_.size(); i++) {
+        pools_[i]->stop();
+    }
+}
+
+size_t NodePools::node_count() const
+{
+    return pools_.size();
+}
+
+ThreadPool& NodePools::pool(size_t node)
+{
+    return *pools_[node % pools_.size()];
+}
+
+size_t NodePools::current_node() const
+{
+    int cpu = Topology::current_cpu();
+    return cpu < 0 ? 0 : topology_.node_of(cpu);
+}
+
+AsyncResultPtr NodePools::submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback)
+{
+    return pool(current_node()).submit(job, callback);
+}
+
+AsyncResultPtr NodePools::submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback,
+                                 size_t node)
+{
+    return pool(node).submit(job, callback);
+}
+
+AsyncResultPtr NodePools::submit(const AsyncResultPtr& ar)
+{
+    return pool(current_node()).submit(ar);
+}
+
+Executor::SubmitStatus NodePools::try_submit(const AsyncResultPtr& ar)
+{
+    return pool(current_node()).try_submit(ar);
+}
+
+JoinResult::Ptr NodePools::submit_bulk(const std::vector<AsyncResultPtr>& jobs)
+{
+    return pool(current_node()).submit_bulk(jobs);
+}
+
+size_t NodePools::concurrency()
+{
+    size_t ret = 0;
+    for (size_t i=0; i<pools_.size(); i++) {
+        ret += pools_[i]->concurrency();
+    }
+    return ret;
+}
+
+END_AVALON_NS2
@@ -0,0 +1,106 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_NODEPOOLS_H
+#define THREAD_NODEPOOLS_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "executor.h"
+#include "threadpool.h"
+#include "topology.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// One ThreadPool per NUMA node.
+/**
+ * The workers of each pool are pinned to the CPUs of its node. A job 
+ * is submitted to the pool of the node the caller is running on, so 
+ * jobs spawned by a worker stay on its node, and the data they touch 
+ * stays in node-local memory and caches.
+ */
+class NodePools : public Executor, private boost::noncopyable
+{
+public:
+    /// Create the pools.
+    /**
+     * @param workers_per_node The thread count of each pool. Zero means 
+     *      one per CPU of the node.
+     * @param max_queue The maximum queue size of each pool. Zero means no limit.
+     * @param mode The scheduling mode of each pool.
+     * @param topology The machine layout.
+     */
+    NodePools(size_t workers_per_node, size_t max_queue, 
+              ThreadPool::Mode mode = ThreadPool::WORK_STEALING,
+              const Topology& topology = Topology::system());
+    
+    /// Stop and dispose the pools.
+    virtual ~NodePools();
+    
+    /// Run all pools.
+    void run();
+    
+    /// Stop all pools.
+    void stop();
+    
+    /// The node count.
+    size_t node_count() const;
+    
+    /// The pool of a node.
+    ThreadPool& pool(size_t node);
+    
+    /// The node the calling thread is running on.
+    size_t current_node() const;
+    
+    /// Add a job to the pool of the current node.
+    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback);
+    
+    /// Add a job to the pool of a node.
+    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback,
+                          size_t node);
+    
+    /// Add a prepared AsyncResult to the pool of the current node.
+    virtual AsyncResultPtr submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult to the pool of the current node, unless it is full.
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    /// Add a batch of prepared AsyncResults to the pool of the current node.
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// The worker count of all pools.
+    virtual size_t concurrency();
+    
+protected:
+    /// The machine layout.
+    const Topology topology_;
+    
+    /// The pools, by node.
+    std::vector< boost::shared_ptr<ThreadPool> > pools_;
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_NODEPOOLS_H
@@ -0,0 +1,108 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <vector>
+#include <boost/bind.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+ParallelLoop::ParallelLoop(size_t begin, size_t end, size_t grain, size_t participants,
+                           const ChunkBody& body)
+ :  next_(begin),
+    end_(end),
+    grain_(grain),
+    participants_(participants),
+    body_(body),
+    lock_()
+{
+}
+
+void ParallelLoop::run(Executor& executor, size_t begin, size_t end, size_t grain,
+                       const ChunkBody& body)
+{
+    if (begin >= end)
+        return;
+    grain = std::max(grain, (size_t)1);
+    
+    // no more helpers than there are chunks left for them.
+    size_t chunks = (end - begin + grain - 1) / grain;
+    size_t helpers = std::min(executor.concurrency(), chunks - 1);
+    boost::shared_ptr<ParallelLoop> loop(new ParallelLoop(begin, end, grain, helpers + 1, body));
+    
+    std::vector<AsyncResultPtr> jobs;
+    jobs.reserve(helpers);
+    for (size_t i=0; i<helpers; i++) {
+        AsyncResultPtr job(new AsyncResult(boost::bind(&ParallelLoop::helper, _1, loop)));
+        // a full queue only means fewer helpers.
+        if (executor.try_submit(job) != Executor::SUBMIT_OK)
+            break;
+        jobs.push_back(job);
+    }
+    
+    loop->work();
+    
+    // helpers which have not started will find nothing to do.
+    for (size_t i=0; i<jobs.size(); i++) {
+        if (!jobs[i]->cancel())
+            jobs[i]->wait();
+    }
+    if (loop->error_)
+        boost::rethrow_exception(loop->error_);
+}
+
+bool ParallelLoop::next_chunk(size_t& begin, size_t& end)
+{
+    size_t current = next_.load(boost::memory_order_relaxed);
+    while (current < end_) {
+        size_t size = std::max(grain_, (end_ - current) / (2 * participants_));
+        size_t last = std::min(current + size, end_);
+        if (next_.compare_exchange_weak(current, last, boost::memory_order_relaxed)) {
+            begin = current;
+            end = last;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelLoop::work()
+{
+    size_t begin, end;
+    try {
+        while (next_chunk(begin, end))
+            body_(begin, end);
+    } catch (...) {
+        Lock::scoped_lock guard(lock_);
+        if (!error_)
+            error_ = boost::current_exception();
+        next_.store(end_, boost::memory_order_relaxed);
+    }
+}
+
+void ParallelLoop::helper(AsyncResult& ar, const boost::shared_ptr<ParallelLoop>& loop)
+{
+    loop->work();
+}
+
+END_AVALON_NS2
@@ -0,0 +1,165 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_PARALLEL_H
+#define THREAD_PARALLEL_H
+
+#include "../define.h"
+
+#include <boost/atomic.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/smart_ptr/detail/spinlock.hpp>
+
+#include "asyncresult.h"
+#include "executor.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The shared state of one parallel loop over [begin, end).
+/**
+ * The range is handed out in chunks from an atomic cursor. Each chunk
+ * takes a share of what is left (remaining / 2P, but at least grain),
+ * so the first chunks are large and cheap to schedule, and the last
+ * ones are small enough to balance the load between participants.
+ *
+ * The calling thread is one of the participants. The helpers are plain
+ * jobs on the executor; if they do not start before the caller runs out
+ * of chunks, they are cancelled instead of waited for. So a loop never
+ * depends on a free worker, and can be nested inside a job of the same
+ * pool.
+ */
+class ParallelLoop : private boost::noncopyable
+{
+public:
+    /// The chunk function type, called with [begin, end).
+    typedef boost::function<void (size_t, size_t)> ChunkBody;
+    
+    /// Run body over [begin, end) on the executor and the calling thread.
+    /**
+     * The first exception thrown by body stops the loop, and is thrown
+     * again from here after all participants left.
+     *
+     * @param executor The executor of the helper jobs.
+     * @param begin The first index.
+     * @param end One past the last index.
+     * @param grain The minimum chunk size.
+     * @param body The chunk function.
+     */
+    static void run(Executor& executor, size_t begin, size_t end, size_t grain,
+                    const ChunkBody& body);
+    
+protected:
+    /// The spin lock type.
+    typedef boost::detail::spinlock Lock;
+    
+    /// The next index to hand out.
+    boost::atomic<size_t> next_;
+    
+    /// One past the last index.
+    const size_t end_;
+    
+    /// The minimum chunk size.
+    const size_t grain_;
+    
+    /// The maximum number of participants.
+    const size_t participants_;
+    
+    /// The chunk function.
+    ChunkBody body_;
+    
+    /// Guards error_.
+    Lock lock_;
+    
+    /// The first exception thrown by body_.
+    boost::exception_ptr error_;
+    
+    /// Create a loop.
+    ParallelLoop(size_t begin, size_t end, size_t grain, size_t participants,
+                 const ChunkBody& body);
+    
+    /// Take the next chunk.
+    /**
+     * @return false if the range is exhausted.
+     */
+    bool next_chunk(size_t& begin, size_t& end);
+    
+    /// Run chunks until the range is exhausted.
+    void work();
+    
+    /// The helper job task.
+    static void helper(AsyncResult& ar, const boost::shared_ptr<ParallelLoop>& loop);
+};
+
+/// Call f(i) for each i in [first, last).
+/**
+ * @param executor The executor which lends the helper threads.
+ * @param first The first index.
+ * @param last One past the last index.
+ * @param f The function.
+ * @param grain The minimum number of indices in one chunk.
+ */
+template <typename Index, typename Function>
+void parallel_for(Executor& executor, Index first, Index last, Function f,
+                  size_t grain = 1);
+
+/// Store op(*it) for each it in [first, last) to out.
+/**
+ * Both iterators should be random access.
+ *
+ * @return The end of the output range.
+ */
+template <typename InputIterator, typename OutputIterator, typename UnaryOperation>
+OutputIterator parallel_transform(Executor& executor, InputIterator first,
+                                  InputIterator last, OutputIterator out,
+                                  UnaryOperation op, size_t grain = 1);
+
+/// Reduce [first, last) with op, starting from init.
+/**
+ * The chunks are reduced in parallel, and the partial results are
+ * combined as they arrive. So op should be associative and commutative.
+ *
+ * @return init if the range is empty.
+ */
+template <typename Iterator, typename T, typename BinaryOperation>
+T parallel_reduce(Executor& executor, Iterator first, Iterator last, T init,
+                  BinaryOperation op, size_t grain = 1);
+
+/// Sort [first, last) with comp.
+/**
+ * Blocks of at least grain elements are sorted in parallel, then merged
+ * in pairs, each round in parallel. Not stable.
+ */
+template <typename Iterator, typename Compare>
+void parallel_sort(Executor& executor, Iterator first, Iterator last, Compare comp,
+                   size_t grain = 4096);
+
+/// Sort [first, last) with operator<.
+template <typename Iterator>
+void parallel_sort(Executor& executor, Iterator first, Iterator last);
+
+END_AVALON_NS2
+
+#include "parallel.tpl.h"
+
+#endif // THREAD_PARALLEL_H
@@ -0,0 +1,199 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_PARALLEL_TPL_H
+#define THREAD_PARALLEL_TPL_H
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+#include <boost/optional.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+namespace detail {
+    /// The chunk function of parallel_for.
+    template <typename Index, typename Function>
+    struct ForChunk
+    {
+        Index first;
+        Function f;
+        
+        ForChunk(Index first, const Function& f) : first(first), f(f) {}
+        
+        void operator()(size_t begin, size_t end)
+        {
+            Index last = first + end;
+            for (Index i = first + begin; i != last; ++i)
+                f(i);
+        }
+    };
+    
+    /// The chunk function of parallel_transform.
+    template <typename InputIterator, typename OutputIterator, typename UnaryOperation>
+    struct TransformChunk
+    {
+        InputIterator first;
+        OutputIterator out;
+        UnaryOperation op;
+        
+        TransformChunk(InputIterator first, OutputIterator out, const UnaryOperation& op)
+         :  first(first), out(out), op(op) {}
+        
+        void operator()(size_t begin, size_t end)
+        {
+            std::transform(first + begin, first + end, out + begin, op);
+        }
+    };
+    
+    /// The chunk function of parallel_reduce.
+    template <typename Iterator, typename T, typename BinaryOperation>
+    struct ReduceChunk
+    {
+        typedef boost::detail::spinlock Lock;
+        
+        Iterator first;
+        BinaryOperation op;
+        Lock* lock;
+        boost::optional<T>* total;
+        
+        ReduceChunk(Iterator first, const BinaryOperation& op, Lock* lock,
+                    boost::optional<T>* total)
+         :  first(first), op(op), lock(lock), total(total) {}
+        
+        void operator()(size_t begin, size_t end)
+        {
+            Iterator it = first + begin, last = first + end;
+            T partial = *it;
+            for (++it; it != last; ++it)
+                partial = op(partial, *it);
+            
+            Lock::scoped_lock guard(*lock);
+            if (*total)
+                **total = op(**total, partial);
+            else
+                *total = partial;
+        }
+    };
+    
+    /// The chunk function of parallel_sort, which sorts or merges blocks.
+    /**
+     * Chunk i covers the blocks [i * width, (i + 1) * width); with width
+     * 1 the block is sorted, otherwise its two halves are merged.
+     */
+    template <typename Iterator, typename Compare>
+    struct SortChunk
+    {
+        Iterator first;
+        Compare comp;
+        const std::vector<size_t>* bounds;
+        size_t width;
+        
+        SortChunk(Iterator first, const Compare& comp, const std::vector<size_t>* bounds,
+                  size_t width)
+         :  first(first), comp(comp), bounds(bounds), width(width) {}
+        
+        void operator()(size_t begin, size_t end)
+        {
+            size_t blocks = bounds->size() - 1;
+            for (size_t i=begin; i<end; i++) {
+                size_t low = i * width;
+                size_t high = std::min(low + width, blocks);
+                if (width == 1) {
+                    std::sort(first + (*bounds)[low], first + (*bounds)[high], comp);
+                } else {
+                    size_t middle = low + width / 2;
+                    if (middle < high) {
+                        std::inplace_merge(first + (*bounds)[low], first + (*bounds)[middle],
+                                           first + (*bounds)[high], comp);
+                    }
+                }
+            }
+        }
+    };
+}
+
+template <typename Index, typename Function>
+void parallel_for(Executor& executor, Index first, Index last, Function f, size_t grain)
+{
+    if (!(first < last))
+        return;
+    ParallelLoop::run(executor, 0, last - first, grain,
+                      detail::ForChunk<Index, Function>(first, f));
+}
+
+template <typename InputIterator, typename OutputIterator, typename UnaryOperation>
+OutputIterator parallel_transform(Executor& executor, InputIterator first,
+                                  InputIterator last, OutputIterator out,
+                                  UnaryOperation op, size_t grain)
+{
+    size_t count = std::distance(first, last);
+    ParallelLoop::run(executor, 0, count, grain,
+        detail::TransformChunk<InputIterator, OutputIterator, UnaryOperation>(first, out, op));
+    return out + count;
+}
+
+template <typename Iterator, typename T, typename BinaryOperation>
+T parallel_reduce(Executor& executor, Iterator first, Iterator last, T init,
+                  BinaryOperation op, size_t grain)
+{
+    boost::detail::spinlock lock = BOOST_DETAIL_SPINLOCK_INIT;
+    boost::optional<T> total;
+    ParallelLoop::run(executor, 0, std::distance(first, last), grain,
+        detail::ReduceChunk<Iterator, T, BinaryOperation>(first, op, &lock, &total));
+    return total ? op(init, *total) : init;
+}
+
+template <typename Iterator, typename Compare>
+void parallel_sort(Executor& executor, Iterator first, Iterator last, Compare comp,
+                   size_t grain)
+{
+    size_t count = std::distance(first, last);
+    size_t blocks = std::min(executor.concurrency() + 1, count / std::max(grain, (size_t)1));
+    if (blocks <= 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+    
+    std::vector<size_t> bounds(blocks + 1);
+    for (size_t i=0; i<=blocks; i++)
+        bounds[i] = count * i / blocks;
+    
+    // sort each block, then merge neighbours until one block is left.
+    for (size_t width=1; width/2 < blocks; width *= 2) {
+        ParallelLoop::run(executor, 0, (blocks + width - 1) / width, 1,
+            detail::SortChunk<Iterator, Compare>(first, comp, &bounds, width));
+    }
+}
+
+template <typename Iterator>
+void parallel_sort(Executor& executor, Iterator first, Iterator last)
+{
+    typedef typename std::iterator_traits<Iterator>::value_type Value;
+    parallel_sort(executor, first, last, std::less<Value>());
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_PARALLEL_TPL_H
@@ -0,0 +1,119 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_PRIORITYLANES_H
+#define THREAD_PRIORITYLANES_H
+
+#include "../define.h"
+
+#include <deque>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The locked multi-lane FIFO queue.
+/**
+ * Lane 0 has the highest priority. pop() takes from the highest 
+ * non-empty lane, but a lane which has been passed over aging() times 
+ * in a row is served first, so that low lanes still progress under 
+ * a steady stream of high priority items.
+ *
+ * The lane sizes are kept in atomics, so that they can be checked 
+ * without taking the lock.
+ */
+template <typename T>
+class PriorityLanes : private boost::noncopyable
+{
+public:
+    /// The default aging limit.
+    static const size_t DEFAULT_AGING = 8;
+    
+    /// Create a new queue.
+    /**
+     * @param lanes The lane count.
+     * @param aging The number of times a lane can be passed over before 
+     *      it is served. Zero means strict priority.
+     */
+    explicit PriorityLanes(size_t lanes, size_t aging = DEFAULT_AGING);
+    
+    /// Push an item to a lane.
+    void push(const T& item, size_t lane);
+    
+    /// Push a range of items to a lane, under one lock.
+    template <typename Iterator>
+    void push(Iterator begin, Iterator end, size_t lane);
+    
+    /// Pop the next item.
+    /**
+     * @return false if all lanes are empty.
+     */
+    bool pop(T& item);
+    
+    /// The item count of all lanes.
+    size_t size() const;
+    
+    /// The item count of a lane.
+    size_t size(size_t lane) const;
+    
+    /// Whether all lanes are empty.
+    bool empty() const;
+    
+    /// The lane count.
+    size_t lanes() const;
+    
+    /// Get the aging limit.
+    size_t aging() const;
+    
+    /// Set the aging limit.
+    void set_aging(size_t aging);
+    
+protected:
+    /// The lock type.
+    typedef boost::mutex Lock;
+    
+    /// The lock.
+    mutable Lock lock_;
+    
+    /// The lanes.
+    std::vector< std::deque<T> > queues_;
+    
+    /// The times each lane has been passed over.
+    std::vector<size_t> skipped_;
+    
+    /// The size of each lane.
+    boost::scoped_array< boost::atomic<size_t> > sizes_;
+    
+    /// The total size.
+    boost::atomic<size_t> size_;
+    
+    /// The aging limit.
+    size_t aging_;
+};
+
+END_AVALON_NS2
+
+#include "prioritylanes.tpl.h"
+
+#endif // THREAD_PRIORITYLANES_H
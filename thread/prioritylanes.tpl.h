@@ -0,0 +1,143 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_PRIORITYLANES_TPL_H
+#define THREAD_PRIORITYLANES_TPL_H
+
+#include "prioritylanes.h"
+
+#include <boost/swap.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+template <typename T>
+const size_t PriorityLanes<T>::DEFAULT_AGING;
+
+template <typename T>
+PriorityLanes<T>::PriorityLanes(size_t lanes, size_t aging)
+ :  lock_(),
+    queues_(lanes),
+    skipped_(lanes, 0),
+    sizes_(new boost::atomic<size_t>[lanes]),
+    size_(0),
+    aging_(aging)
+{
+    for (size_t i=0; i<lanes; i++) {
+        sizes_[i].store(0, boost::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+void PriorityLanes<T>::push(const T& item, size_t lane)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    queues_[lane].push_back(item);
+    sizes_[lane].store(queues_[lane].size(), boost::memory_order_relaxed);
+    size_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+template <typename T>
+template <typename Iterator>
+void PriorityLanes<T>::push(Iterator begin, Iterator end, size_t lane)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    size_t before = queues_[lane].size();
+    queues_[lane].insert(queues_[lane].end(), begin, end);
+    sizes_[lane].store(queues_[lane].size(), boost::memory_order_relaxed);
+    size_.fetch_add(queues_[lane].size() - before, boost::memory_order_relaxed);
+}
+
+template <typename T>
+bool PriorityLanes<T>::pop(T& item)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    size_t lanes = queues_.size();
+    size_t best = 0;
+    while (best < lanes && queues_[best].empty())
+        best++;
+    if (best == lanes)
+        return false;
+    
+    // The lowest starving lane goes first.
+    size_t chosen = best;
+    if (aging_) {
+        for (size_t i=lanes-1; i>best; i--) {
+            if (!queues_[i].empty() && skipped_[i] >= aging_) {
+                chosen = i;
+                break;
+            }
+        }
+    }
+    for (size_t i=best; i<lanes; i++) {
+        if (i != chosen && !queues_[i].empty())
+            skipped_[i]++;
+    }
+    skipped_[chosen] = 0;
+    
+    std::deque<T>& queue = queues_[chosen];
+    boost::swap(item, queue.front());
+    queue.pop_front();
+    sizes_[chosen].store(queue.size(), boost::memory_order_relaxed);
+    size_.fetch_sub(1, boost::memory_order_relaxed);
+    return true;
+}
+
+template <typename T>
+size_t PriorityLanes<T>::size() const
+{
+    return size_.load(boost::memory_order_relaxed);
+}
+
+template <typename T>
+size_t PriorityLanes<T>::size(size_t lane) const
+{
+    return sizes_[lane].load(boost::memory_order_relaxed);
+}
+
+template <typename T>
+bool PriorityLanes<T>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename T>
+size_t PriorityLanes<T>::lanes() const
+{
+    return queues_.size();
+}
+
+template <typename T>
+size_t PriorityLanes<T>::aging() const
+{
+    boost::unique_lock<Lock> locker(lock_);
+    return aging_;
+}
+
+template <typename T>
+void PriorityLanes<T>::set_aging(size_t aging)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    aging_ = aging;
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_PRIORITYLANES_TPL_H
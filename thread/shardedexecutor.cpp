@@ -0,0 +1,313 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "shardedexecutor.h"
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/foreach.hpp>
+
+#include "errors.h"
+#include "tracer.h"
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The executor whose worker is the current thread.
+    __thread const ShardedExecutor* current_executor = NULL;
+    
+    /// The shard of the current worker.
+    __thread size_t current_index = 0;
+}
+
+const size_t ShardedExecutor::DONATE_THRESHOLD;
+
+ShardedExecutor::Shard::Shard()
+ :  queue(),
+    depth(0),
+    executed(0),
+    donated(0),
+    sleeping(false),
+    lock(),
+    cond()
+{
+}
+
+ShardedExecutor::ShardedExecutor(size_t shards, size_t max_queue, bool donate,
+                                 const Placement& placement)
+ :  shard_count_(shards),
+    max_queue_(max_queue),
+    donate_(donate),
+    shards_(new Shard[shards]),
+    threads_(),
+    stopping_(false),
+    sleepers_(0),
+    next_(0),
+    stop_lock_(),
+    stopped_(false)
+{
+    if (!shards)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("shards") );
+    threads_.set_placement(placement);
+    for (size_t i=0; i<shards; i++) {
+        threads_.create_thread(boost::bind(&ShardedExecutor::run_shard, this, i));
+    }
+}
+
+ShardedExecutor::~ShardedExecutor()
+{
+    stop();
+}
+
+void ShardedExecutor::stop()
+{
+    stopping_.store(true);
+    for (size_t i=0; i<shard_count_; i++) {
+        boost::unique_lock<boost::mutex> locker(shards_[i].lock);
+        shards_[i].cond.notify_all();
+    }
+    threads_.join_all();
+    
+    // The workers are gone, so the holder of stop_lock_ is the consumer now.
+    boost::mutex::scoped_lock locker(stop_lock_);
+    stopped_ = true;
+    for (size_t i=0; i<shard_count_; i++) {
+        while (AsyncResult* job = shards_[i].queue.pop()) {
+            AsyncResultPtr holder(job, false);
+            shards_[i].depth.fetch_sub(1);
+            job->cancel();
+        }
+    }
+}
+
+void ShardedExecutor::cancel_stopped(size_t shard)
+{
+    boost::mutex::scoped_lock locker(stop_lock_);
+    if (!stopped_)
+        return;
+    while (AsyncResult* job = shards_[shard].queue.pop()) {
+        AsyncResultPtr holder(job, false);
+        shards_[shard].depth.fetch_sub(1);
+        job->cancel();
+    }
+}
+
+size_t ShardedExecutor::shard_count() const
+{
+    return shard_count_;
+}
+
+size_t ShardedExecutor::shard_of(size_t key) const
+{
+    // Fibonacci hashing, so that keys differing in low bits spread.
+    boost::uint64_t mixed = (boost::uint64_t)key * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(mixed >> 32) % shard_count_;
+}
+
+size_t ShardedExecutor::current_shard() const
+{
+    return current_executor == this ? current_index : shard_count_;
+}
+
+AsyncResultPtr ShardedExecutor::submit(const AsyncResult::Task& job, 
+                                       const AsyncResult::Callback& callback, size_t key)
+{
+    AsyncResultPtr ar(new AsyncResult(job));
+    ar->add_all(callback);
+    return submit(ar, key);
+}
+
+AsyncResultPtr ShardedExecutor::submit(const AsyncResultPtr& ar, size_t key)
+{
+    if (try_submit(ar, key) != SUBMIT_OK)
+        AVALON_THROW(AvalonThreadPoolIsFull);
+    return ar;
+}
+
+Executor::SubmitStatus ShardedExecutor::try_submit(const AsyncResultPtr& ar, size_t key)
+{
+    size_t index = shard_of(key);
+    if (!reserve(index, 1))
+        return SUBMIT_FULL;
+    push(index, ar.get());
+    return SUBMIT_OK;
+}
+
+JoinResult::Ptr ShardedExecutor::submit_bulk(const std::vector<AsyncResultPtr>& jobs, size_t key)
+{
+    size_t index = shard_of(key);
+    if (!reserve(index, jobs.size()))
+        AVALON_THROW(AvalonThreadPoolIsFull);
+    
+    JoinResult::Ptr group = JoinResult::create(jobs, JoinResult::JOIN_ALL);
+    BOOST_FOREACH(const AsyncResultPtr& p, jobs) {
+        push(index, p.get());
+    }
+    return group;
+}
+
+AsyncResultPtr ShardedExecutor::submit(const AsyncResultPtr& ar)
+{
+    if (try_submit(ar) != SUBMIT_OK)
+        AVALON_THROW(AvalonThreadPoolIsFull);
+    return ar;
+}
+
+Executor::SubmitStatus ShardedExecutor::try_submit(const AsyncResultPtr& ar)
+{
+    size_t index = current_shard();
+    if (index == shard_count_)
+        index = next_.fetch_add(1, boost::memory_order_relaxed) % shard_count_;
+    if (!reserve(index, 1))
+        return SUBMIT_FULL;
+    push(index, ar.get());
+    return SUBMIT_OK;
+}
+
+JoinResult::Ptr ShardedExecutor::submit_bulk(const std::vector<AsyncResultPtr>& jobs)
+{
+    JoinResult::Ptr group = JoinResult::create(jobs, JoinResult::JOIN_ALL);
+    for (size_t i=0; i<jobs.size(); i++) {
+        if (try_submit(jobs[i]) == SUBMIT_OK)
+            continue;
+        for (; i<jobs.size(); i++) {
+            jobs[i]->cancel();
+        }
+        AVALON_THROW(AvalonThreadPoolIsFull);
+    }
+    return group;
+}
+
+size_t ShardedExecutor::concurrency()
+{
+    return shard_count_;
+}
+
+size_t ShardedExecutor::depth(size_t shard) const
+{
+    return shards_[shard].depth.load(boost::memory_order_relaxed);
+}
+
+std::vector<ShardedExecutor::ShardStats> ShardedExecutor::shard_stats() const
+{
+    std::vector<ShardStats> ret(shard_count_);
+    for (size_t i=0; i<shard_count_; i++) {
+        ret[i].depth = shards_[i].depth.load(boost::memory_order_relaxed);
+        ret[i].executed = shards_[i].executed.load(boost::memory_order_relaxed);
+        ret[i].donated = shards_[i].donated.load(boost::memory_order_relaxed);
+    }
+    return ret;
+}
+
+bool ShardedExecutor::reserve(size_t shard, size_t n)
+{
+    if (stopping_.load())
+        return false;
+    size_t depth = shards_[shard].depth.fetch_add(n);
+    if (max_queue_ && depth + n > max_queue_) {
+        shards_[shard].depth.fetch_sub(n);
+        return false;
+    }
+    return true;
+}
+
+void ShardedExecutor::push(size_t shard, AsyncResult* job)
+{
+    Tracer::on_submit(*job);
+    shards_[shard].queue.push(job);
+    wake(shards_[shard]);
+    
+    // The push is a seq_cst RMW, so either stop() sees the job, or this 
+    // sees the flag. Unless the workers are gone, stop() drains it later.
+    if (stopping_.load())
+        cancel_stopped(shard);
+}
+
+void ShardedExecutor::wake(Shard& shard)
+{
+    // Pairs with idle_wait(), which sets the flag before checking the queue.
+    if (shard.sleeping.load()) {
+        boost::unique_lock<boost::mutex> locker(shard.lock);
+        shard.cond.notify_one();
+    }
+}
+
+void ShardedExecutor::run_shard(size_t index)
+{
+    current_executor = this;
+    current_index = index;
+    Shard& shard = shards_[index];
+    
+    while (!stopping_.load(boost::memory_order_relaxed)) {
+        AsyncResult* job = shard.queue.pop();
+        if (!job) {
+            idle_wait(shard);
+            continue;
+        }
+        AsyncResultPtr holder(job, false);
+        shard.depth.fetch_sub(1, boost::memory_order_relaxed);
+        if (donate_ && sleepers_.load(boost::memory_order_relaxed) && 
+            shard.depth.load(boost::memory_order_relaxed) >= DONATE_THRESHOLD)
+            donate(index);
+        
+        Tracer::on_event(Tracer::DEQUEUE, *job);
+        job->execute();
+        shard.executed.fetch_add(1, boost::memory_order_relaxed);
+    }
+}
+
+void ShardedExecutor::idle_wait(Shard& shard)
+{
+    boost::unique_lock<boost::mutex> locker(shard.lock);
+    shard.sleeping.store(true);
+    sleepers_.fetch_add(1);
+    while (!shard.queue.has_pushed() && !stopping_.load())
+        shard.cond.wait(locker);
+    sleepers_.fetch_sub(1);
+    shard.sleeping.store(false);
+}
+
+void ShardedExecutor::donate(size_t index)
+{
+    Shard& shard = shards_[index];
+    for (size_t i=1; i<shard_count_; i++) {
+        Shard& idle = shards_[(index + i) % shard_count_];
+        if (!idle.sleeping.load())
+            continue;
+        
+        // Move the oldest half, which would wait the longest here.
+        size_t n = shard.depth.load() / 2;
+        for (size_t k=0; k<n; k++) {
+            AsyncResult* job = shard.queue.pop();
+            if (!job)
+                break;
+            shard.depth.fetch_sub(1);
+            idle.depth.fetch_add(1);
+            idle.queue.push(job);
+            intrusive_ptr_release(job);
+            shard.donated.fetch_add(1, boost::memory_order_relaxed);
+        }
+        wake(idle);
+        return;
+    }
+}
+
+END_AVALON_NS2
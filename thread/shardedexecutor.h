@@ -0,0 +1,246 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_SHARDEDEXECUTOR_H
+#define THREAD_SHARDEDEXECUTOR_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "asyncresult.h"
+#include "executor.h"
+#include "jobqueue.h"
+#include "threadgroup.h"
+#include "topology.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The executor which runs all jobs of a key on the same worker.
+/**
+ * Each shard has one worker thread and one JobQueue, which only that 
+ * worker pops. A submit key is hashed to a shard, so the state of a 
+ * key (e.g. a per-user cache) is only touched by one thread, needs no 
+ * lock, and stays hot in that core's cache. Pin the workers with 
+ * Placement::compact() to keep each shard on one core.
+ * 
+ * A hot key makes its shard deep while others idle. With donation 
+ * enabled, a worker whose shard is deep gives half of its backlog 
+ * to a sleeping shard, which trades affinity and order for latency. 
+ * shard_stats() reports the depth of each shard, to find hot keys.
+ */
+class ShardedExecutor : public Executor, private boost::noncopyable
+{
+public:
+    /// The statistics of a shard.
+    struct ShardStats
+    {
+        /// The jobs waiting in the shard.
+        size_t depth;
+        
+        /// The jobs executed by the worker of the shard.
+        size_t executed;
+        
+        /// The jobs the worker gave to idle shards.
+        size_t donated;
+    };
+    
+    /// The minimum shard depth to donate jobs.
+    static const size_t DONATE_THRESHOLD = 4;
+    
+    /// Create the shards and start their workers.
+    /**
+     * @param shards The shard count, which is also the thread count.
+     * @param max_queue The maximum depth of each shard. Zero means no limit.
+     * @param donate Whether deep shards give jobs to idle ones.
+     * @param placement The placement of the workers, by shard.
+     * 
+     * @throw AvalonInvalidArgument if shards is zero.
+     */
+    ShardedExecutor(size_t shards, size_t max_queue = 0, bool donate = false,
+                    const Placement& placement = Placement());
+    
+    /// Stop the workers and dispose the executor.
+    virtual ~ShardedExecutor();
+    
+    /// Stop the workers, and cancel the jobs left.
+    /**
+     * Later submissions are rejected as full.
+     */
+    void stop();
+    
+    /// The shard count.
+    size_t shard_count() const;
+    
+    /// The shard of a key.
+    /**
+     * The key is mixed before reduced, so sequential keys spread. Hash 
+     * other key types with boost::hash first.
+     */
+    size_t shard_of(size_t key) const;
+    
+    /// The shard the calling thread is the worker of.
+    /**
+     * @return shard_count() if called outside the workers.
+     */
+    size_t current_shard() const;
+    
+    /// Add a job to the shard of a key.
+    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback, 
+                          size_t key);
+    
+    /// Add a prepared AsyncResult to the shard of a key.
+    /**
+     * @throw AvalonThreadPoolIsFull if the shard is full.
+     */
+    AsyncResultPtr submit(const AsyncResultPtr& ar, size_t key);
+    
+    /// Add a prepared AsyncResult to the shard of a key, unless it is full.
+    SubmitStatus try_submit(const AsyncResultPtr& ar, size_t key);
+    
+    /// Add a batch of prepared AsyncResults to the shard of a key, in order.
+    /**
+     * @throw AvalonThreadPoolIsFull if the shard has no room for all.
+     */
+    JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs, size_t key);
+    
+    /// Add a prepared AsyncResult without a key.
+    /**
+     * A worker submits to its own shard, other threads deal the jobs 
+     * to the shards in turn.
+     */
+    virtual AsyncResultPtr submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult without a key, unless the shard is full.
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    /// Deal a batch of prepared AsyncResults to the shards in turn.
+    /**
+     * @throw AvalonThreadPoolIsFull if a shard is full. The jobs not 
+     *      queued are cancelled.
+     */
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// The shard count.
+    virtual size_t concurrency();
+    
+    /// The jobs waiting in a shard.
+    size_t depth(size_t shard) const;
+    
+    /// The statistics of all shards.
+    std::vector<ShardStats> shard_stats() const;
+    
+protected:
+    /// The shard.
+    struct Shard
+    {
+        /// The jobs, popped by the worker only.
+        JobQueue queue;
+        
+        /// The jobs waiting.
+        boost::atomic<size_t> depth;
+        
+        /// The jobs executed.
+        boost::atomic<size_t> executed;
+        
+        /// The jobs given to idle shards.
+        boost::atomic<size_t> donated;
+        
+        /// Whether the worker sleeps, or is about to.
+        boost::atomic<bool> sleeping;
+        
+        /// The lock for the sleeping worker.
+        boost::mutex lock;
+        
+        /// The condition variable for the sleeping worker.
+        boost::condition_variable cond;
+        
+        /// Keep the shards on different cache lines.
+        char pad[AVALON_CACHE_LINE];
+        
+        /// Create an empty shard.
+        Shard();
+    };
+    
+    /// The shard count.
+    const size_t shard_count_;
+    
+    /// The maximum depth of each shard.
+    const size_t max_queue_;
+    
+    /// Whether deep shards give jobs to idle ones.
+    const bool donate_;
+    
+    /// The shards.
+    boost::scoped_array<Shard> shards_;
+    
+    /// The workers.
+    ThreadGroup threads_;
+    
+    /// Whether the workers should exit.
+    boost::atomic<bool> stopping_;
+    
+    /// The sleeping worker count.
+    boost::atomic<size_t> sleepers_;
+    
+    /// The next shard for jobs without a key.
+    boost::atomic<size_t> next_;
+    
+    /// The lock of stopped_, and of the queues once the workers are gone.
+    boost::mutex stop_lock_;
+    
+    /// Whether the workers have been joined.
+    bool stopped_;
+    
+    /// Count n more jobs in a shard, unless it has no room for them or it stops.
+    bool reserve(size_t shard, size_t n);
+    
+    /// Cancel the jobs of a shard, if the workers are gone. 
+    /**
+     * For a job pushed while stop() was running, which its drain may 
+     * have missed.
+     */
+    void cancel_stopped(size_t shard);
+    
+    /// Queue a job to a shard, which has been reserved.
+    void push(size_t shard, AsyncResult* job);
+    
+    /// Wake up the worker of a shard, if it sleeps.
+    void wake(Shard& shard);
+    
+    /// Run the worker loop of a shard.
+    void run_shard(size_t index);
+    
+    /// Sleep until the shard has jobs, or the executor stops.
+    void idle_wait(Shard& shard);
+    
+    /// Give half of the shard's backlog to a sleeping shard, if any.
+    void donate(size_t index);
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_SHARDEDEXECUTOR_H
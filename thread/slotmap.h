@@ -0,0 +1,150 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_SLOTMAP_H
+#define THREAD_SLOTMAP_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The sharded slot map.
+/**
+ * Values live in slot arrays, which are split into shards with a lock 
+ * each. A thread inserts into its own shard, so inserts from different 
+ * threads, and erases of their values, rarely meet on a lock.
+ * 
+ * A key is the generation of the slot in the high 32 bits, and the 
+ * slot index in the low 32 bits. Erasing bumps the generation, so a 
+ * stale key never finds the value which reuses the slot. Freed slots 
+ * are linked in a free list, so insert and erase are O(1), and do not 
+ * allocate unless a shard outgrows its reserved capacity.
+ * 
+ * The live generations are odd, so zero is never a valid key.
+ */
+template <typename T>
+class SlotMap : private boost::noncopyable
+{
+public:
+    /// The key type.
+    typedef boost::uint64_t Key;
+    
+    /// The shard count.
+    static const size_t SHARD_COUNT = 16;
+    
+    /// Create an empty map.
+    /**
+     * @param capacity The slot count to reserve over all shards.
+     */
+    explicit SlotMap(size_t capacity = 0);
+    
+    /// Insert a value into the shard of the calling thread.
+    /**
+     * @return The key of the value.
+     */
+    Key insert(const T& value);
+    
+    /// Remove a value.
+    /**
+     * @param value Receives the removed value.
+     * @return false if the key is stale or invalid.
+     */
+    bool erase(Key key, T& value);
+    
+    /// Get a value.
+    /**
+     * @return false if the key is stale or invalid.
+     */
+    bool get(Key key, T& value) const;
+    
+    /// The value count.
+    /**
+     * Sums the shard counts without locking, so it may be stale while 
+     * other threads insert or erase.
+     */
+    size_t size() const;
+    
+    /// Copy all values out, shard by shard.
+    void collect(std::vector<T>& values) const;
+    
+    /// Remove all values, and move them out.
+    void clear(std::vector<T>& values);
+    
+protected:
+    /// The end of a free list.
+    static const boost::uint32_t NO_SLOT = 0xffffffff;
+    
+    /// The slot.
+    struct Slot
+    {
+        /// The value, or T() if free.
+        T value;
+        
+        /// The generation. Odd if the slot is used.
+        boost::uint32_t generation;
+        
+        /// The next free slot in the shard.
+        boost::uint32_t next;
+    };
+    
+    /// The lock type.
+    typedef boost::mutex Lock;
+    
+    /// The shard.
+    struct Shard
+    {
+        /// The lock.
+        mutable Lock lock;
+        
+        /// The slots.
+        std::vector<Slot> slots;
+        
+        /// The first free slot.
+        boost::uint32_t free;
+        
+        /// The value count. Written under the lock, read without it.
+        boost::atomic<size_t> count;
+        
+        /// Keep the shard locks on different cache lines.
+        char pad[AVALON_CACHE_LINE];
+    };
+    
+    /// The shards.
+    Shard shards_[SHARD_COUNT];
+    
+    /// The shard of the calling thread.
+    static size_t current_shard();
+    
+    /// Free a used slot. The shard lock must be held.
+    void release(Shard& shard, boost::uint32_t index);
+};
+
+END_AVALON_NS2
+
+#include "slotmap.tpl.h"
+
+#endif // THREAD_SLOTMAP_H
@@ -0,0 +1,167 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_SLOTMAP_TPL_H
+#define THREAD_SLOTMAP_TPL_H
+
+#include "slotmap.h"
+
+BEGIN_AVALON_NS2(thread)
+
+template <typename T>
+const size_t SlotMap<T>::SHARD_COUNT;
+
+template <typename T>
+const boost::uint32_t SlotMap<T>::NO_SLOT;
+
+template <typename T>
+SlotMap<T>::SlotMap(size_t capacity)
+{
+    for (size_t i=0; i<SHARD_COUNT; i++) {
+        shards_[i].slots.reserve((capacity + SHARD_COUNT - 1) / SHARD_COUNT);
+        shards_[i].free = NO_SLOT;
+        shards_[i].count.store(0, boost::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+size_t SlotMap<T>::current_shard()
+{
+    // Threads are dealt to shards in turn, on their first insert.
+    static boost::atomic<size_t> next(0);
+    static __thread size_t shard = 0;
+    if (!shard)
+        shard = next.fetch_add(1, boost::memory_order_relaxed) % SHARD_COUNT + 1;
+    return shard - 1;
+}
+
+template <typename T>
+typename SlotMap<T>::Key SlotMap<T>::insert(const T& value)
+{
+    size_t s = current_shard();
+    Shard& shard = shards_[s];
+    boost::unique_lock<Lock> locker(shard.lock);
+    
+    boost::uint32_t index = shard.free;
+    if (index != NO_SLOT) {
+        shard.free = shard.slots[index].next;
+    } else {
+        Slot slot = { T(), 0, NO_SLOT };
+        index = shard.slots.size();
+        shard.slots.push_back(slot);
+    }
+    Slot& slot = shard.slots[index];
+    slot.value = value;
+    slot.generation++;
+    // The lock serializes writers, so a plain store is enough.
+    shard.count.store(shard.count.load(boost::memory_order_relaxed) + 1, 
+                      boost::memory_order_relaxed);
+    return (Key(slot.generation) << 32) | (Key(index) * SHARD_COUNT + s);
+}
+
+template <typename T>
+bool SlotMap<T>::erase(Key key, T& value)
+{
+    boost::uint32_t generation = key >> 32;
+    size_t position = key & 0xffffffff;
+    Shard& shard = shards_[position % SHARD_COUNT];
+    boost::uint32_t index = position / SHARD_COUNT;
+    
+    boost::unique_lock<Lock> locker(shard.lock);
+    if (!(generation & 1) || index >= shard.slots.size() || 
+        shard.slots[index].generation != generation)
+        return false;
+    value = shard.slots[index].value;
+    release(shard, index);
+    return true;
+}
+
+template <typename T>
+bool SlotMap<T>::get(Key key, T& value) const
+{
+    boost::uint32_t generation = key >> 32;
+    size_t position = key & 0xffffffff;
+    const Shard& shard = shards_[position % SHARD_COUNT];
+    boost::uint32_t index = position / SHARD_COUNT;
+    
+    boost::unique_lock<Lock> locker(shard.lock);
+    if (!(generation & 1) || index >= shard.slots.size() || 
+        shard.slots[index].generation != generation)
+        return false;
+    value = shard.slots[index].value;
+    return true;
+}
+
+template <typename T>
+size_t SlotMap<T>::size() const
+{
+    size_t ret = 0;
+    for (size_t s=0; s<SHARD_COUNT; s++) {
+        ret += shards_[s].count.load(boost::memory_order_relaxed);
+    }
+    return ret;
+}
+
+template <typename T>
+void SlotMap<T>::collect(std::vector<T>& values) const
+{
+    values.reserve(values.size() + size());
+    for (size_t s=0; s<SHARD_COUNT; s++) {
+        const Shard& shard = shards_[s];
+        boost::unique_lock<Lock> locker(shard.lock);
+        for (size_t i=0; i<shard.slots.size(); i++) {
+            if (shard.slots[i].generation & 1)
+                values.push_back(shard.slots[i].value);
+        }
+    }
+}
+
+template <typename T>
+void SlotMap<T>::clear(std::vector<T>& values)
+{
+    values.reserve(values.size() + size());
+    for (size_t s=0; s<SHARD_COUNT; s++) {
+        Shard& shard = shards_[s];
+        boost::unique_lock<Lock> locker(shard.lock);
+        for (size_t i=0; i<shard.slots.size(); i++) {
+            if (shard.slots[i].generation & 1) {
+                values.push_back(shard.slots[i].value);
+                release(shard, i);
+            }
+        }
+    }
+}
+
+template <typename T>
+void SlotMap<T>::release(Shard& shard, boost::uint32_t index)
+{
+    Slot& slot = shard.slots[index];
+    slot.value = T();
+    slot.generation++;
+    slot.next = shard.free;
+    shard.free = index;
+    shard.count.store(shard.count.load(boost::memory_order_relaxed) - 1, 
+                      boost::memory_order_relaxed);
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_SLOTMAP_TPL_H
@@ -0,0 +1,123 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "stackpool.h"
+
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+BEGIN_AVALON_NS2(thread)
+
+const size_t StackPool::DEFAULT_STACK_SIZE;
+const size_t StackPool::DEFAULT_MAX_CACHED;
+
+void* StackPool::Stack::top() const
+{
+    return (char*)base + size;
+}
+
+StackPool& StackPool::instance()
+{
+    // Never destroyed, for coroutines may finish after static destruction.
+    static StackPool* pool = new StackPool();
+    return *pool;
+}
+
+StackPool::StackPool(size_t stack_size, size_t max_cached)
+ :  stack_size_((stack_size + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE) 
+                * sysconf(_SC_PAGESIZE)),
+    max_cached_(max_cached),
+    page_size_(sysconf(_SC_PAGESIZE)),
+    lock_(),
+    free_(),
+    in_use_(0)
+{
+}
+
+StackPool::~StackPool()
+{
+    for (size_t i=0; i<free_.size(); i++) {
+        munmap(free_[i], stack_size_ + page_size_);
+    }
+}
+
+StackPool::Stack StackPool::allocate()
+{
+    Stack ret = { NULL, stack_size_ };
+    {
+        boost::mutex::scoped_lock locker(lock_);
+        if (!free_.empty()) {
+            ret.base = free_.back();
+            free_.pop_back();
+        }
+    }
+    
+    if (!ret.base) {
+        // The guard page is the lowest, for stacks grow down.
+        void* p = mmap(NULL, stack_size_ + page_size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        if (mprotect(p, page_size_, PROT_NONE) != 0) {
+            munmap(p, stack_size_ + page_size_);
+            throw std::bad_alloc();
+        }
+        ret.base = p;
+    }
+    in_use_.fetch_add(1, boost::memory_order_relaxed);
+    ret.base = (char*)ret.base + page_size_;
+    return ret;
+}
+
+void StackPool::release(const Stack& stack)
+{
+    void* base = (char*)stack.base - page_size_;
+    in_use_.fetch_sub(1, boost::memory_order_relaxed);
+    // Drop the touched pages, so a cached stack costs no memory.
+    madvise(stack.base, stack_size_, MADV_DONTNEED);
+    {
+        boost::mutex::scoped_lock locker(lock_);
+        if (free_.size() < max_cached_) {
+            free_.push_back(base);
+            return;
+        }
+    }
+    munmap(base, stack_size_ + page_size_);
+}
+
+size_t StackPool::stack_size() const
+{
+    return stack_size_;
+}
+
+size_t StackPool::in_use() const
+{
+    return in_use_.load(boost::memory_order_relaxed);
+}
+
+size_t StackPool::cached() const
+{
+    boost::mutex::scoped_lock locker(lock_);
+    return free_.size();
+}
+
+END_AVALON_NS2
@@ -0,0 +1,123 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_STACKPOOL_H
+#define THREAD_STACKPOOL_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The pool of guard-paged stacks for coroutines.
+/**
+ * Each stack is mapped with a PROT_NONE page below it, so an overflow 
+ * faults instead of corrupting the heap. Pages are only committed when 
+ * touched, so a suspended coroutine costs the few pages it used, and 
+ * 100k of them fit in memory with the default size. Each stack takes 
+ * two kernel mappings, so that many need vm.max_map_count raised above 
+ * its usual 65530.
+ * 
+ * Released stacks are cached for reuse, up to a limit, so spawning a 
+ * coroutine does not map memory in the steady state. Their pages are 
+ * given back to the system first, so the cache only holds address space.
+ */
+class StackPool : private boost::noncopyable
+{
+public:
+    /// The usable size of a stack by default.
+    static const size_t DEFAULT_STACK_SIZE = 64 * 1024;
+    
+    /// The cached stack count by default.
+    static const size_t DEFAULT_MAX_CACHED = 1024;
+    
+    /// A stack.
+    struct Stack
+    {
+        /// The start of the mapping, which is the guard page.
+        void* base;
+        
+        /// The usable size, above the guard page.
+        size_t size;
+        
+        /// The top of the stack, where it starts to grow down.
+        void* top() const;
+    };
+    
+    /// The pool shared by all coroutines by default.
+    static StackPool& instance();
+    
+    /// Create an empty pool.
+    /**
+     * @param stack_size The usable size of each stack, rounded up to pages.
+     * @param max_cached The maximum released stacks kept for reuse.
+     */
+    explicit StackPool(size_t stack_size = DEFAULT_STACK_SIZE, 
+                       size_t max_cached = DEFAULT_MAX_CACHED);
+    
+    /// Unmap the cached stacks. All stacks must have been released.
+    ~StackPool();
+    
+    /// Take a stack.
+    /**
+     * @throw std::bad_alloc if the stack cannot be mapped.
+     */
+    Stack allocate();
+    
+    /// Give a stack back.
+    void release(const Stack& stack);
+    
+    /// The usable size of each stack.
+    size_t stack_size() const;
+    
+    /// The stacks taken and not released.
+    size_t in_use() const;
+    
+    /// The released stacks kept for reuse.
+    size_t cached() const;
+    
+protected:
+    /// The usable size of each stack.
+    const size_t stack_size_;
+    
+    /// The maximum cached stacks.
+    const size_t max_cached_;
+    
+    /// The page size.
+    const size_t page_size_;
+    
+    /// The lock of free_.
+    mutable boost::mutex lock_;
+    
+    /// The cached stacks, by base.
+    std::vector<void*> free_;
+    
+    /// The stacks taken and not released.
+    boost::atomic<size_t> in_use_;
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_STACKPOOL_H
@@ -0,0 +1,178 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "strand.h"
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scope_exit.hpp>
+
+#include "errors.h"
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The strand whose turn is running in current thread.
+    __thread const Strand* current_strand = NULL;
+}
+
+const size_t Strand::BATCH;
+
+Strand::Strand(Executor& executor)
+ :  refs_(0),
+    executor_(executor),
+    queue_(),
+    scheduled_(false)
+{
+}
+
+Strand::~Strand()
+{
+}
+
+Strand::Ptr Strand::create(Executor& executor)
+{
+    return Ptr(new Strand(executor));
+}
+
+AsyncResultPtr Strand::submit(const AsyncResultPtr& ar)
+{
+    if (try_submit(ar) != SUBMIT_OK)
+        AVALON_THROW(AvalonThreadPoolIsFull);
+    return ar;
+}
+
+Executor::SubmitStatus Strand::try_submit(const AsyncResultPtr& ar)
+{
+    queue_.push(ar.get());
+    if (scheduled_.exchange(true) || schedule())
+        return SUBMIT_OK;
+    
+    // Jobs pushed by others while the flag was ours are cancelled.
+    bool kept = drop(ar.get());
+    release();
+    return kept ? SUBMIT_FULL : SUBMIT_OK;
+}
+
+JoinResult::Ptr Strand::submit_bulk(const std::vector<AsyncResultPtr>& jobs)
+{
+    JoinResult::Ptr group = JoinResult::create(jobs, JoinResult::JOIN_ALL);
+    if (jobs.empty())
+        return group;
+    BOOST_FOREACH(const AsyncResultPtr& p, jobs) {
+        queue_.push(p.get());
+    }
+    if (scheduled_.exchange(true) || schedule())
+        return group;
+    
+    drop(NULL);
+    release();
+    AVALON_THROW(AvalonThreadPoolIsFull);
+}
+
+size_t Strand::concurrency()
+{
+    return 1;
+}
+
+Executor& Strand::executor()
+{
+    return executor_;
+}
+
+bool Strand::running_in_this_thread() const
+{
+    return current_strand == this;
+}
+
+bool Strand::schedule()
+{
+    AsyncResultPtr turn(new AsyncResult(boost::bind(&Strand::drain, Ptr(this), _1)));
+    // The turn belongs to no caller, so it must not inherit a cancellation.
+    turn->orphan();
+    if (executor_.try_submit(turn) != SUBMIT_OK)
+        return false;
+    
+    // After submitting, so a rejected turn does not call back.
+    turn->add_all(boost::bind(&Strand::turn_handler, Ptr(this), _1));
+    return true;
+}
+
+bool Strand::drop(AsyncResult* keep)
+{
+    bool ret = false;
+    while (AsyncResult* job = queue_.pop()) {
+        AsyncResultPtr p(job, false);
+        if (job == keep)
+            ret = true;
+        else
+            p->cancel();
+    }
+    return ret;
+}
+
+void Strand::release()
+{
+    // Pairs with the producers, which push before taking the flag.
+    scheduled_.store(false);
+    while (queue_.has_pushed() && !scheduled_.exchange(true)) {
+        if (schedule())
+            return;
+        drop(NULL);
+        scheduled_.store(false);
+    }
+}
+
+void Strand::drain(AsyncResult& turn)
+{
+    const Strand* outer = current_strand;
+    current_strand = this;
+    BOOST_SCOPE_EXIT( (outer) ) {
+        current_strand = outer;
+    } BOOST_SCOPE_EXIT_END
+    
+    for (size_t i=0; i<BATCH; i++) {
+        AsyncResult* job = queue_.pop();
+        if (!job) {
+            release();
+            return;
+        }
+        AsyncResultPtr p(job, false);
+        p->execute();
+    }
+    
+    // Yield the thread to other work, keeping the flag.
+    if (!schedule()) {
+        drop(NULL);
+        release();
+    }
+}
+
+void Strand::turn_handler(AsyncResult& turn)
+{
+    // A turn which did not run to the end still owns the flag.
+    if (turn.status() == AsyncResult::SUCCESS)
+        return;
+    drop(NULL);
+    release();
+}
+
+END_AVALON_NS2
@@ -0,0 +1,153 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_STRAND_H
+#define THREAD_STRAND_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "asyncresult.h"
+#include "executor.h"
+#include "jobqueue.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The serial executor on top of another executor.
+/**
+ * Jobs submitted to a strand are executed one at a time, in submission 
+ * order, on the threads of the underlying executor. So the state of a 
+ * session can be touched by its jobs without a lock, and no worker 
+ * blocks on another's.
+ * 
+ * Jobs wait in an intrusive JobQueue, which only the running turn 
+ * pops. The producer which sets the scheduled flag submits one turn 
+ * job to the executor, and the turn runs a batch of jobs before 
+ * yielding the thread. A strand is a few 
+ * words, so thousands of them can share a pool.
+ * 
+ * If the executor rejects or drops a turn, the jobs queued at that time 
+ * are cancelled.
+ */
+class Strand : public Executor, private boost::noncopyable
+{
+public:
+    /// The Strand pointer type.
+    typedef boost::intrusive_ptr<Strand> Ptr;
+    
+    /// The maximum jobs run by one turn.
+    static const size_t BATCH = 64;
+    
+    /// Create a strand on an executor, which must outlive the strand's jobs.
+    static Ptr create(Executor& executor);
+    
+    /// Dispose the strand.
+    virtual ~Strand();
+    
+    /// Add a prepared AsyncResult to the strand.
+    /**
+     * @throw AvalonThreadPoolIsFull if the executor rejects the strand's 
+     *      turn. The job is not queued.
+     */
+    virtual AsyncResultPtr submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult to the strand, unless the executor is full.
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    /// Add a batch of prepared AsyncResults to the strand, in order.
+    /**
+     * @throw AvalonThreadPoolIsFull if the executor rejects the strand's 
+     *      turn. The jobs are cancelled.
+     */
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// Always one.
+    virtual size_t concurrency();
+    
+    /// The underlying executor.
+    Executor& executor();
+    
+    /// Whether the calling thread is running a turn of this strand.
+    bool running_in_this_thread() const;
+    
+private:
+    /// The reference count.
+    boost::atomic<size_t> refs_;
+    
+    /// The underlying executor.
+    Executor& executor_;
+    
+    /// The queued jobs, consumed by the turn which owns the flag.
+    JobQueue queue_;
+    
+    /// Whether a turn owns the queue.
+    boost::atomic<bool> scheduled_;
+    
+    /// Create a strand.
+    explicit Strand(Executor& executor);
+    
+    /// Submit a turn. The flag must be owned.
+    /**
+     * @return false if the executor rejects it.
+     */
+    bool schedule();
+    
+    /// Cancel all queued jobs, except keep. The flag must be owned.
+    /**
+     * @return Whether keep was queued. It is left untouched.
+     */
+    bool drop(AsyncResult* keep);
+    
+    /// Clear the flag, and take it again if jobs arrived meanwhile.
+    void release();
+    
+    /// Run a turn.
+    void drain(AsyncResult& turn);
+    
+    /// The callback of a turn, which takes over a dropped turn.
+    void turn_handler(AsyncResult& turn);
+    
+    friend void intrusive_ptr_add_ref(Strand* p);
+    friend void intrusive_ptr_release(Strand* p);
+};
+
+/// Increase the reference count.
+inline void intrusive_ptr_add_ref(Strand* p)
+{
+    p->refs_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+/// Decrease the reference count, and dispose the Strand on zero.
+inline void intrusive_ptr_release(Strand* p)
+{
+    if (p->refs_.fetch_sub(1, boost::memory_order_release) == 1) {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        delete p;
+    }
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_STRAND_H
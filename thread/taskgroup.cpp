@@ -0,0 +1,127 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "taskgroup.h"
+
+#include <boost/bind.hpp>
+
+#include "clock.h"
+
+BEGIN_AVALON_NS2(thread)
+
+InFlightCounter::InFlightCounter()
+ :  count_(0),
+    waiters_(0),
+    lock_(),
+    cond_()
+{
+}
+
+void InFlightCounter::add(size_t n)
+{
+    count_.fetch_add(n);
+}
+
+void InFlightCounter::done()
+{
+    // Pairs with the waiter, which counts itself before checking count_.
+    if (count_.fetch_sub(1) == 1 && waiters_.load()) {
+        boost::unique_lock<boost::mutex> locker(lock_);
+        cond_.notify_all();
+    }
+}
+
+size_t InFlightCounter::count() const
+{
+    return count_.load();
+}
+
+bool InFlightCounter::wait_idle(size_t timeout)
+{
+    if (!count_.load())
+        return true;
+    
+    Clock::time_point until = deadline_after(timeout);
+    bool expired = false;
+    boost::unique_lock<boost::mutex> locker(lock_);
+    waiters_.fetch_add(1);
+    while (count_.load() && !expired) {
+        if (!timeout)
+            cond_.wait(locker);
+        else
+            expired = cond_.wait_until(locker, until) == boost::cv_status::timeout;
+    }
+    waiters_.fetch_sub(1);
+    return !count_.load();
+}
+
+TaskGroup::TaskGroup()
+ :  refs_(0),
+    in_flight_()
+{
+}
+
+TaskGroup::Ptr TaskGroup::create()
+{
+    return Ptr(new TaskGroup());
+}
+
+AsyncResultPtr TaskGroup::add(const AsyncResultPtr& ar)
+{
+    // The job keeps the group alive until its callback is done.
+    in_flight_.add();
+    intrusive_ptr_add_ref(this);
+    ar->add_all(boost::bind(&TaskGroup::job_handler, this, _1));
+    return ar;
+}
+
+AsyncResultPtr TaskGroup::submit(Executor& executor, const AsyncResultPtr& ar)
+{
+    // A job finished before add() is counted out at once.
+    executor.submit(ar);
+    return add(ar);
+}
+
+AsyncResultPtr TaskGroup::submit(Executor& executor, const AsyncResult::Task& job, 
+                                 const AsyncResult::Callback& callback)
+{
+    AsyncResultPtr ar(new AsyncResult(job));
+    ar->add_all(callback);
+    return submit(executor, ar);
+}
+
+size_t TaskGroup::pending() const
+{
+    return in_flight_.count();
+}
+
+bool TaskGroup::wait_idle(size_t timeout)
+{
+    return in_flight_.wait_idle(timeout);
+}
+
+void TaskGroup::job_handler(AsyncResult& ar)
+{
+    in_flight_.done();
+    intrusive_ptr_release(this);
+}
+
+END_AVALON_NS2
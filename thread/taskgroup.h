@@ -0,0 +1,162 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_TASKGROUP_H
+#define THREAD_TASKGROUP_H
+
+#include "../define.h"
+
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "asyncresult.h"
+#include "executor.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// A count of unfinished jobs, which can be waited on until it drops to zero.
+/**
+ * Finishing a job costs one atomic decrement. The lock is only taken 
+ * on the transition to zero, and only if some thread is waiting, so 
+ * the job completion path never contends with the waiters.
+ */
+class InFlightCounter : private boost::noncopyable
+{
+public:
+    /// Create an idle counter.
+    InFlightCounter();
+    
+    /// Count n more jobs.
+    void add(size_t n = 1);
+    
+    /// Count one job finished, and wake up the waiters if none is left.
+    void done();
+    
+    /// The unfinished job count.
+    size_t count() const;
+    
+    /// Wait until the count drops to zero.
+    /**
+     * @param timeout The maximum waiting milliseconds. Zero means no limit.
+     * @return false if time exceeds, otherwise true (including no waiting).
+     */
+    bool wait_idle(size_t timeout = 0);
+    
+private:
+    /// The unfinished job count.
+    boost::atomic<size_t> count_;
+    
+    /// The waiting thread count.
+    boost::atomic<size_t> waiters_;
+    
+    /// The lock for the waiters.
+    boost::mutex lock_;
+    
+    /// The condition variable to notify the waiters.
+    boost::condition_variable cond_;
+};
+
+/// A set of jobs which can be waited on as a whole.
+/**
+ * Unlike a JoinResult, a TaskGroup is open: jobs can be added while 
+ * others are running, and it becomes idle each time its count drops 
+ * to zero. So a batch of jobs, which may spawn more jobs into the same 
+ * group, can be fenced without polling, whatever executor runs them.
+ * 
+ * Each added job holds a reference to the group until its callback is 
+ * done, so the group may be released before the jobs finish.
+ */
+class TaskGroup : private boost::noncopyable
+{
+public:
+    /// The TaskGroup pointer type.
+    typedef boost::intrusive_ptr<TaskGroup> Ptr;
+    
+    /// Create an empty group.
+    static Ptr create();
+    
+    /// Count a job in the group until it finishes.
+    /**
+     * A job which has already finished is counted out immediately.
+     * 
+     * @return The job.
+     */
+    AsyncResultPtr add(const AsyncResultPtr& ar);
+    
+    /// Submit a job to an executor, and count it in the group.
+    /**
+     * @throw AvalonException if the executor rejects the job, which is 
+     *      then not counted.
+     */
+    AsyncResultPtr submit(Executor& executor, const AsyncResultPtr& ar);
+    
+    /// Create a job, submit it to an executor, and count it in the group.
+    AsyncResultPtr submit(Executor& executor, const AsyncResult::Task& job, 
+                          const AsyncResult::Callback& callback);
+    
+    /// The number of jobs not yet finished.
+    size_t pending() const;
+    
+    /// Wait until all jobs in the group are finished.
+    /**
+     * @param timeout The maximum waiting milliseconds. Zero means no limit.
+     * @return false if time exceeds, otherwise true (including no waiting).
+     */
+    bool wait_idle(size_t timeout = 0);
+    
+private:
+    /// The reference count.
+    boost::atomic<size_t> refs_;
+    
+    /// The unfinished jobs.
+    InFlightCounter in_flight_;
+    
+    /// Create an empty group.
+    TaskGroup();
+    
+    /// The callback of each job.
+    void job_handler(AsyncResult& ar);
+    
+    friend void intrusive_ptr_add_ref(TaskGroup* p);
+    friend void intrusive_ptr_release(TaskGroup* p);
+};
+
+/// Increase the reference count.
+inline void intrusive_ptr_add_ref(TaskGroup* p)
+{
+    p->refs_.fetch_add(1, boost::memory_order_relaxed);
+}
+
+/// Decrease the reference count, and dispose the TaskGroup on zero.
+inline void intrusive_ptr_release(TaskGroup* p)
+{
+    if (p->refs_.fetch_sub(1, boost::memory_order_release) == 1) {
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        delete p;
+    }
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_TASKGROUP_H
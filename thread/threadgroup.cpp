@@ -28,7 +28,9 @@ using boost::shared_mutex;
 
 ThreadGroup::ThreadGroup()
  :  lock_(),
-    threads_()
+    threads_(),
+    placement_(),
+    next_index_(0)
 {
 }
 
@@ -52,6 +54,21 @@ void ThreadGroup::remove_thread(const avalon::thread::ThreadPtr& thread)
         threads_.erase(it);
 }
 
+size_t ThreadGroup::remove_finished()
+{
+    boost::lock_guard<shared_mutex> locker(lock_);
+    size_t ret = 0;
+    for (Threads::iterator it = threads_.begin(); it != threads_.end(); ) {
+        if ((*it)->timed_join(boost::posix_time::milliseconds(0))) {
+            it = threads_.erase(it);
+            ret++;
+        } else {
+            it++;
+        }
+    }
+    return ret;
+}
+
 size_t ThreadGroup::size()
 {
     boost::shared_lock<shared_mutex> locker(lock_);
@@ -76,6 +93,26 @@ void ThreadGroup::interrupt_all()
     }
 }
 
+void ThreadGroup::set_placement(const Placement& placement)
+{
+    boost::lock_guard<shared_mutex> locker(lock_);
+    placement_ = placement;
+}
+
+Placement ThreadGroup::placement()
+{
+    boost::shared_lock<shared_mutex> locker(lock_);
+    return placement_;
+}
+
+void ThreadGroup::run_placed(const Topology::CpuList& cpus, 
+                             const boost::function<void ()>& threadfunc)
+{
+    // A refused binding leaves the thread unpinned, which is still correct.
+    Topology::bind_current_thread(cpus);
+    threadfunc();
+}
+
 void ThreadGroup::join_all()
 {
     boost::shared_lock<shared_mutex> locker(lock_);
@@ -24,10 +24,14 @@
 #include "../define.h"
 
 #include <list>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/unordered_set.hpp>
 
+#include "topology.h"
+
 BEGIN_AVALON_NS2(thread)
 
 /// The shared_ptr of boost::thread.
@@ -46,6 +50,9 @@ public:
     
     /// Create a thread and add it to the group.
     /**
+     * The thread is pinned according to the placement, before calling 
+     * threadfunc.
+     * 
      * @param threadfunc Thread main loop function.
      */
     template <typename F>
@@ -63,6 +70,12 @@ public:
      */
     void remove_thread(const ThreadPtr& thread);
     
+    /// Remove the threads which have exited.
+    /**
+     * @return The number of threads removed.
+     */
+    size_t remove_finished();
+    
     /// Get the thread list.
     std::list<ThreadPtr> all_threads();
     
@@ -82,6 +95,12 @@ public:
     /// Interrupt all threads.
     void interrupt_all();
     
+    /// Set the placement of threads created later.
+    void set_placement(const Placement& placement);
+    
+    /// Get the placement.
+    Placement placement();
+    
 protected:
     /// The object lock.
     boost::shared_mutex lock_;
@@ -91,13 +110,29 @@ protected:
     
     /// The thread hashset.
     Threads threads_;
+    
+    /// The thread placement.
+    Placement placement_;
+    
+    /// The index of the next thread, for placement.
+    size_t next_index_;
+    
+    /// Pin the thread, then run the thread function.
+    static void run_placed(const Topology::CpuList& cpus, const boost::function<void ()>& threadfunc);
 };
 
 template <typename F>
 ThreadPtr ThreadGroup::create_thread(F threadfunc)
 {
     boost::lock_guard<boost::shared_mutex> locker(lock_);
-    ThreadPtr thread(new boost::thread(threadfunc));
+    Topology::CpuList cpus = placement_.cpus_for(next_index_++);
+    ThreadPtr thread;
+    if (cpus.empty()) {
+        thread.reset(new boost::thread(threadfunc));
+    } else {
+        thread.reset(new boost::thread(boost::bind(&ThreadGroup::run_placed, cpus, 
+                                                   boost::function<void ()>(threadfunc))));
+    }
     threads_.insert(thread);
     return thread;
 }
@@ -20,47 +20,95 @@
 
 #include "threadpool.h"
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/scope_exit.hpp>
 #include <boost/foreach.hpp>
 
 #include "errors.h"
+#include "tracer.h"
 
 
 BEGIN_AVALON_NS2(thread)
 
 using boost::shared_mutex;
 
-ThreadPool::ThreadPool(size_t workers, size_t max_queue)
- :  running_(false),
+namespace {
+    /// The WORK_STEALING worker running in current thread.
+    __thread void* current_worker = NULL;
+}
+
+ThreadPool::Worker::Worker(ThreadPool* pool)
+ :  pool(pool),
+    deque(),
+    active(false),
+    seed(0),
+    local_streak(0)
+{
+}
+
+ThreadPool::ThreadPool(size_t workers, size_t max_queue, Mode mode)
+ :  mode_(mode),
+    running_(false),
     workers_(workers),
     max_queue_(max_queue),
     lock_(),
-    cond_(),
+    space_cond_(),
+    blocked_(0),
+    in_flight_(),
     service_(),
     work_(),
     threads_(),
-    next_job_id_(0),
-    jobs_(new Jobs())
+    placement_(),
+    jobs_(max_queue),
+    next_seq_(0),
+    lanes_(PRIORITY_COUNT),
+    slot_count_(0),
+    idle_lock_(),
+    idle_cond_(),
+    sleepers_(0),
+    retiring_(0),
+    stopping_(false),
+    timing_(false),
+    metrics_(),
+    stats_base_(),
+    stats_since_(Clock::now())
 {
+    if (mode_ == WORK_STEALING && workers > MAX_STEALING_WORKERS)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("workers") );
+    for (size_t i=0; i<MAX_STEALING_WORKERS; i++) {
+        slots_[i].store(NULL, boost::memory_order_relaxed);
+    }
+    for (size_t i=0; i<PRIORITY_COUNT; i++) {
+        lane_limits_[i] = 0;
+        lane_jobs_[i].store(0, boost::memory_order_relaxed);
+    }
 }
 
 ThreadPool::~ThreadPool()
 {
     stop();
     cancel_all();
+    clear_queues();
+    
+    size_t slots = slot_count_.load();
+    for (size_t i=0; i<slots; i++) {
+        delete slots_[i].load();
+    }
 }
 
 void ThreadPool::add_workers(size_t n)
 {
     boost::unique_lock<Lock> locker(lock_);
+    if (mode_ == WORK_STEALING && workers_ + n > MAX_STEALING_WORKERS)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("n") );
     workers_ += n;
     if (!running_)
         return;
     
     for (size_t i=0; i<n; i++) {
-        threads_->create_thread(boost::bind(&ThreadPool::run_thread, this));
+        spawn_worker();
     }
 }
 
@@ -73,9 +121,14 @@ void ThreadPool::reduce_workers(size_t n)
     if (!running_)
         return;
     
-    const ThreadGroup* current_thread_group = threads_.get();
+    // Any n workers exit after their current job, without exceptions.
+    retiring_.fetch_add(n);
+    if (mode_ == WORK_STEALING) {
+        wake_workers(true);
+        return;
+    }
     for (size_t i=0; i<n; i++) {
-        service_->post(boost::bind(&ThreadPool::reduce_worker_handler, this, current_thread_group));
+        service_->post(boost::bind(&ThreadPool::reduce_worker_handler, this));
     }
 }
 
@@ -85,6 +138,118 @@ size_t ThreadPool::worker_count()
     return workers_;
 }
 
+size_t ThreadPool::concurrency()
+{
+    return worker_count();
+}
+
+ThreadPool::Mode ThreadPool::mode() const
+{
+    return mode_;
+}
+
+void ThreadPool::set_placement(const Placement& placement)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    placement_ = placement;
+    if (threads_)
+        threads_->set_placement(placement);
+}
+
+void ThreadPool::set_max_queue(Priority priority, size_t max_queue)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    lane_limits_[priority] = max_queue;
+    if (blocked_)
+        space_cond_.notify_all();
+}
+
+size_t ThreadPool::max_queue(Priority priority)
+{
+    boost::unique_lock<Lock> locker(lock_);
+    return lane_limits_[priority];
+}
+
+size_t ThreadPool::job_count(Priority priority)
+{
+    return lane_jobs_[priority].load();
+}
+
+void ThreadPool::set_timing(bool enabled)
+{
+    timing_.store(enabled);
+}
+
+ThreadPool::LoadStats ThreadPool::take_load_stats()
+{
+    MetricsSnapshot snapshot;
+    metrics_.collect(snapshot);
+    const WorkerSnapshot& total = snapshot.total;
+    
+    LoadStats ret;
+    boost::unique_lock<Lock> locker(lock_);
+    ret.workers = workers_;
+    ret.jobs = jobs_.size();
+    ret.executed = total.executed() - stats_base_.executed();
+    ret.wait_time = total.wait - stats_base_.wait;
+    ret.busy_time = total.busy - stats_base_.busy;
+    ret.elapsed = snapshot.taken_at - stats_since_;
+    stats_base_ = total;
+    stats_since_ = snapshot.taken_at;
+    return ret;
+}
+
+MetricsSnapshot ThreadPool::metrics()
+{
+    MetricsSnapshot ret;
+    metrics_.collect(ret);
+    
+    boost::unique_lock<Lock> locker(lock_);
+    ret.jobs = jobs_.size();
+    ret.queued = lanes_.size();
+    size_t slots = slot_count_.load();
+    for (size_t i=0; i<slots; i++) {
+        ret.queued += slots_[i].load()->deque.size();
+    }
+    return ret;
+}
+
+void ThreadPool::set_aging(size_t aging)
+{
+    lanes_.set_aging(aging);
+}
+
+void ThreadPool::spawn_worker()
+{
+    // Retired threads are only dropped here, so that resizing often 
+    // does not pile them up.
+    threads_->remove_finished();
+    
+    if (mode_ != WORK_STEALING) {
+        threads_->create_thread(boost::bind(&ThreadPool::run_thread, this));
+        return;
+    }
+    
+    // Reuse a retired slot if possible, otherwise take a new one.
+    // Slots are only taken under lock_, so there is no race here.
+    Worker* worker = NULL;
+    size_t slots = slot_count_.load();
+    for (size_t i=0; i<slots && !worker; i++) {
+        Worker* w = slots_[i].load();
+        bool expected = false;
+        if (w->active.compare_exchange_strong(expected, true))
+            worker = w;
+    }
+    if (!worker) {
+        worker = new Worker(this);
+        worker->active.store(true);
+        worker->seed = (unsigned int)slots * 2654435761u + 1;
+        slots_[slots].store(worker);
+        slot_count_.store(slots + 1);
+    }
+    threads_->create_thread(boost::bind(&ThreadPool::run_stealing_thread, this, worker));
+}
+
 void ThreadPool::run_thread()
 {
     // We do not really remove the thread from ThreadGroup.
@@ -93,45 +258,347 @@ void ThreadPool::run_thread()
     //     if (threads_) threads_->remove_thread(thread);
     // } BOOST_SCOPE_EXIT_END
     
-    // Enter thread.
-    try {
-        // Run the io_service loop.
-        service_->run();
+    metrics_.attach();
+    BOOST_SCOPE_EXIT( (this_) ) {
+        this_->metrics_.detach();
+    } BOOST_SCOPE_EXIT_END
+    
+    // Run the io_service loop, one handler at a time, so that a retire 
+    // ticket is taken between two jobs.
+    while (!take_retire()) {
+        if (!service_->run_one())
+            return;
+    }
+}
+
+void ThreadPool::run_stealing_thread(Worker* worker)
+{
+    current_worker = worker;
+    metrics_.attach();
+    BOOST_SCOPE_EXIT( (this_)(&worker) ) {
+        this_->metrics_.detach();
+        current_worker = NULL;
+        worker->active.store(false);
+    } BOOST_SCOPE_EXIT_END
+    
+    while (!stopping_.load(boost::memory_order_acquire)) {
+        AsyncResult* job = find_job(worker);
+        if (job) {
+            run_job(job);
+            continue;
+        }
         
-    } catch (InterruptWorker) {
-        // A managed style to reduce worker.
+        // Only retire with an empty deque, so that no job is left behind.
+        if (take_retire())
+            return;
+        
+        // Sleep until new jobs arrive. stop() wakes us up, so there 
+        // is no need to be interrupted here.
+        boost::this_thread::disable_interruption no_interrupt;
+        boost::unique_lock<Lock> locker(idle_lock_);
+        sleepers_.fetch_add(1);
+        if (!stopping_.load() && retiring_.load() == 0 && !has_job())
+            idle_cond_.wait(locker);
+        sleepers_.fetch_sub(1);
+    }
+}
+
+AsyncResult* ThreadPool::find_job(Worker* worker)
+{
+    AsyncResult* job = NULL;
+    
+    // First, interactive jobs, which should not wait for the local deque.
+    if (lanes_.size(INTERACTIVE) && pop_lanes(job))
+        return job;
+    
+    // Every few local jobs, the other lanes go first.
+    if (worker->local_streak >= LANE_POLL_INTERVAL) {
+        worker->local_streak = 0;
+        if (pop_lanes(job))
+            return job;
+    }
+    
+    // Second, the local deque.
+    if (worker->deque.pop(job)) {
+        worker->local_streak++;
+        return job;
+    }
+    worker->local_streak = 0;
+    
+    // Third, the other lanes.
+    if (pop_lanes(job))
+        return job;
+    
+    // Last, steal from a random victim.
+    size_t slots = slot_count_.load(boost::memory_order_acquire);
+    if (slots <= 1)
+        return NULL;
+    worker->seed ^= worker->seed << 13;
+    worker->seed ^= worker->seed >> 17;
+    worker->seed ^= worker->seed << 5;
+    size_t start = worker->seed % slots;
+    for (size_t i=0; i<slots; i++) {
+        Worker* victim = slots_[(start + i) % slots].load(boost::memory_order_acquire);
+        if (victim != worker && victim->deque.steal(job))
+            return job;
+    }
+    return NULL;
+}
+
+bool ThreadPool::pop_lanes(AsyncResult*& job)
+{
+    if (!lanes_.pop(job))
+        return false;
+    
+    // Pass the wakeup on, so that a burst is not served by one worker.
+    if (!lanes_.empty() && sleepers_.load())
+        wake_workers(false);
+    return true;
+}
+
+bool ThreadPool::has_job()
+{
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (!lanes_.empty())
+        return true;
+    size_t slots = slot_count_.load();
+    for (size_t i=0; i<slots; i++) {
+        if (!slots_[i].load()->deque.empty())
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::run_job(AsyncResult* job)
+{
+    // adopt the reference taken by schedule().
+    AsyncResultPtr holder(job, false);
+    Tracer::on_event(Tracer::DEQUEUE, *job);
+    WorkerMetrics* metrics = ExecutorMetrics::current();
+    if (!metrics) {
+        job->execute();
+        return;
+    }
+    
+    metrics->begin();
+    if (!timing_.load(boost::memory_order_relaxed)) {
+        job->execute();
+    } else {
+        Clock::time_point start = Clock::now();
+        if (job->queued_at() != Clock::time_point())
+            metrics->record_wait(start - job->queued_at());
+        metrics->start_run(start);
+        job->execute();
+        metrics->record_run(Clock::now() - start);
+    }
+    metrics->end(*job);
+}
+
+bool ThreadPool::take_retire()
+{
+    size_t n = retiring_.load();
+    while (n) {
+        if (retiring_.compare_exchange_weak(n, n - 1))
+            return true;
+    }
+    return false;
+}
+
+bool ThreadPool::has_room(size_t n, Priority priority) const
+{
+    if (max_queue_ && jobs_.size() + n > max_queue_)
+        return false;
+    if (lane_limits_[priority] && lane_jobs_[priority] + n > lane_limits_[priority])
+        return false;
+    return true;
+}
+
+void ThreadPool::check_limit(size_t n, Priority priority)
+{
+    if (!has_room(n, priority))
+        AVALON_THROW(AvalonThreadPoolIsFull);
+}
+
+bool ThreadPool::submitted_before(const JobEntry& a, const JobEntry& b)
+{
+    return a.seq < b.seq;
+}
+
+void ThreadPool::enqueue(const AsyncResultPtr& ar, Priority priority)
+{
+    in_flight_.add();
+    
+    // Add to internal work list.
+    JobEntry entry = { ar, priority, next_seq_++ };
+    ar->set_slot_key(jobs_.insert(entry));
+    lane_jobs_[priority].fetch_add(1);
+    
+    // Submit to the queue
+    if (running_)
+        schedule(ar, priority);
+}
+
+void ThreadPool::schedule(const AsyncResultPtr& ar, Priority priority)
+{
+    // The queues hold raw pointers with a reference taken.
+    AsyncResult* job = ar.get();
+    intrusive_ptr_add_ref(job);
+    if (timing_.load(boost::memory_order_relaxed))
+        job->set_queued_at(Clock::now());
+    Tracer::on_submit(*job);
+    
+    if (mode_ != WORK_STEALING) {
+        lanes_.push(job, priority);
+        service_->post(boost::bind(&ThreadPool::dispatch_handler, this));
+        return;
     }
+    
+    Worker* worker = (Worker*)current_worker;
+    if (priority == NORMAL && worker && worker->pool == this)
+        worker->deque.push(job);
+    else
+        lanes_.push(job, priority);
+    
+    // Pairs with the sleeper's increment and has_job() check.
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (sleepers_.load(boost::memory_order_relaxed))
+        wake_workers(false);
 }
 
-void ThreadPool::reduce_worker_handler(const ThreadGroup* thread_group)
+void ThreadPool::schedule(const std::vector<AsyncResultPtr>& jobs, Priority priority)
+{
+    Clock::time_point now;
+    if (timing_.load(boost::memory_order_relaxed))
+        now = Clock::now();
+    std::vector<AsyncResult*> raw;
+    raw.reserve(jobs.size());
+    BOOST_FOREACH(const AsyncResultPtr& ar, jobs) {
+        intrusive_ptr_add_ref(ar.get());
+        ar->set_queued_at(now);
+        Tracer::on_submit(*ar);
+        raw.push_back(ar.get());
+    }
+    
+    if (mode_ != WORK_STEALING) {
+        lanes_.push(raw.begin(), raw.end(), priority);
+        // One handler per needed worker, instead of one per job.
+        size_t handlers = std::min(jobs.size(), std::max(workers_, (size_t)1));
+        for (size_t i=0; i<handlers; i++) {
+            service_->post(boost::bind(&ThreadPool::drain_handler, this));
+        }
+        return;
+    }
+    
+    Worker* worker = (Worker*)current_worker;
+    if (priority == NORMAL && worker && worker->pool == this) {
+        BOOST_FOREACH(AsyncResult* job, raw) {
+            worker->deque.push(job);
+        }
+    } else {
+        lanes_.push(raw.begin(), raw.end(), priority);
+    }
+    
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    wake_workers(jobs.size());
+}
+
+void ThreadPool::wake_workers(size_t n)
+{
+    size_t sleepers = sleepers_.load(boost::memory_order_relaxed);
+    if (!sleepers || !n)
+        return;
+    
+    boost::unique_lock<Lock> locker(idle_lock_);
+    if (n >= sleepers) {
+        idle_cond_.notify_all();
+    } else {
+        for (size_t i=0; i<n; i++) {
+            idle_cond_.notify_one();
+        }
+    }
+}
+
+void ThreadPool::dispatch_handler()
+{
+    AsyncResult* job = NULL;
+    if (lanes_.pop(job))
+        run_job(job);
+}
+
+void ThreadPool::drain_handler()
+{
+    AsyncResult* job = NULL;
+    while (!service_->stopped()) {
+        if (retiring_.load()) {
+            // The worker takes its ticket after we return, so hand the 
+            // remaining jobs to another worker.
+            if (lanes_.size())
+                service_->post(boost::bind(&ThreadPool::drain_handler, this));
+            return;
+        }
+        if (!lanes_.pop(job))
+            return;
+        run_job(job);
+    }
+}
+
+void ThreadPool::wake_workers(bool all)
+{
+    boost::unique_lock<Lock> locker(idle_lock_);
+    if (all)
+        idle_cond_.notify_all();
+    else
+        idle_cond_.notify_one();
+}
+
+void ThreadPool::clear_queues()
+{
+    AsyncResult* job = NULL;
+    size_t slots = slot_count_.load();
+    for (size_t i=0; i<slots; i++) {
+        Worker* worker = slots_[i].load();
+        while (worker->deque.steal(job)) {
+            intrusive_ptr_release(job);
+        }
+    }
+    while (lanes_.pop(job)) {
+        intrusive_ptr_release(job);
+    }
+}
+
+void ThreadPool::reduce_worker_handler()
 {
-    if (threads_.get() == thread_group)
-        throw InterruptWorker();
 }
 
 void ThreadPool::run()
 {
     boost::unique_lock<Lock> locker(lock_);
     if (running_) return;
-    
-    // check jobs
-    if (!jobs_) jobs_.reset(new Jobs);
+    running_ = true;
     
     // init thread group
     threads_.reset(new ThreadGroup());
+    threads_->set_placement(placement_);
     
     // init main loop
-    service_.reset(new boost::asio::io_service());
-    work_.reset(new boost::asio::io_service::work(*service_));
+    retiring_.store(0);
+    if (mode_ == WORK_STEALING) {
+        stopping_.store(false);
+    } else {
+        service_.reset(new boost::asio::io_service());
+        work_.reset(new boost::asio::io_service::work(*service_));
+    }
     
     for (size_t i=0; i<workers_; i++) {
-        threads_->create_thread(boost::bind(&ThreadPool::run_thread, this));
+        spawn_worker();
     }
     
-    // put unfinished jobs in loop.
-    for (Jobs::iterator it=jobs_->begin(); it!=jobs_->end(); it++) {
-        if (it->second)
-            service_->post(boost::bind(&AsyncResult::execute, it->second));
+    // put unfinished jobs in loop, in submission order.
+    std::vector<JobEntry> entries;
+    jobs_.collect(entries);
+    std::sort(entries.begin(), entries.end(), submitted_before);
+    BOOST_FOREACH(const JobEntry& entry, entries) {
+        schedule(entry.job, entry.priority);
     }
 }
 
@@ -141,10 +608,16 @@ void ThreadPool::stop(size_t timeout)
     {
         boost::unique_lock<Lock> locker(lock_);
         if (!running_) return;
+        running_ = false;
         
         // stop the main loop
-        service_->stop();
-        work_.reset();
+        if (mode_ == WORK_STEALING) {
+            stopping_.store(true);
+            wake_workers(true);
+        } else {
+            service_->stop();
+            work_.reset();
+        }
         
         // swap the pointer
         // if we do not do this, mutex may be blocked in join_all.
@@ -154,62 +627,181 @@ void ThreadPool::stop(size_t timeout)
     
     // kill threads
     threads->join_and_interrupt_all(timeout);
+    threads->join_all();
+    
+    // queued jobs are posted again by run(), from the job list.
+    clear_queues();
 }
 
 void ThreadPool::cancel_all()
 {
-    boost::shared_ptr<Jobs> jobs;
-    {
-        boost::unique_lock<Lock> locker(lock_);
-        jobs = jobs_;
-        jobs_.reset();
+    // The finish handlers of cleared jobs find their keys stale.
+    std::vector<JobEntry> entries;
+    jobs_.clear(entries);
+    BOOST_FOREACH(const JobEntry& entry, entries) {
+        lane_jobs_[entry.priority].fetch_sub(1);
     }
+    notify_space();
     
-    for (Jobs::iterator it=jobs->begin(); it != jobs->end(); it++) {
-        if (it->second) it->second->cancel();
+    BOOST_FOREACH(const JobEntry& entry, entries) {
+        entry.job->cancel();
     }
 }
 
-void ThreadPool::task_finish_handler(AsyncResult& ar, unsigned int job_id)
+void ThreadPool::notify_space()
 {
-    boost::unique_lock<Lock> locker(lock_);
-    if (!jobs_) return;
-    Jobs::iterator it = jobs_->find(job_id);
-    if (it != jobs_->end())
-        jobs_->erase(it);
+    // Pairs with submit_wait(), which counts itself before checking the room.
+    if (blocked_.load()) {
+        boost::unique_lock<Lock> locker(lock_);
+        space_cond_.notify_all();
+    }
 }
 
-bool ThreadPool::wait(size_t timeout)
+void ThreadPool::task_finish_handler(AsyncResult& ar)
 {
-    boost::unique_lock<Lock> locker(lock_);
-    if (timeout)
-        return cond_.timed_wait(locker, boost::posix_time::milliseconds(timeout));
-    else {
-        cond_.wait(locker);
-        return true;
+    JobEntry entry;
+    if (jobs_.erase(ar.slot_key(), entry)) {
+        lane_jobs_[entry.priority].fetch_sub(1);
+        notify_space();
     }
+    
+    // After the job list, so the waiters see it updated.
+    in_flight_.done();
+}
+
+bool ThreadPool::wait(size_t timeout)
+{
+    return wait_idle(timeout);
+}
+
+bool ThreadPool::wait_idle(size_t timeout)
+{
+    return in_flight_.wait_idle(timeout);
+}
+
+size_t ThreadPool::in_flight() const
+{
+    return in_flight_.count();
 }
 
 AsyncResultPtr ThreadPool::submit(const avalon::thread::AsyncResult::Task& job, 
-                                  const avalon::thread::AsyncResult::Callback& callback)
+                                  const avalon::thread::AsyncResult::Callback& callback,
+                                  Priority priority)
 {
-    boost::unique_lock<Lock> locker(lock_);
-    
-    // check limit
-    if (!jobs_ || jobs_->size() >= max_queue_)
-        AVALON_THROW(AvalonThreadPoolIsFull);
-    
     // Create AsyncResult
-    unsigned int job_id = next_job_id_++;
     AsyncResultPtr p(new AsyncResult(job));
     p->add_all(callback);
-    p->add_all(boost::bind(&ThreadPool::task_finish_handler, this, _1, job_id));
+    return submit(p, priority);
+}
+
+AsyncResultPtr ThreadPool::submit(const avalon::thread::AsyncResult::Task& job, 
+                                  const avalon::thread::AsyncResult::Callback& callback,
+                                  const Clock::time_point& deadline, Priority priority)
+{
+    AsyncResultPtr p(new AsyncResult(job));
+    p->set_deadline(deadline);
+    p->add_all(callback);
+    return submit(p, priority);
+}
+
+AsyncResultPtr ThreadPool::submit(const avalon::thread::AsyncResultPtr& p)
+{
+    return submit(p, NORMAL);
+}
+
+AsyncResultPtr ThreadPool::submit(const avalon::thread::AsyncResultPtr& p, Priority priority)
+{
+    {
+        boost::unique_lock<Lock> locker(lock_);
+        
+        // check limit
+        check_limit(1, priority);
+        enqueue(p, priority);
+    }
     
-    // Add to internal work list.
-    jobs_->insert(std::make_pair(job_id, p));
+    // Out of lock_, for a finished job calls the handler immediately.
+    p->add_all(boost::bind(&ThreadPool::task_finish_handler, this, _1));
+    return p;
+}
+
+Executor::SubmitStatus ThreadPool::try_submit(const avalon::thread::AsyncResultPtr& p)
+{
+    return try_submit(p, NORMAL);
+}
+
+Executor::SubmitStatus ThreadPool::try_submit(const avalon::thread::AsyncResultPtr& p, 
+                                              Priority priority)
+{
+    {
+        boost::unique_lock<Lock> locker(lock_);
+        if (!has_room(1, priority))
+            return SUBMIT_FULL;
+        enqueue(p, priority);
+    }
+    
+    p->add_all(boost::bind(&ThreadPool::task_finish_handler, this, _1));
+    return SUBMIT_OK;
+}
+
+Executor::SubmitStatus ThreadPool::submit_wait(const avalon::thread::AsyncResultPtr& p, 
+                                               size_t timeout, Priority priority)
+{
+    {
+        boost::unique_lock<Lock> locker(lock_);
+        if (!has_room(1, priority)) {
+            Clock::time_point until = deadline_after(timeout);
+            bool expired = false;
+            blocked_++;
+            while (!has_room(1, priority) && !expired) {
+                if (!timeout)
+                    space_cond_.wait(locker);
+                else
+                    expired = space_cond_.wait_until(locker, until) == boost::cv_status::timeout;
+            }
+            blocked_--;
+            if (!has_room(1, priority))
+                return SUBMIT_TIMEOUT;
+        }
+        enqueue(p, priority);
+    }
     
-    // Submit to io_service
-    if (running_) service_->post(boost::bind(&AsyncResult::execute, p));
+    p->add_all(boost::bind(&ThreadPool::task_finish_handler, this, _1));
+    return SUBMIT_OK;
+}
+
+JoinResult::Ptr ThreadPool::submit_bulk(const std::vector<AsyncResultPtr>& jobs)
+{
+    return submit_bulk(jobs, NORMAL);
+}
+
+JoinResult::Ptr ThreadPool::submit_bulk(const std::vector<AsyncResultPtr>& jobs,
+                                        Priority priority)
+{
+    JoinResult::Ptr group;
+    {
+        boost::unique_lock<Lock> locker(lock_);
+        
+        // check limit
+        check_limit(jobs.size(), priority);
+        group = JoinResult::create(jobs, JoinResult::JOIN_ALL);
+        
+        // Add to internal work list.
+        in_flight_.add(jobs.size());
+        BOOST_FOREACH(const AsyncResultPtr& p, jobs) {
+            JobEntry entry = { p, priority, next_seq_++ };
+            p->set_slot_key(jobs_.insert(entry));
+        }
+        lane_jobs_[priority].fetch_add(jobs.size());
+        
+        // Submit to the queue
+        if (running_ && !jobs.empty())
+            schedule(jobs, priority);
+    }
+    
+    BOOST_FOREACH(const AsyncResultPtr& p, jobs) {
+        p->add_all(boost::bind(&ThreadPool::task_finish_handler, this, _1));
+    }
+    return group;
 }
 
 END_AVALON_NS2
@@ -23,15 +23,27 @@
 
 #include "../define.h"
 
+#include <iterator>
+#include <vector>
+#include <deque>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/asio/io_service.hpp>
-#include <boost/unordered_map.hpp>
 
 #include "asyncresult.h"
+#include "clock.h"
+#include "combinators.h"
+#include "executor.h"
+#include "metrics.h"
+#include "prioritylanes.h"
+#include "slotmap.h"
+#include "taskgroup.h"
 #include "threadgroup.h"
+#include "workstealingqueue.h"
 
 BEGIN_AVALON_NS2(thread)
 
@@ -39,16 +51,88 @@ BEGIN_AVALON_NS2(thread)
 /**
  * This class uses boost::asio::io_service to manage threads, 
  * so that it can provide a multi-threaded queued work executor.
+ * 
+ * In WORK_STEALING mode, the io_service is replaced by a deque per 
+ * worker. Jobs submitted from a worker thread are pushed to its own 
+ * deque, other jobs are pushed to a shared injection queue, and idle 
+ * workers steal from a random victim. So the workers do not contend 
+ * on a single queue.
+ * 
+ * Jobs are submitted with a Priority. Queued jobs wait in one lane per 
+ * priority, and workers take from the highest lane first. A lane passed 
+ * over too many times is served anyway (see set_aging()), so background 
+ * jobs still progress under load. Each lane can have its own queue 
+ * limit. In WORK_STEALING mode, NORMAL jobs submitted from a worker 
+ * thread still go to its own deque.
  */
-class ThreadPool
+class ThreadPool : public Executor
 {
 public:
+    /// The scheduling mode.
+    enum Mode
+    {
+        /// All workers share one io_service queue.
+        SHARED_QUEUE = 0,
+        
+        /// Each worker owns a work-stealing deque.
+        WORK_STEALING = 1
+    };
+    
+    /// The job priority.
+    enum Priority
+    {
+        /// Latency critical jobs.
+        INTERACTIVE = 0,
+        
+        /// Ordinary jobs.
+        NORMAL = 1,
+        
+        /// Throughput jobs, which can be delayed.
+        BACKGROUND = 2,
+        
+        /// The priority count.
+        PRIORITY_COUNT = 3
+    };
+    
+    /// The load counters, accumulated between two take_load_stats().
+    struct LoadStats
+    {
+        /// The worker count.
+        size_t workers;
+        
+        /// The unfinished job count, including running ones.
+        size_t jobs;
+        
+        /// The jobs executed.
+        boost::uint64_t executed;
+        
+        /// The total time executed jobs spent queued.
+        Clock::duration wait_time;
+        
+        /// The total time spent executing jobs.
+        Clock::duration busy_time;
+        
+        /// The time since the last take_load_stats().
+        Clock::duration elapsed;
+    };
+    
+    /// The maximum worker count in WORK_STEALING mode.
+    static const size_t MAX_STEALING_WORKERS = 256;
+    
+    /// The local jobs a worker runs in a row before it polls the lanes.
+    /**
+     * So that recursive or fan-out work in the local deques does not 
+     * starve the jobs submitted from outside.
+     */
+    static const size_t LANE_POLL_INTERVAL = 16;
+    
     /// create a new threadpool.
     /**
      * @param workers The initial thread count.
      * @param max_queue The maximum queue size for tasks. Zero means no limit.
+     * @param mode The scheduling mode.
      */
-    ThreadPool(size_t workers, size_t max_queue);
+    ThreadPool(size_t workers, size_t max_queue, Mode mode = SHARED_QUEUE);
     
     /// destroy the threadpool
     virtual ~ThreadPool();
@@ -62,6 +146,59 @@ public:
     /// Get worker count.
     size_t worker_count();
     
+    /// Same as worker_count().
+    virtual size_t concurrency();
+    
+    /// Get the scheduling mode.
+    Mode mode() const;
+    
+    /// Set the CPU placement of the workers.
+    /**
+     * Applies to workers spawned later, including all of them on the 
+     * next run().
+     */
+    void set_placement(const Placement& placement);
+    
+    /// Set the queue limit of a priority lane.
+    /**
+     * Applies in addition to the max_queue of the whole pool.
+     * 
+     * @param priority The lane.
+     * @param max_queue The maximum unfinished jobs. Zero means no limit.
+     */
+    void set_max_queue(Priority priority, size_t max_queue);
+    
+    /// Get the queue limit of a priority lane.
+    size_t max_queue(Priority priority);
+    
+    /// Get the unfinished job count of a priority lane.
+    size_t job_count(Priority priority);
+    
+    /// Enable or disable job timing.
+    /**
+     * When enabled, each job costs three clock reads, for the wait and 
+     * run latencies and the busy time, so it is off by default. Job 
+     * counts are always kept.
+     */
+    void set_timing(bool enabled);
+    
+    /// Take the load counters, and reset them.
+    LoadStats take_load_stats();
+    
+    /// Take a snapshot of the metrics.
+    /**
+     * The per-worker counters are summed here, so workers never share 
+     * a cache line to record them. Latencies and utilisation are only 
+     * recorded while timing is enabled.
+     */
+    MetricsSnapshot metrics();
+    
+    /// Set how many times a lane can be passed over before it is served.
+    /**
+     * Zero means strict priority, which may starve lower lanes.
+     */
+    void set_aging(size_t aging);
+    
     /// Run the threadpool.
     /**
      * Start the threadpool task loop. This method blocks the caller's 
@@ -75,12 +212,30 @@ public:
     /// Wait for all jobs to be finished.
     /**
      * If more jobs are added, then it will wait until all the jobs are done.
+     * Same as wait_idle().
      * 
      * @param timeout The maximum waiting milliseconds. Zero means no limit.
      * @return false if time exceeds, otherwise true (including no waiting).
      */
     bool wait(size_t timeout = 0);
     
+    /// Wait until no submitted job is left unfinished.
+    /**
+     * The pool counts the jobs in flight, from submission to the end of 
+     * their callbacks, without taking lock_. Waiters are only notified 
+     * when the count drops to zero. Jobs of a stopped pool stay in flight, 
+     * until the pool runs again or they are cancelled.
+     * 
+     * To fence a batch among other jobs, use a TaskGroup instead.
+     * 
+     * @param timeout The maximum waiting milliseconds. Zero means no limit.
+     * @return false if time exceeds, otherwise true (including no waiting).
+     */
+    bool wait_idle(size_t timeout = 0);
+    
+    /// The number of submitted jobs not yet finished.
+    size_t in_flight() const;
+    
     /// Run the threadpool.
     /**
      * Stop the threadpool task loop. Existing tasks will remain in queue, 
@@ -106,13 +261,112 @@ public:
      * 
      * @param job Job function object.
      * @param callback The callback function object after the job finished.
+     * @param priority The job priority.
      * @return AsyncResult instance. Job can be marked cancelled via AsyncResult.
+     * @throw AvalonThreadPoolIsFull If the pool or the lane is full.
+     */
+    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback,
+                          Priority priority = NORMAL);
+    
+    /// Add a job which is dropped if not started before the deadline.
+    /**
+     * An expired job becomes EXPIRED when a worker takes it from the 
+     * queue, without being executed, and the callback is called with 
+     * that status. So an overloaded pool spends no time on stale jobs.
+     * 
+     * @param job Job function object.
+     * @param callback The callback function object after the job finished.
+     * @param deadline The latest time to start the job.
+     * @param priority The job priority.
+     * @return AsyncResult instance.
+     */
+    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback,
+                          const Clock::time_point& deadline, Priority priority = NORMAL);
+    
+    /// Add a prepared AsyncResult to the job queue.
+    /**
+     * This is used to submit AsyncResult subclasses, e.g. Future<T>. 
+     * Callbacks should be added before submitting.
+     * 
+     * @param ar The job to execute.
+     * @return ar.
+     */
+    virtual AsyncResultPtr submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult to the job queue with a priority.
+    AsyncResultPtr submit(const AsyncResultPtr& ar, Priority priority);
+    
+    /// Add a prepared AsyncResult to the job queue, unless it is full.
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult with a priority, unless the pool or the lane is full.
+    /**
+     * @return SUBMIT_OK or SUBMIT_FULL.
+     */
+    SubmitStatus try_submit(const AsyncResultPtr& ar, Priority priority);
+    
+    /// Add a prepared AsyncResult, waiting for a free slot if the pool or the lane is full.
+    /**
+     * The producer sleeps until a job of the pool finishes, or a limit is 
+     * raised, so that it slows down to the speed of the workers instead 
+     * of retrying.
+     * 
+     * @param ar The job to execute.
+     * @param timeout The maximum waiting milliseconds. Zero means no limit.
+     * @param priority The job priority.
+     * @return SUBMIT_OK or SUBMIT_TIMEOUT.
      */
-    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback);
+    SubmitStatus submit_wait(const AsyncResultPtr& ar, size_t timeout = 0, 
+                             Priority priority = NORMAL);
+    
+    /// Add a batch of jobs to the job queue.
+    /**
+     * The jobs are registered under one lock acquisition, and only as 
+     * many workers as needed are woken up.
+     * 
+     * @param begin The first job function object.
+     * @param end The end of job function objects.
+     * @param callback The callback function object for each job.
+     * @param priority The priority of all jobs.
+     * @return The group handle, to wait on or cancel the whole batch.
+     * @throw AvalonThreadPoolIsFull If the batch does not fit in the queue 
+     *      or the lane. No job is submitted then.
+     */
+    template <typename Iterator>
+    JoinResult::Ptr submit_bulk(Iterator begin, Iterator end, const AsyncResult::Callback& callback,
+                                Priority priority = NORMAL);
+    
+    /// Add a batch of prepared AsyncResults to the job queue.
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// Add a batch of prepared AsyncResults to the job queue with a priority.
+    JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs, Priority priority);
     
 protected:
-    /// Notify a thread to give up executing io_service loop.
-    class InterruptWorker {};
+    /// The worker state in WORK_STEALING mode.
+    struct Worker
+    {
+        /// Create a worker owned by pool.
+        explicit Worker(ThreadPool* pool);
+        
+        /// The owner pool.
+        ThreadPool* pool;
+        
+        /// The local deque.
+        WorkStealingQueue<AsyncResult*> deque;
+        
+        /// Whether a thread is running on this worker.
+        boost::atomic<bool> active;
+        
+        /// The random seed to choose victims.
+        unsigned int seed;
+        
+        /// The local jobs run since the lanes were last polled.
+        size_t local_streak;
+    };
+    
+    /// The scheduling mode.
+    const Mode mode_;
     
     /// Indicating the threads are running.
     bool running_;
@@ -129,8 +383,14 @@ protected:
     /// The mutex.
     Lock lock_;
     
-    /// The condition variable to notify all jobs done.
-    boost::condition_variable cond_;
+    /// The condition variable to notify producers blocked in submit_wait().
+    boost::condition_variable space_cond_;
+    
+    /// The producer count blocked in submit_wait(). Changed with lock_ held.
+    boost::atomic<size_t> blocked_;
+    
+    /// The submitted jobs not yet finished.
+    InFlightCounter in_flight_;
     
     /// The io_service.
     boost::shared_ptr<boost::asio::io_service> service_;
@@ -141,28 +401,177 @@ protected:
     /// The thread_group.
     boost::shared_ptr<ThreadGroup> threads_;
     
-    /// The next available job id.
-    unsigned int next_job_id_;
+    /// The worker placement.
+    Placement placement_;
+    
+    /// The task set entry.
+    struct JobEntry
+    {
+        /// The job.
+        AsyncResultPtr job;
+        
+        /// The lane of the job.
+        Priority priority;
+        
+        /// The submission order.
+        boost::uint64_t seq;
+    };
     
     /// The task set type.
-    typedef boost::unordered_map<unsigned int, AsyncResultPtr> Jobs;
+    /**
+     * Each job carries its key in AsyncResult::slot_key(), so the finish 
+     * handler removes it without taking lock_.
+     */
+    typedef SlotMap<JobEntry> Jobs;
     
     /// The task set.
-    boost::shared_ptr<Jobs> jobs_;
+    Jobs jobs_;
+    
+    /// The submission order of the next job. Guarded by lock_.
+    boost::uint64_t next_seq_;
+    
+    /// Compare jobs by submission order.
+    static bool submitted_before(const JobEntry& a, const JobEntry& b);
+    
+    /// The queue limit of each lane.
+    size_t lane_limits_[PRIORITY_COUNT];
+    
+    /// The unfinished job count of each lane, counted in jobs_.
+    boost::atomic<size_t> lane_jobs_[PRIORITY_COUNT];
+    
+    /// The queued jobs, holding a reference each.
+    /**
+     * In SHARED_QUEUE mode, one dispatch handler is posted to the 
+     * io_service per job, which executes the best job at that time. 
+     * In WORK_STEALING mode, this is the injection queue.
+     */
+    PriorityLanes<AsyncResult*> lanes_;
+    
+    /// The worker slots in WORK_STEALING mode.
+    /**
+     * A fixed array, so that stealers can walk it without locking. 
+     * Retired worker slots are reused by later threads.
+     */
+    boost::atomic<Worker*> slots_[MAX_STEALING_WORKERS];
+    
+    /// The used worker slot count.
+    boost::atomic<size_t> slot_count_;
+    
+    /// The lock for idle workers.
+    Lock idle_lock_;
+    
+    /// The condition variable for idle workers.
+    boost::condition_variable idle_cond_;
+    
+    /// The sleeping worker count.
+    boost::atomic<size_t> sleepers_;
+    
+    /// The number of workers required to exit.
+    boost::atomic<size_t> retiring_;
+    
+    /// Whether the workers should exit.
+    boost::atomic<bool> stopping_;
+    
+    /// Whether job timing is enabled.
+    boost::atomic<bool> timing_;
+    
+    /// The per-worker metrics.
+    ExecutorMetrics metrics_;
+    
+    /// The worker totals at the last take_load_stats(). Guarded by lock_.
+    WorkerSnapshot stats_base_;
+    
+    /// The time of the last take_load_stats().
+    Clock::time_point stats_since_;
     
     /// Run the io_service loop in a thread.
     void run_thread();
     
-    /// The handler to reduce worker.
+    /// Start a worker thread. lock_ must be held.
+    void spawn_worker();
+    
+    /// Run the work-stealing loop in a thread.
+    void run_stealing_thread(Worker* worker);
+    
+    /// Find a job for the worker. Returns NULL if none.
+    AsyncResult* find_job(Worker* worker);
+    
+    /// Pop a job from the lanes in WORK_STEALING mode.
+    bool pop_lanes(AsyncResult*& job);
+    
+    /// Whether any queue seems to have jobs.
+    bool has_job();
+    
+    /// Try to take one retire ticket.
+    bool take_retire();
+    
+    /// Execute a queued job, adopting the reference taken by schedule().
+    void run_job(AsyncResult* job);
+    
+    /// Whether the limits allow n more jobs. lock_ must be held.
+    bool has_room(size_t n, Priority priority) const;
+    
+    /// Check the limits for n more jobs. lock_ must be held.
+    void check_limit(size_t n, Priority priority);
+    
+    /// Register and queue a job which fits in the limits. lock_ must be held.
+    void enqueue(const AsyncResultPtr& ar, Priority priority);
+    
+    /// Queue a job. lock_ must be held, and the pool running.
+    void schedule(const AsyncResultPtr& ar, Priority priority);
+    
+    /// Queue a batch of jobs. lock_ must be held, and the pool running.
+    void schedule(const std::vector<AsyncResultPtr>& jobs, Priority priority);
+    
+    /// Wake up sleeping workers.
+    void wake_workers(bool all);
+    
+    /// Wake up to n sleeping workers.
+    void wake_workers(size_t n);
+    
+    /// The handler to execute the best queued job.
+    void dispatch_handler();
+    
+    /// The handler to execute queued jobs, until none is left.
     /**
-     * @param thread_group Current active ThreadGroup instance. 
+     * Returns early once the loop is stopped or a worker should retire, 
+     * so that stop() leaves the rest in the queues, as with one handler 
+     * per job.
      */
-    void reduce_worker_handler(const ThreadGroup *thread_group);
+    void drain_handler();
+    
+    /// Drop all queued jobs. Workers must be stopped.
+    void clear_queues();
+    
+    /// The handler to wake up a worker in SHARED_QUEUE mode.
+    /**
+     * Does nothing, but the worker checks for retire tickets after each 
+     * handler, so an idle worker retires too.
+     */
+    void reduce_worker_handler();
+    
+    /// Wake up the producers blocked in submit_wait(), if any.
+    void notify_space();
     
     /// The handler for task finished.
-    void task_finish_handler(AsyncResult& ar, unsigned int job_id);
+    void task_finish_handler(AsyncResult& ar);
 };
 
+template <typename Iterator>
+JoinResult::Ptr ThreadPool::submit_bulk(Iterator begin, Iterator end, 
+                                        const AsyncResult::Callback& callback,
+                                        Priority priority)
+{
+    std::vector<AsyncResultPtr> jobs;
+    jobs.reserve(std::distance(begin, end));
+    for (; begin != end; ++begin) {
+        AsyncResultPtr ar(new AsyncResult(*begin));
+        ar->add_all(callback);
+        jobs.push_back(ar);
+    }
+    return submit_bulk(jobs, priority);
+}
+
 END_AVALON_NS2
 
 #endif // THREADPOOL_H
@@ -0,0 +1,319 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "timerservice.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+#include "../errors.h"
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The task of a periodic schedule handle, which is never executed.
+    void schedule_task(AsyncResult&)
+    {
+    }
+}
+
+TimerService::TimerService(Executor& executor, size_t tick)
+ :  executor_(executor),
+    tick_(boost::chrono::milliseconds(std::max(tick, (size_t)1))),
+    origin_(Clock::now()),
+    lock_(),
+    cond_(),
+    current_(0),
+    wake_(0),
+    count_(0),
+    stopping_(false),
+    thread_()
+{
+    for (size_t level=0; level<LEVELS; level++) {
+        for (size_t slot=0; slot<SLOTS; slot++) {
+            wheel_[level][slot].prev = wheel_[level][slot].next = &wheel_[level][slot];
+        }
+    }
+}
+
+TimerService::~TimerService()
+{
+    stop();
+    
+    std::vector<AsyncResultPtr> jobs;
+    jobs.reserve(count_);
+    for (size_t level=0; level<LEVELS; level++) {
+        for (size_t slot=0; slot<SLOTS; slot++) {
+            Link* head = &wheel_[level][slot];
+            for (Link* it = head->next; it != head; ) {
+                Entry* entry = static_cast<Entry*>(it);
+                it = it->next;
+                jobs.push_back(entry->job);
+                delete entry;
+            }
+        }
+    }
+    count_ = 0;
+    BOOST_FOREACH(const AsyncResultPtr& job, jobs) {
+        job->cancel();
+    }
+}
+
+void TimerService::start()
+{
+    Lock::scoped_lock locker(lock_);
+    if (thread_)
+        return;
+    stopping_ = false;
+    thread_.reset(new boost::thread(boost::bind(&TimerService::run_thread, this)));
+}
+
+void TimerService::stop()
+{
+    boost::shared_ptr<boost::thread> thread;
+    {
+        Lock::scoped_lock locker(lock_);
+        if (!thread_ || stopping_)
+            return;
+        stopping_ = true;
+        thread = thread_;
+        cond_.notify_all();
+    }
+    thread->join();
+    
+    Lock::scoped_lock locker(lock_);
+    thread_.reset();
+}
+
+AsyncResultPtr TimerService::submit_after(size_t delay, const AsyncResult::Task& job,
+                                          const AsyncResult::Callback& callback)
+{
+    return submit_at(Clock::now() + boost::chrono::milliseconds(delay), job, callback);
+}
+
+AsyncResultPtr TimerService::submit_at(const Clock::time_point& when, const AsyncResult::Task& job,
+                                       const AsyncResult::Callback& callback)
+{
+    AsyncResultPtr ar(new AsyncResult(job));
+    ar->add_all(callback);
+    
+    Entry* entry = new Entry();
+    entry->expires = tick_of(when);
+    entry->period = 0;
+    entry->job = ar;
+    
+    Lock::scoped_lock locker(lock_);
+    insert(entry);
+    return ar;
+}
+
+AsyncResultPtr TimerService::submit_every(size_t period, const AsyncResult::Task& job,
+                                          const AsyncResult::Callback& callback)
+{
+    AsyncResultPtr handle(new AsyncResult(schedule_task));
+    boost::chrono::milliseconds length(period);
+    
+    Entry* entry = new Entry();
+    entry->expires = tick_of(Clock::now() + length);
+    entry->period = std::max((length + tick_ - Clock::duration(1)) / tick_,
+                             (Clock::duration::rep)1);
+    entry->job = handle;
+    entry->task = job;
+    entry->callback = callback;
+    
+    Lock::scoped_lock locker(lock_);
+    insert(entry);
+    return handle;
+}
+
+size_t TimerService::pending()
+{
+    Lock::scoped_lock locker(lock_);
+    size_t ret = 0;
+    for (size_t level=0; level<LEVELS; level++) {
+        for (size_t slot=0; slot<SLOTS; slot++) {
+            Link* head = &wheel_[level][slot];
+            for (Link* it = head->next; it != head; it = it->next) {
+                if (static_cast<Entry*>(it)->job->status() == AsyncResult::WAIT)
+                    ret++;
+            }
+        }
+    }
+    return ret;
+}
+
+boost::uint64_t TimerService::tick_of(const Clock::time_point& when) const
+{
+    if (when <= origin_)
+        return 0;
+    return ((when - origin_) + tick_ - Clock::duration(1)) / tick_;
+}
+
+void TimerService::insert(Entry* entry)
+{
+    // An empty wheel is not advanced by the timer thread, so catch up 
+    // before placing relative to current_.
+    if (count_ == 0)
+        current_ = std::max(current_, (boost::uint64_t)((Clock::now() - origin_) / tick_));
+    if (entry->expires <= current_)
+        entry->expires = current_ + 1;
+    place(entry);
+    // The timer thread sleeps until wake_, so an earlier entry wakes it.
+    if (count_++ == 0 || entry->expires < wake_)
+        cond_.notify_all();
+}
+
+void TimerService::place(Entry* entry)
+{
+    boost::uint64_t delta = entry->expires - current_;
+    boost::uint64_t at = entry->expires;
+    size_t level = 0;
+    while (level < LEVELS - 1 && delta >= ((boost::uint64_t)1 << (SLOT_BITS * (level + 1))))
+        level++;
+    
+    // Beyond the top wheel, park in its farthest slot. The entry is 
+    // placed again when that slot is cascaded.
+    const boost::uint64_t span = (boost::uint64_t)1 << (SLOT_BITS * LEVELS);
+    if (delta >= span)
+        at = current_ + span - 1;
+    
+    Link* head = &wheel_[level][(at >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    entry->next = head;
+    entry->prev = head->prev;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+void TimerService::advance(boost::uint64_t tick, std::vector<AsyncResultPtr>& due)
+{
+    while (current_ < tick) {
+        if (count_ == 0) {
+            current_ = tick;
+            return;
+        }
+        current_++;
+        
+        // Each time a wheel turns over, move the next slot of the wheel 
+        // above down to where it belongs now.
+        for (size_t level=1; level<LEVELS; level++) {
+            if (current_ & (((boost::uint64_t)1 << (SLOT_BITS * level)) - 1))
+                break;
+            Link* head = &wheel_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+            Link* it = head->next;
+            head->prev = head->next = head;
+            while (it != head) {
+                Link* next = it->next;
+                place(static_cast<Entry*>(it));
+                it = next;
+            }
+        }
+        expire(&wheel_[0][current_ & (SLOTS - 1)], due);
+    }
+}
+
+void TimerService::expire(Link* head, std::vector<AsyncResultPtr>& due)
+{
+    Link* it = head->next;
+    head->prev = head->next = head;
+    while (it != head) {
+        Entry* entry = static_cast<Entry*>(it);
+        it = it->next;
+        
+        if (entry->expires > current_) {
+            place(entry);
+            continue;
+        }
+        
+        // Cancelled jobs and schedules are dropped lazily, here.
+        if (entry->job->status() != AsyncResult::WAIT) {
+            delete entry;
+            count_--;
+            continue;
+        }
+        
+        if (entry->period) {
+            AsyncResultPtr ar(new AsyncResult(entry->task));
+            ar->add_all(entry->callback);
+            due.push_back(ar);
+            entry->expires += entry->period;
+            if (entry->expires <= current_)
+                entry->expires = current_ + 1;
+            place(entry);
+        } else {
+            due.push_back(entry->job);
+            delete entry;
+            count_--;
+        }
+    }
+}
+
+boost::uint64_t TimerService::next_tick() const
+{
+    // Entries above level 0 only move down when the level 0 wheel turns 
+    // over, so nothing can be due before that but the level 0 slots.
+    boost::uint64_t turn = (current_ | (SLOTS - 1)) + 1;
+    for (boost::uint64_t tick = current_ + 1; tick < turn; tick++) {
+        const Link* head = &wheel_[0][tick & (SLOTS - 1)];
+        if (head->next != head)
+            return tick;
+    }
+    return turn;
+}
+
+void TimerService::dispatch(const std::vector<AsyncResultPtr>& due)
+{
+    try {
+        executor_.submit_bulk(due);
+        return;
+    } catch (AvalonException&) {
+        // the batch does not fit, try one by one.
+    }
+    BOOST_FOREACH(const AsyncResultPtr& ar, due) {
+        if (executor_.try_submit(ar) != Executor::SUBMIT_OK)
+            ar->cancel();
+    }
+}
+
+void TimerService::run_thread()
+{
+    std::vector<AsyncResultPtr> due;
+    boost::unique_lock<Lock> locker(lock_);
+    while (!stopping_) {
+        if (count_ == 0) {
+            cond_.wait(locker);
+            continue;
+        }
+        
+        advance((Clock::now() - origin_) / tick_, due);
+        if (!due.empty()) {
+            locker.unlock();
+            dispatch(due);
+            due.clear();
+            locker.lock();
+            continue;
+        }
+        wake_ = next_tick();
+        cond_.wait_until(locker, origin_ + tick_ * wake_);
+    }
+}
+
+END_AVALON_NS2
@@ -0,0 +1,225 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_TIMERSERVICE_H
+#define THREAD_TIMERSERVICE_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asyncresult.h"
+#include "clock.h"
+#include "executor.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The delayed and periodic job scheduler.
+/**
+ * Timers are kept in a hierarchical timing wheel: LEVELS wheels of 
+ * SLOTS slots each, where a slot of level n spans SLOTS^n ticks. A timer 
+ * is linked into the slot of its expiry, and moved down a level when 
+ * the wheel above turns over. So adding a timer is O(1) regardless of 
+ * how many are pending, and one thread serves all of them. The thread 
+ * sleeps until the next slot with timers, or the next turn of the lowest 
+ * wheel, rather than waking every tick.
+ * 
+ * Due jobs are handed to the executor in one submit_bulk() per tick. 
+ * If the executor rejects the batch, each job is submitted on its own, 
+ * and cancelled if rejected again.
+ * 
+ * The returned AsyncResult is cancelled like any other job. Cancelling 
+ * is O(1) too: the wheel entry stays in place, and is dropped when it 
+ * comes due. Until then it holds the cancelled job, whose task has 
+ * already been released, and for a periodic timer the task and callback 
+ * of the runs. So a far timer which is cancelled costs its entry and 
+ * job blocks until its expiry.
+ */
+class TimerService : private boost::noncopyable
+{
+public:
+    /// The bits of slot index per level.
+    static const size_t SLOT_BITS = 8;
+    
+    /// The slot count per level.
+    static const size_t SLOTS = 1 << SLOT_BITS;
+    
+    /// The level count.
+    static const size_t LEVELS = 4;
+    
+    /// Create a timer service.
+    /**
+     * @param executor The executor to run due jobs.
+     * @param tick The wheel resolution in milliseconds.
+     */
+    explicit TimerService(Executor& executor, size_t tick = 1);
+    
+    /// Stop the service, and cancel all pending timers.
+    ~TimerService();
+    
+    /// Start the timer thread.
+    void start();
+    
+    /// Stop the timer thread.
+    /**
+     * Pending timers are kept, and those due in the meantime fire 
+     * after start() is called again.
+     */
+    void stop();
+    
+    /// Submit a job after some milliseconds.
+    /**
+     * @param delay The delay in milliseconds.
+     * @param job Job function object.
+     * @param callback The callback function object after the job finished.
+     * @return The job's AsyncResult.
+     */
+    AsyncResultPtr submit_after(size_t delay, const AsyncResult::Task& job,
+                                const AsyncResult::Callback& callback);
+    
+    /// Submit a job at a time point.
+    /**
+     * A time point in the past submits the job at the next tick.
+     */
+    AsyncResultPtr submit_at(const Clock::time_point& when, const AsyncResult::Task& job,
+                             const AsyncResult::Callback& callback);
+    
+    /// Submit a job every period milliseconds.
+    /**
+     * Each run gets its own AsyncResult, on which callback is called. 
+     * Runs are fired at a fixed rate, whether or not the previous run 
+     * has finished.
+     * 
+     * @param period The period in milliseconds. The first run is after 
+     *      one period.
+     * @return The schedule handle. It stays WAIT, and cancelling it 
+     *      stops further runs.
+     */
+    AsyncResultPtr submit_every(size_t period, const AsyncResult::Task& job,
+                                const AsyncResult::Callback& callback);
+    
+    /// The number of timers which are still to fire.
+    /**
+     * Cancelled timers are not counted, even if not yet dropped. This 
+     * walks the wheel, so it is meant for diagnostics.
+     */
+    size_t pending();
+    
+protected:
+    /// The list link of wheel slots.
+    struct Link
+    {
+        Link* prev;
+        Link* next;
+    };
+    
+    /// The timer entry.
+    struct Entry : public Link
+    {
+        /// The expiry tick.
+        boost::uint64_t expires;
+        
+        /// The period in ticks. Zero means one shot.
+        boost::uint64_t period;
+        
+        /// The job, or the schedule handle of a periodic timer.
+        AsyncResultPtr job;
+        
+        /// The job function of a periodic timer.
+        AsyncResult::Task task;
+        
+        /// The callback of a periodic timer.
+        AsyncResult::Callback callback;
+    };
+    
+    /// The lock type.
+    typedef boost::mutex Lock;
+    
+    /// The executor.
+    Executor& executor_;
+    
+    /// The tick length.
+    const Clock::duration tick_;
+    
+    /// The time of tick zero.
+    const Clock::time_point origin_;
+    
+    /// Guards the wheel.
+    Lock lock_;
+    
+    /// Notifies the timer thread.
+    boost::condition_variable cond_;
+    
+    /// The wheel slots, as circular lists.
+    Link wheel_[LEVELS][SLOTS];
+    
+    /// The last processed tick.
+    boost::uint64_t current_;
+    
+    /// The tick the timer thread sleeps until.
+    boost::uint64_t wake_;
+    
+    /// The entry count.
+    size_t count_;
+    
+    /// Whether the timer thread should exit.
+    bool stopping_;
+    
+    /// The timer thread.
+    boost::shared_ptr<boost::thread> thread_;
+    
+    /// The tick of a time point, rounded up.
+    boost::uint64_t tick_of(const Clock::time_point& when) const;
+    
+    /// Add an entry to the wheel. lock_ must be held.
+    void insert(Entry* entry);
+    
+    /// Link an entry into its slot. lock_ must be held.
+    void place(Entry* entry);
+    
+    /// Advance the wheel to the tick, collecting due jobs. lock_ must be held.
+    void advance(boost::uint64_t tick, std::vector<AsyncResultPtr>& due);
+    
+    /// Process the entries of a level 0 slot. lock_ must be held.
+    void expire(Link* slot, std::vector<AsyncResultPtr>& due);
+    
+    /// The next tick with work: a level 0 slot with entries, or a cascade.
+    /**
+     * lock_ must be held.
+     */
+    boost::uint64_t next_tick() const;
+    
+    /// Hand the due jobs to the executor.
+    void dispatch(const std::vector<AsyncResultPtr>& due);
+    
+    /// The timer thread loop.
+    void run_thread();
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_TIMERSERVICE_H
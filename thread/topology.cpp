@@ -0,0 +1,256 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#include "topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <boost/thread/thread.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// Read the first line of a file.
+    bool read_line(const std::string& path, std::string& line)
+    {
+        std::ifstream in(path.c_str());
+        return in && std::getline(in, line);
+    }
+    
+    /// Discover the topology, restricted to the allowed CPUs.
+    Topology* discover(const std::string& root)
+    {
+        Topology* ret = new Topology(root);
+        ret->restrict_to(Topology::allowed_cpus());
+        return ret;
+    }
+}
+
+Topology::Topology(const std::string& root)
+ :  nodes_()
+{
+    // nodes may be sparse, e.g. node0 and node2.
+    std::string line;
+    if (read_line(root + "/node/possible", line)) {
+        CpuList ids = parse_cpu_list(line);
+        for (size_t i=0; i<ids.size(); i++) {
+            std::ostringstream path;
+            path << root << "/node/node" << ids[i] << "/cpulist";
+            if (read_line(path.str(), line)) {
+                CpuList cpus = parse_cpu_list(line);
+                if (!cpus.empty())
+                    nodes_.push_back(cpus);
+            }
+        }
+    }
+    if (nodes_.empty()) {
+        CpuList cpus;
+        if (read_line(root + "/cpu/online", line))
+            cpus = parse_cpu_list(line);
+        if (cpus.empty()) {
+            for (unsigned i=0; i<std::max(boost::thread::hardware_concurrency(), 1u); i++) {
+                cpus.push_back((int)i);
+            }
+        }
+        nodes_.push_back(cpus);
+    }
+}
+
+Topology::Topology(const std::vector<CpuList>& nodes)
+ :  nodes_(nodes)
+{
+    if (nodes_.empty())
+        nodes_.push_back(CpuList(1, 0));
+}
+
+const Topology& Topology::system()
+{
+    static Topology* instance = discover("/sys/devices/system");
+    return *instance;
+}
+
+size_t Topology::node_count() const
+{
+    return nodes_.size();
+}
+
+const Topology::CpuList& Topology::cpus(size_t node) const
+{
+    return nodes_[node % nodes_.size()];
+}
+
+Topology::CpuList Topology::all_cpus() const
+{
+    CpuList ret;
+    for (size_t i=0; i<nodes_.size(); i++) {
+        ret.insert(ret.end(), nodes_[i].begin(), nodes_[i].end());
+    }
+    return ret;
+}
+
+size_t Topology::node_of(int cpu) const
+{
+    for (size_t i=0; i<nodes_.size(); i++) {
+        if (std::find(nodes_[i].begin(), nodes_[i].end(), cpu) != nodes_[i].end())
+            return i;
+    }
+    return 0;
+}
+
+Topology::CpuList Topology::parse_cpu_list(const std::string& text)
+{
+    CpuList ret;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        int first = 0, last = 0;
+        char dash = 0;
+        std::istringstream range(item);
+        if (!(range >> first))
+            continue;
+        if (range >> dash >> last && dash == '-') {
+            for (int cpu = first; cpu <= last; cpu++) {
+                ret.push_back(cpu);
+            }
+        } else {
+            ret.push_back(first);
+        }
+    }
+    return ret;
+}
+
+bool Topology::bind_current_thread(const CpuList& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i=0; i<cpus.size(); i++) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE)
+            CPU_SET(cpus[i], &set);
+    }
+    return !cpus.empty() && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+int Topology::current_cpu()
+{
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+Topology::CpuList Topology::allowed_cpus()
+{
+    CpuList ret;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                ret.push_back(cpu);
+        }
+    }
+#endif
+    return ret;
+}
+
+void Topology::restrict_to(const CpuList& allowed)
+{
+    std::vector<CpuList> nodes;
+    for (size_t i=0; i<nodes_.size(); i++) {
+        CpuList cpus;
+        for (size_t j=0; j<nodes_[i].size(); j++) {
+            if (std::find(allowed.begin(), allowed.end(), nodes_[i][j]) != allowed.end())
+                cpus.push_back(nodes_[i][j]);
+        }
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+    if (!nodes.empty())
+        nodes_.swap(nodes);
+}
+
+Placement::Placement()
+ :  policy_(NONE),
+    cpus_()
+{
+}
+
+Placement Placement::cpu_set(const Topology::CpuList& cpus)
+{
+    Placement ret;
+    ret.policy_ = CPU_LIST;
+    ret.cpus_ = cpus;
+    return ret;
+}
+
+Placement Placement::node(size_t node, const Topology& topology)
+{
+    return cpu_set(topology.cpus(node));
+}
+
+Placement Placement::spread()
+{
+    Placement ret;
+    ret.policy_ = SPREAD;
+    return ret;
+}
+
+Placement Placement::compact()
+{
+    Placement ret;
+    ret.policy_ = COMPACT;
+    return ret;
+}
+
+Placement::Policy Placement::policy() const
+{
+    return policy_;
+}
+
+Topology::CpuList Placement::cpus_for(size_t index, const Topology& topology) const
+{
+    switch (policy_) {
+        case CPU_LIST:
+            return cpus_;
+        case SPREAD:
+            return topology.cpus(index % topology.node_count());
+        case COMPACT: {
+            Topology::CpuList all = topology.all_cpus();
+            return Topology::CpuList(1, all[index % all.size()]);
+        }
+        default:
+            return Topology::CpuList();
+    }
+}
+
+END_AVALON_NS2
@@ -0,0 +1,159 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+#ifndef THREAD_TOPOLOGY_H
+#define THREAD_TOPOLOGY_H
+
+#include "../define.h"
+
+#include <string>
+#include <vector>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The CPU and NUMA node layout of the machine.
+/**
+ * Read from sysfs (node/nodeN/cpulist), the same source as libnuma. Machines 
+ * without NUMA information are seen as one node with all online CPUs.
+ * system() only keeps the CPUs in the affinity mask of the process, so that 
+ * taskset and cgroup cpusets are honoured.
+ */
+class Topology
+{
+public:
+    /// The CPU list type.
+    typedef std::vector<int> CpuList;
+    
+    /// Discover the topology under a sysfs directory.
+    /**
+     * @param root Usually "/sys/devices/system".
+     */
+    explicit Topology(const std::string& root);
+    
+    /// Create a topology from the CPU lists of each node.
+    explicit Topology(const std::vector<CpuList>& nodes);
+    
+    /// The topology of this machine, discovered once.
+    static const Topology& system();
+    
+    /// The node count. At least one.
+    size_t node_count() const;
+    
+    /// The CPUs of a node.
+    const CpuList& cpus(size_t node) const;
+    
+    /// All CPUs, node by node.
+    CpuList all_cpus() const;
+    
+    /// The node of a CPU.
+    /**
+     * @return 0 if the CPU is unknown.
+     */
+    size_t node_of(int cpu) const;
+    
+    /// Parse a sysfs CPU list, e.g. "0-3,8,10-11".
+    static CpuList parse_cpu_list(const std::string& text);
+    
+    /// Pin the calling thread to the CPUs.
+    /**
+     * @return false if not supported or refused by the system.
+     */
+    static bool bind_current_thread(const CpuList& cpus);
+    
+    /// The CPU the calling thread is running on.
+    /**
+     * @return -1 if not supported.
+     */
+    static int current_cpu();
+    
+    /// The CPUs the process is allowed to run on.
+    /**
+     * @return An empty list if not supported.
+     */
+    static CpuList allowed_cpus();
+    
+    /// Keep only the allowed CPUs.
+    /**
+     * Nodes left without CPUs are dropped. Nothing changes if no CPU would be 
+     * left, e.g. when @p allowed is empty.
+     */
+    void restrict_to(const CpuList& allowed);
+    
+protected:
+    /// The CPUs of each node.
+    std::vector<CpuList> nodes_;
+};
+
+/// The policy to place threads on CPUs.
+class Placement
+{
+public:
+    /// The placement policy.
+    enum Policy
+    {
+        /// Let the kernel place the threads.
+        NONE = 0,
+        
+        /// Pin every thread to the same CPU list.
+        CPU_LIST = 1,
+        
+        /// Deal threads round-robin over the nodes, each pinned to its node.
+        SPREAD = 2,
+        
+        /// Fill the CPUs of one node before the next, each thread on one CPU.
+        COMPACT = 3
+    };
+    
+    /// Create a NONE placement.
+    Placement();
+    
+    /// Pin all threads to the CPUs.
+    static Placement cpu_set(const Topology::CpuList& cpus);
+    
+    /// Pin all threads to the CPUs of a node.
+    static Placement node(size_t node, const Topology& topology = Topology::system());
+    
+    /// Spread threads across the nodes.
+    static Placement spread();
+    
+    /// Pack threads within the nodes.
+    static Placement compact();
+    
+    /// The policy.
+    Policy policy() const;
+    
+    /// The CPUs allowed for the index-th thread.
+    /**
+     * @return An empty list if the thread should not be pinned.
+     */
+    Topology::CpuList cpus_for(size_t index, const Topology& topology = Topology::system()) const;
+    
+protected:
+    /// The policy.
+    Policy policy_;
+    
+    /// The CPUs of CPU_LIST.
+    Topology::CpuList cpus_;
+};
+
+END_AVALON_NS2
+
+#endif // THREAD_TOPOLOGY_H
@@ -0,0 +1,336 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <boost/foreach.hpp>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../errors.h"
+#include "clock.h"
+
+BEGIN_AVALON_NS2(thread)
+
+namespace {
+    /// The ring of the current thread.
+    __thread void* current_ring = NULL;
+    
+    /// The traced job running in current thread.
+    __thread boost::uint64_t current_job = 0;
+    
+    /// The submissions to skip before the next sample, in current thread.
+    __thread size_t sample_countdown = 0;
+    
+    /// The id of the calling thread.
+    long thread_id()
+    {
+#ifdef __linux__
+        return (long)syscall(SYS_gettid);
+#else
+        static boost::atomic<long> next_tid(1);
+        return next_tid.fetch_add(1);
+#endif
+    }
+    
+    /// The id of the process.
+    long process_id()
+    {
+#ifdef __linux__
+        return (long)getpid();
+#else
+        return 1;
+#endif
+    }
+    
+    /// The event names, by type.
+    const char* EVENT_NAMES[] = {
+        "submit", "dequeue", "job", "job", "callbacks", "callbacks"
+    };
+    
+    /// The status names.
+    const char* STATUS_NAMES[] = {
+        "WAIT", "RUNNING", "SUCCESS", "ERROR", "CANCELLED", "INTERRUPTED", "EXPIRED"
+    };
+    
+    /// Write a Clock tick count as microseconds.
+    void write_time(std::ostream& out, boost::int64_t time)
+    {
+        boost::int64_t ns = boost::chrono::duration_cast<boost::chrono::nanoseconds>(
+            Clock::duration(time)).count();
+        out << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000;
+    }
+}
+
+boost::atomic<bool> Tracer::enabled_(false);
+
+const size_t Tracer::MAX_RETIRED_RINGS;
+
+boost::thread_specific_ptr<Tracer::Ring> Tracer::ring_owner_(&Tracer::retire);
+
+Tracer::Ring::Ring(size_t capacity)
+ :  events_(),
+    mask_(capacity - 1),
+    tid_(thread_id()),
+    head_(0),
+    base_(0)
+{
+    events_.resize(capacity);
+}
+
+void Tracer::Ring::push(const Event& event)
+{
+    size_t head = head_.load(boost::memory_order_relaxed);
+    events_[head & mask_] = event;
+    head_.store(head + 1, boost::memory_order_release);
+}
+
+void Tracer::Ring::collect(std::vector<Event>& out) const
+{
+    size_t head = head_.load(boost::memory_order_acquire);
+    size_t begin = base_.load(boost::memory_order_relaxed);
+    if (head - begin > events_.size())
+        begin = head - events_.size();
+    size_t start = out.size();
+    for (size_t i=begin; i<head; i++) {
+        out.push_back(events_[i & mask_]);
+    }
+    
+    // The owner may have overwritten the oldest ones meanwhile.
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    size_t now = head_.load(boost::memory_order_relaxed);
+    if (now - begin > events_.size()) {
+        size_t lost = std::min(now - begin - events_.size(), head - begin);
+        out.erase(out.begin() + start, out.begin() + start + lost);
+    }
+}
+
+void Tracer::Ring::clear()
+{
+    base_.store(head_.load(boost::memory_order_acquire), boost::memory_order_relaxed);
+}
+
+long Tracer::Ring::tid() const
+{
+    return tid_;
+}
+
+size_t Tracer::Ring::capacity() const
+{
+    return mask_ + 1;
+}
+
+
+Tracer::Tracer()
+ :  period_(1),
+    capacity_(DEFAULT_CAPACITY),
+    next_id_(0),
+    lock_(),
+    rings_(),
+    retired_()
+{
+}
+
+Tracer& Tracer::instance()
+{
+    // Leaked, so that threads may record while static objects are destroyed.
+    static Tracer* tracer = new Tracer();
+    return *tracer;
+}
+
+void Tracer::enable(double rate, size_t capacity)
+{
+    if (!(rate > 0 && rate <= 1))
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("rate") );
+    if (!capacity)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("capacity") );
+    
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+    period_.store(std::max((size_t)std::floor(1 / rate + 0.5), (size_t)1));
+    capacity_.store(rounded);
+    enabled_.store(true);
+}
+
+void Tracer::disable()
+{
+    enabled_.store(false);
+}
+
+void Tracer::clear()
+{
+    boost::mutex::scoped_lock locker(lock_);
+    BOOST_FOREACH(const boost::shared_ptr<Ring>& ring, rings_) {
+        ring->clear();
+    }
+    retired_.clear();
+}
+
+Tracer::Ring& Tracer::ring()
+{
+    Ring* ring = (Ring*)current_ring;
+    size_t capacity = capacity_.load(boost::memory_order_relaxed);
+    if (ring && ring->capacity() == capacity)
+        return *ring;
+    
+    ring = new Ring(capacity);
+    {
+        boost::mutex::scoped_lock locker(lock_);
+        rings_.push_back(boost::shared_ptr<Ring>(ring));
+    }
+    // Retires the previous ring, if any.
+    ring_owner_.reset(ring);
+    current_ring = ring;
+    return *ring;
+}
+
+void Tracer::retire(Ring* ring)
+{
+    if (current_ring == ring)
+        current_ring = NULL;
+    
+    Tracer& tracer = instance();
+    boost::mutex::scoped_lock locker(tracer.lock_);
+    for (size_t i=0; i<tracer.rings_.size(); i++) {
+        if (tracer.rings_[i].get() == ring) {
+            tracer.retired_.push_back(tracer.rings_[i]);
+            tracer.rings_.erase(tracer.rings_.begin() + i);
+            break;
+        }
+    }
+    if (tracer.retired_.size() > MAX_RETIRED_RINGS)
+        tracer.retired_.erase(tracer.retired_.begin());
+}
+
+void Tracer::submit(AsyncResult& ar)
+{
+    // A continuation belongs to the job it follows, others to the 
+    // job submitting them.
+    boost::uint64_t parent = current_job;
+    if (ar.parent() && ar.parent()->trace_id())
+        parent = ar.parent()->trace_id();
+    
+    if (!ar.trace_id()) {
+        if (!parent) {
+            if (sample_countdown) {
+                sample_countdown--;
+                return;
+            }
+            sample_countdown = period_.load(boost::memory_order_relaxed) - 1;
+        }
+        ar.set_trace_id(next_id_.fetch_add(1, boost::memory_order_relaxed) + 1);
+    }
+    record(SUBMIT, ar.trace_id(), parent, ar.status());
+}
+
+void Tracer::record(EventType type, boost::uint64_t job, boost::uint64_t parent, int status)
+{
+    Event event;
+    event.time = Clock::now().time_since_epoch().count();
+    event.job = job;
+    event.parent = parent;
+    event.type = type;
+    event.status = status;
+    ring().push(event);
+}
+
+boost::uint64_t Tracer::enter(AsyncResult& ar)
+{
+    boost::uint64_t outer = current_job;
+    current_job = ar.trace_id();
+    record(START, ar.trace_id(), outer, ar.status());
+    return outer;
+}
+
+void Tracer::leave(AsyncResult& ar, boost::uint64_t outer)
+{
+    record(FINISH, ar.trace_id(), 0, ar.status());
+    current_job = outer;
+}
+
+void Tracer::write_json(std::ostream& out)
+{
+    // Exited threads write no more, so their rings are taken away.
+    std::vector< boost::shared_ptr<Ring> > rings;
+    {
+        boost::mutex::scoped_lock locker(lock_);
+        rings.swap(retired_);
+        rings.insert(rings.end(), rings_.begin(), rings_.end());
+    }
+    
+    long pid = process_id();
+    std::vector<Event> events;
+    bool first = true;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    BOOST_FOREACH(const boost::shared_ptr<Ring>& ring, rings) {
+        events.clear();
+        ring->collect(events);
+        BOOST_FOREACH(const Event& e, events) {
+            const char* phase = "i";
+            switch (e.type) {
+                case START:
+                case CALLBACK_BEGIN:
+                    phase = "B";
+                    break;
+                case FINISH:
+                case CALLBACK_END:
+                    phase = "E";
+                    break;
+            }
+            
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\":\"" << EVENT_NAMES[e.type] << "\",\"cat\":\"job\",\"ph\":\"" 
+                << phase << "\",\"ts\":";
+            write_time(out, e.time);
+            out << ",\"pid\":" << pid << ",\"tid\":" << ring->tid();
+            if (phase[0] == 'i')
+                out << ",\"s\":\"t\"";
+            out << ",\"args\":{\"job\":" << e.job;
+            if (e.type == SUBMIT || e.type == START)
+                out << ",\"parent\":" << e.parent;
+            if (e.type == FINISH || e.type == CALLBACK_BEGIN)
+                out << ",\"status\":\"" << STATUS_NAMES[e.status % 7] << "\"";
+            out << "}}";
+            
+            // Flow arrows, from the submission to the run.
+            if (e.type == SUBMIT || e.type == START) {
+                out << ",\n{\"name\":\"queue\",\"cat\":\"job\",\"ph\":\"" 
+                    << (e.type == SUBMIT ? "s" : "f") << "\",\"bp\":\"e\",\"id\":" << e.job 
+                    << ",\"ts\":";
+                write_time(out, e.time);
+                out << ",\"pid\":" << pid << ",\"tid\":" << ring->tid() << "}";
+            }
+        }
+    }
+    out << "\n]}\n";
+}
+
+END_AVALON_NS2
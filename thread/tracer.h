@@ -0,0 +1,288 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+
+
+#ifndef THREAD_TRACER_H
+#define THREAD_TRACER_H
+
+#include "../define.h"
+
+#include <ostream>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include "asyncresult.h"
+
+BEGIN_AVALON_NS2(thread)
+
+/// The job lifecycle tracer.
+/**
+ * When enabled, a sampled job gets a trace id at its submission. Its 
+ * submit, dequeue, start, finish and callback events are recorded then. 
+ * Jobs submitted while a traced job is running are its children, and 
+ * continuations of a traced job are linked to it. Both are always 
+ * traced, so a sampled request is seen as a whole.
+ * 
+ * Events go to a ring buffer of the recording thread, with a single 
+ * writer and no lock. A full ring overwrites its oldest events. 
+ * write_json() dumps all rings as Chrome trace events, for 
+ * chrome://tracing or Perfetto.
+ * 
+ * The ring of an exiting thread is retired: kept for the next dump or 
+ * clear(), up to MAX_RETIRED_RINGS of them, so thread churn does not 
+ * grow the memory while tracing is on.
+ * 
+ * A disabled tracer costs a relaxed load per submission, and untraced 
+ * jobs only check their trace id on execution.
+ */
+class Tracer : private boost::noncopyable
+{
+public:
+    /// The event type.
+    enum EventType
+    {
+        /// The job is queued.
+        SUBMIT = 0,
+        /// A worker took the job from the queue.
+        DEQUEUE = 1,
+        /// The job starts running.
+        START = 2,
+        /// The job has run, callbacks included.
+        FINISH = 3,
+        /// The callbacks start.
+        CALLBACK_BEGIN = 4,
+        /// The callbacks are done.
+        CALLBACK_END = 5
+    };
+    
+    /// The default ring capacity, in events per thread.
+    static const size_t DEFAULT_CAPACITY = 8192;
+    
+    /// The maximum rings of exited threads kept, the oldest dropped first.
+    static const size_t MAX_RETIRED_RINGS = 64;
+    
+    /// The tracer of the process.
+    static Tracer& instance();
+    
+    /// Whether tracing is enabled.
+    static bool enabled();
+    
+    /// Enable tracing.
+    /**
+     * @param rate The sampled fraction of jobs submitted outside traced 
+     *      jobs. Each thread samples one in round(1 / rate) submissions.
+     * @param capacity The ring capacity, rounded up to power of 2. A 
+     *      thread whose ring has another capacity retires it and starts 
+     *      a new one at its next event.
+     * @throw AvalonInvalidArgument If rate is not in (0, 1], or capacity is zero.
+     */
+    void enable(double rate = 1.0, size_t capacity = DEFAULT_CAPACITY);
+    
+    /// Disable tracing. Recorded events are kept.
+    void disable();
+    
+    /// Drop the recorded events.
+    void clear();
+    
+    /// Write the recorded events as Chrome trace JSON.
+    /**
+     * Events being overwritten during the dump are left out. The rings 
+     * of exited threads are dropped once written.
+     */
+    void write_json(std::ostream& out);
+    
+    /// Trace the submission of a job. Called by executors.
+    static void on_submit(AsyncResult& ar);
+    
+    /// Trace an event of a traced job. Called by executors and AsyncResult.
+    static void on_event(EventType type, AsyncResult& ar);
+    
+    /// Trace the run of a job, as START and FINISH events around a scope.
+    /**
+     * While the scope lasts, the job is the parent of submitted jobs.
+     */
+    class Scope : private boost::noncopyable
+    {
+    public:
+        /// Record START if the job is traced.
+        explicit Scope(AsyncResult& ar);
+        
+        /// Record FINISH if START was recorded.
+        ~Scope();
+        
+    protected:
+        /// The job.
+        AsyncResult& ar_;
+        
+        /// The job running outside this scope.
+        boost::uint64_t outer_;
+        
+        /// Whether START was recorded.
+        bool active_;
+    };
+    
+protected:
+    friend class Scope;
+    
+    /// A recorded event.
+    struct Event
+    {
+        /// The time, in Clock ticks since epoch.
+        boost::int64_t time;
+        
+        /// The job trace id.
+        boost::uint64_t job;
+        
+        /// The parent trace id, for SUBMIT.
+        boost::uint64_t parent;
+        
+        /// The event type.
+        boost::uint32_t type;
+        
+        /// The job status, for FINISH and CALLBACK_BEGIN.
+        boost::uint32_t status;
+    };
+    
+    /// The event ring of one thread.
+    class Ring : private boost::noncopyable
+    {
+    public:
+        /// Create a ring for the calling thread.
+        explicit Ring(size_t capacity);
+        
+        /// Append an event. Only called by the owner thread.
+        void push(const Event& event);
+        
+        /// Copy the events not yet overwritten.
+        void collect(std::vector<Event>& out) const;
+        
+        /// Drop the events pushed so far.
+        void clear();
+        
+        /// The owner thread id.
+        long tid() const;
+        
+        /// The event capacity.
+        size_t capacity() const;
+        
+    protected:
+        /// The events.
+        std::vector<Event> events_;
+        
+        /// The index mask.
+        const size_t mask_;
+        
+        /// The owner thread id.
+        const long tid_;
+        
+        /// The count of events ever pushed.
+        boost::atomic<size_t> head_;
+        
+        /// The head at the last clear().
+        boost::atomic<size_t> base_;
+    };
+    
+    /// Create a disabled tracer.
+    Tracer();
+    
+    /// Whether tracing is enabled.
+    static boost::atomic<bool> enabled_;
+    
+    /// The sampling period.
+    boost::atomic<size_t> period_;
+    
+    /// The ring capacity of new threads.
+    boost::atomic<size_t> capacity_;
+    
+    /// The last trace id.
+    boost::atomic<boost::uint64_t> next_id_;
+    
+    /// The lock for the ring list.
+    boost::mutex lock_;
+    
+    /// The rings of live threads.
+    std::vector< boost::shared_ptr<Ring> > rings_;
+    
+    /// The rings of exited threads, oldest first.
+    std::vector< boost::shared_ptr<Ring> > retired_;
+    
+    /// Retire the ring of the calling thread when it exits.
+    static boost::thread_specific_ptr<Ring> ring_owner_;
+    
+    /// Move a ring from the live list to the retired one.
+    static void retire(Ring* ring);
+    
+    /// Record a submission.
+    void submit(AsyncResult& ar);
+    
+    /// Record an event.
+    void record(EventType type, boost::uint64_t job, boost::uint64_t parent, int status);
+    
+    /// The ring of the calling thread, created on first use or capacity change.
+    Ring& ring();
+    
+    /// Record START, and make the job current. Returns the outer job.
+    boost::uint64_t enter(AsyncResult& ar);
+    
+    /// Record FINISH, and restore the outer job.
+    void leave(AsyncResult& ar, boost::uint64_t outer);
+};
+
+inline bool Tracer::enabled()
+{
+    return enabled_.load(boost::memory_order_relaxed);
+}
+
+inline void Tracer::on_submit(AsyncResult& ar)
+{
+    if (enabled())
+        instance().submit(ar);
+}
+
+inline void Tracer::on_event(EventType type, AsyncResult& ar)
+{
+    if (ar.trace_id() && enabled())
+        instance().record(type, ar.trace_id(), 0, ar.status());
+}
+
+inline Tracer::Scope::Scope(AsyncResult& ar)
+ :  ar_(ar),
+    outer_(0),
+    active_(ar.trace_id() && enabled())
+{
+    if (active_)
+        outer_ = instance().enter(ar);
+}
+
+inline Tracer::Scope::~Scope()
+{
+    if (active_)
+        instance().leave(ar_, outer_);
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_TRACER_H
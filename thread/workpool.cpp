@@ -20,9 +20,15 @@
 
 #include "workpool.h"
 
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scope_exit.hpp>
 #include <boost/asio/deadline_timer.hpp>
 
+#include "../errors.h"
+#include "tracer.h"
+
 BEGIN_AVALON_NS2(thread)
 
 using boost::asio::deadline_timer;
@@ -30,7 +36,13 @@ using boost::asio::deadline_timer;
 WorkPoolBase::WorkPoolBase ( size_t max_queue )
  :  lock_(),
     jobs_(new JobSet), 
-    max_queue_(max_queue)
+    max_queue_(max_queue),
+    blocked_(0),
+    space_lock_(),
+    space_cond_(),
+    space_epoch_(0),
+    timing_(false),
+    metrics_()
 {
 }
 
@@ -66,6 +78,39 @@ void WorkPoolBase::drop ( const avalon::thread::AsyncResultPtr& ar )
         jobs_->erase(it);
 }
 
+namespace {
+    /// Compare AsyncResultPtr with raw pointer.
+    struct RawEqual
+    {
+        bool operator()(AsyncResult* a, const AsyncResultPtr& b) const {
+            return a == b.get();
+        }
+    };
+}
+
+void WorkPoolBase::drop_handler ( AsyncResult& ar )
+{
+    {
+        Lock::scoped_lock locker(lock_);
+        JobSet::iterator it = jobs_->find(&ar, boost::hash<AsyncResult*>(), RawEqual());
+        if (it != jobs_->end())
+            jobs_->erase(it);
+    }
+    notify_space();
+}
+
+void WorkPoolBase::notify_space()
+{
+    // Pairs with the producer's increment and retry in submit_wait().
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (!blocked_.load(boost::memory_order_relaxed))
+        return;
+    
+    boost::mutex::scoped_lock locker(space_lock_);
+    space_epoch_++;
+    space_cond_.notify_all();
+}
+
 void WorkPoolBase::drop_all ()
 {
     Lock::scoped_lock locker(lock_);
@@ -77,24 +122,159 @@ AsyncResultPtr WorkPoolBase::submit ( const avalon::thread::AsyncResult::Task& j
 {
     AsyncResultPtr ar(new AsyncResult(job));
     ar->add_all(callback);
-    ar->add_all(boost::bind(&WorkPoolBase::drop, this, ar));
+    return submit(ar);
+}
+
+AsyncResultPtr WorkPoolBase::submit ( const avalon::thread::AsyncResult::Task& job, 
+                                      const avalon::thread::AsyncResult::Callback& callback,
+                                      const Clock::time_point& deadline )
+{
+    AsyncResultPtr ar(new AsyncResult(job));
+    ar->set_deadline(deadline);
+    ar->add_all(callback);
+    return submit(ar);
+}
+
+AsyncResultPtr WorkPoolBase::submit ( const avalon::thread::AsyncResultPtr& ar )
+{
+    if (try_submit(ar) != SUBMIT_OK)
+        throw AvalonWorkPoolFull();
+    return ar;
+}
+
+Executor::SubmitStatus WorkPoolBase::try_submit ( const avalon::thread::AsyncResultPtr& ar )
+{
     {
         Lock::scoped_lock locker(lock_);
         if (max_queue_ && jobs_->size() >= max_queue_)
-            throw AvalonWorkPoolFull();
+            return SUBMIT_FULL;
         jobs_->insert(ar);
     }
-    return ar;
+    stamp(*ar);
+    // added after insert, for a finished job calls it immediately.
+    ar->add_all(boost::bind(&WorkPoolBase::drop_handler, this, _1));
+    return SUBMIT_OK;
+}
+
+Executor::SubmitStatus WorkPoolBase::submit_wait ( const avalon::thread::AsyncResultPtr& ar, 
+                                                   size_t timeout )
+{
+    SubmitStatus status = try_submit(ar);
+    if (status != SUBMIT_FULL)
+        return status;
+    
+    Clock::time_point until = deadline_after(timeout);
+    // Announce before retrying, so that a job leaving the queue after the 
+    // retry sees this producer and notifies.
+    blocked_.fetch_add(1);
+    bool expired = false;
+    while (!expired) {
+        boost::mutex::scoped_lock locker(space_lock_);
+        size_t epoch = space_epoch_;
+        
+        // Retry unlocked: a finished job calls drop_handler() inline, 
+        // which takes space_lock_ to notify.
+        locker.unlock();
+        if ((status = try_submit(ar)) != SUBMIT_FULL)
+            break;
+        locker.lock();
+        
+        // A notification since the epoch was read may have made room.
+        while (space_epoch_ == epoch && !expired) {
+            if (!timeout)
+                space_cond_.wait(locker);
+            else
+                expired = space_cond_.wait_until(locker, until) == boost::cv_status::timeout;
+        }
+    }
+    if (expired && (status = try_submit(ar)) == SUBMIT_FULL)
+        status = SUBMIT_TIMEOUT;
+    blocked_.fetch_sub(1);
+    return status;
+}
+
+
+JoinResult::Ptr WorkPoolBase::submit_bulk ( const std::vector<AsyncResultPtr>& jobs )
+{
+    {
+        Lock::scoped_lock locker(lock_);
+        if (max_queue_ && jobs_->size() + jobs.size() > max_queue_)
+            throw AvalonWorkPoolFull();
+        jobs_->reserve(jobs_->size() + jobs.size());
+        jobs_->insert(jobs.begin(), jobs.end());
+    }
+    BOOST_FOREACH(const AsyncResultPtr& ar, jobs) {
+        stamp(*ar);
+        ar->add_all(boost::bind(&WorkPoolBase::drop_handler, this, _1));
+    }
+    return JoinResult::create(jobs, JoinResult::JOIN_ALL);
+}
+
+size_t WorkPoolBase::concurrency()
+{
+    return 0;
+}
+
+void WorkPoolBase::set_timing(bool enabled)
+{
+    timing_.store(enabled);
+}
+
+MetricsSnapshot WorkPoolBase::metrics()
+{
+    MetricsSnapshot ret;
+    metrics_.collect(ret);
+    {
+        Lock::scoped_lock locker(lock_);
+        ret.jobs = jobs_->size();
+    }
+    ret.queued = ret.jobs;
+    BOOST_FOREACH(const WorkerSnapshot& worker, ret.workers) {
+        if (worker.running && ret.queued)
+            ret.queued--;
+    }
+    return ret;
+}
+
+void WorkPoolBase::stamp(AsyncResult& ar)
+{
+    if (timing_.load(boost::memory_order_relaxed))
+        ar.set_queued_at(Clock::now());
+    Tracer::on_submit(ar);
+}
+
+void WorkPoolBase::run_job(AsyncResult& ar)
+{
+    Tracer::on_event(Tracer::DEQUEUE, ar);
+    WorkerMetrics* metrics = ExecutorMetrics::current();
+    if (!metrics) {
+        ar.execute();
+        return;
+    }
+    
+    metrics->begin();
+    if (!timing_.load(boost::memory_order_relaxed)) {
+        ar.execute();
+    } else {
+        Clock::time_point start = Clock::now();
+        if (ar.queued_at() != Clock::time_point())
+            metrics->record_wait(start - ar.queued_at());
+        metrics->start_run(start);
+        ar.execute();
+        metrics->record_run(Clock::now() - start);
+    }
+    metrics->end(ar);
 }
 
 
 WorkPool::WorkPool ( size_t worker_count, size_t max_queue )
  :  WorkPoolBase(max_queue),
+    worker_count_(worker_count),
     work_(service_),
     pool_()
 {  
     for (size_t i=0; i<worker_count; i++) {
-        pool_.create_thread(boost::bind(&boost::asio::io_service::run, &service_));
+        pool_.create_thread(boost::bind(&WorkPool::run_thread, this));
     }
 }
 
@@ -109,20 +289,212 @@ void WorkPool::stop()
     pool_.join_all();
 }
 
-AsyncResultPtr WorkPool::submit ( const avalon::thread::AsyncResult::Task& job, 
-                                  const avalon::thread::AsyncResult::Callback& callback )
+Executor::SubmitStatus WorkPool::try_submit ( const avalon::thread::AsyncResultPtr& ar )
 {
-    AsyncResultPtr ar = avalon::thread::WorkPoolBase::submit ( job, callback );
-    service_.post(boost::bind(&WorkPool::exec_, this, ar));
-    return ar;
+    SubmitStatus status = avalon::thread::WorkPoolBase::try_submit ( ar );
+    if (status == SUBMIT_OK)
+        service_.post(boost::bind(&WorkPool::exec_, this, ar));
+    return status;
+}
+
+JoinResult::Ptr WorkPool::submit_bulk ( const std::vector<AsyncResultPtr>& jobs )
+{
+    JoinResult::Ptr group = avalon::thread::WorkPoolBase::submit_bulk ( jobs );
+    
+    // One handler per needed worker, instead of one per job.
+    boost::shared_ptr<Batch> batch(new Batch());
+    batch->group = group;
+    batch->next.store(0);
+    size_t handlers = std::min(jobs.size(), std::max(worker_count_, (size_t)1));
+    for (size_t i=0; i<handlers; i++) {
+        service_.post(boost::bind(&WorkPool::drain_, this, batch));
+    }
+    return group;
+}
+
+size_t WorkPool::concurrency()
+{
+    return worker_count_;
+}
+
+void WorkPool::run_thread()
+{
+    metrics_.attach();
+    BOOST_SCOPE_EXIT( (this_) ) {
+        this_->metrics_.detach();
+    } BOOST_SCOPE_EXIT_END
+    
+    service_.run();
 }
 
 void WorkPool::exec_(const AsyncResultPtr& ar)
 {
-    ar->execute();
+    run_job(*ar);
+}
+
+void WorkPool::drain_(const boost::shared_ptr<Batch>& batch)
+{
+    const std::vector<AsyncResultPtr>& jobs = batch->group->jobs();
+    size_t i;
+    while ((i = batch->next.fetch_add(1, boost::memory_order_relaxed)) < jobs.size()) {
+        run_job(*jobs[i]);
+    }
+}
+
+
+
+LockFreeWorkPool::LockFreeWorkPool ( size_t worker_count, size_t max_queue )
+ :  WorkPoolBase(max_queue),
+    worker_count_(worker_count),
+    queue_(max_queue ? max_queue : 1),
+    pool_(),
+    stopping_(false),
+    sleepers_(0),
+    idle_lock_(),
+    idle_cond_()
+{
+    if (!max_queue)
+        AVALON_THROW_INFO( AvalonInvalidArgument, error_argument("max_queue") );
+    for (size_t i=0; i<worker_count; i++) {
+        pool_.create_thread(boost::bind(&LockFreeWorkPool::run_thread, this));
+    }
+}
+
+LockFreeWorkPool::~LockFreeWorkPool()
+{
+    stop();
+}
+
+void LockFreeWorkPool::stop()
+{
+    {
+        boost::mutex::scoped_lock locker(idle_lock_);
+        stopping_.store(true);
+        idle_cond_.notify_all();
+    }
+    pool_.join_all();
+    
+    AsyncResultPtr ar;
+    while (queue_.pop(ar)) {
+        ar->cancel();
+    }
+}
+
+Executor::SubmitStatus LockFreeWorkPool::try_submit ( const avalon::thread::AsyncResultPtr& ar )
+{
+    if (stopping_.load())
+        return SUBMIT_FULL;
+    stamp(*ar);
+    if (!queue_.push(ar))
+        return SUBMIT_FULL;
+    
+    wake_workers(1);
+    cancel_stopped();
+    return SUBMIT_OK;
 }
 
+JoinResult::Ptr LockFreeWorkPool::submit_bulk ( const std::vector<AsyncResultPtr>& jobs )
+{
+    if (stopping_.load() || queue_.capacity() - queue_.size() < jobs.size())
+        AVALON_THROW(AvalonWorkPoolFull);
+    
+    JoinResult::Ptr group = JoinResult::create(jobs, JoinResult::JOIN_ALL);
+    BOOST_FOREACH(const AsyncResultPtr& ar, jobs) {
+        stamp(*ar);
+    }
+    size_t pushed = 0;
+    for (; pushed < jobs.size() && queue_.push(jobs[pushed]); pushed++);
+    for (size_t i=pushed; i<jobs.size(); i++) {
+        jobs[i]->cancel();
+    }
+    wake_workers(pushed);
+    cancel_stopped();
+    return group;
+}
+
+void LockFreeWorkPool::cancel_stopped()
+{
+    // Pairs with stop(), which sets the flag before draining. Either it 
+    // sees the pushed jobs, or this sees the flag. The queue has many 
+    // consumers, so both may drain.
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    if (!stopping_.load(boost::memory_order_relaxed))
+        return;
+    AsyncResultPtr ar;
+    while (queue_.pop(ar)) {
+        ar->cancel();
+    }
+}
 
+size_t LockFreeWorkPool::concurrency()
+{
+    return worker_count_;
+}
+
+MetricsSnapshot LockFreeWorkPool::metrics()
+{
+    MetricsSnapshot ret;
+    metrics_.collect(ret);
+    ret.queued = queue_.size();
+    ret.jobs = ret.queued;
+    BOOST_FOREACH(const WorkerSnapshot& worker, ret.workers) {
+        if (worker.running)
+            ret.jobs++;
+    }
+    return ret;
+}
+
+void LockFreeWorkPool::wake_workers(size_t n)
+{
+    // Pairs with the sleeper's increment and empty() check.
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    size_t sleepers = sleepers_.load(boost::memory_order_relaxed);
+    if (!sleepers || !n)
+        return;
+    
+    boost::mutex::scoped_lock locker(idle_lock_);
+    if (n >= sleepers) {
+        idle_cond_.notify_all();
+    } else {
+        for (size_t i=0; i<n; i++) {
+            idle_cond_.notify_one();
+        }
+    }
+}
+
+void LockFreeWorkPool::run_thread()
+{
+    metrics_.attach();
+    BOOST_SCOPE_EXIT( (this_) ) {
+        this_->metrics_.detach();
+    } BOOST_SCOPE_EXIT_END
+    
+    AsyncResultPtr ar;
+    while (!stopping_.load(boost::memory_order_acquire)) {
+        if (queue_.pop(ar)) {
+            notify_space();
+            run_job(*ar);
+            ar.reset();
+            continue;
+        }
+        
+        boost::mutex::scoped_lock locker(idle_lock_);
+        sleepers_.fetch_add(1);
+        if (stopping_.load()) {
+            sleepers_.fetch_sub(1);
+            break;
+        }
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (queue_.empty()) {
+            idle_cond_.wait(locker);
+        } else {
+            // A producer has claimed a cell but not published it yet.
+            locker.unlock();
+            boost::this_thread::yield();
+        }
+        sleepers_.fetch_sub(1);
+    }
+}
 
 END_AVALON_NS2
 
@@ -23,14 +23,22 @@
 
 #include "../define.h"
 
+#include <iterator>
+#include <vector>
 #include <boost/unordered_set.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/function.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "asyncresult.h"
+#include "boundedqueue.h"
+#include "combinators.h"
+#include "executor.h"
+#include "metrics.h"
 
 BEGIN_AVALON_NS2(thread)
 
@@ -41,7 +49,7 @@ BEGIN_AVALON_NS2(thread)
  * The workpool should be run in background, and waiting for jobs, until 
  * it is stopped.
  */
-class WorkPoolBase : private boost::noncopyable
+class WorkPoolBase : public Executor, private boost::noncopyable
 {
 public:
     /// create a new workpool.
@@ -79,6 +87,92 @@ public:
      */
     virtual AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback);
     
+    /// Add a job which is dropped if not started before the deadline.
+    /**
+     * An expired job becomes EXPIRED without being executed, and the 
+     * callback is called with that status.
+     * 
+     * @param job Job function object.
+     * @param callback The callback function object after the job finished.
+     * @param deadline The latest time to start the job.
+     * @return AsyncResult instance.
+     */
+    AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback,
+                          const Clock::time_point& deadline);
+    
+    /// Add a prepared AsyncResult to the workpool's job queue.
+    /**
+     * This is used to submit AsyncResult subclasses, e.g. Future<T>. 
+     * Callbacks should be added before submitting.
+     * 
+     * Extended classes should override try_submit() to schedule the job.
+     * 
+     * @param ar The job to execute.
+     * @return ar.
+     * @throw AvalonWorkPoolFull If the queue is full.
+     */
+    virtual AsyncResultPtr submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult to the job queue, unless it is full.
+    /**
+     * Extended classes should override this to schedule the job.
+     * 
+     * @return SUBMIT_OK or SUBMIT_FULL.
+     */
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    /// Add a prepared AsyncResult, waiting for a free slot if the queue is full.
+    /**
+     * The producer sleeps until a job leaves the queue, so that it slows 
+     * down to the speed of the workers instead of retrying.
+     * 
+     * @param ar The job to execute.
+     * @param timeout The maximum waiting milliseconds. Zero means no limit.
+     * @return SUBMIT_OK or SUBMIT_TIMEOUT.
+     */
+    SubmitStatus submit_wait(const AsyncResultPtr& ar, size_t timeout = 0);
+    
+    /// Add a batch of jobs to the workpool's job queue.
+    /**
+     * The jobs are registered under one lock acquisition, and only as 
+     * many workers as needed are woken up.
+     * 
+     * @param begin The first job function object.
+     * @param end The end of job function objects.
+     * @param callback The callback function object for each job.
+     * @return The group handle, to wait on or cancel the whole batch.
+     * @throw AvalonWorkPoolFull If the batch does not fit in the queue. 
+     *      No job is submitted then.
+     */
+    template <typename Iterator>
+    JoinResult::Ptr submit_bulk(Iterator begin, Iterator end, const AsyncResult::Callback& callback);
+    
+    /// Add a batch of prepared AsyncResults to the workpool's job queue.
+    /**
+     * Extended classes should override this to schedule the jobs.
+     */
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// The number of worker threads.
+    /**
+     * The base workpool has no worker, and returns zero.
+     */
+    virtual size_t concurrency();
+    
+    /// Enable or disable job timing.
+    /**
+     * When enabled, each job costs three clock reads, for the wait and 
+     * run latencies and the busy time. Job counts are always kept.
+     */
+    void set_timing(bool enabled);
+    
+    /// Take a snapshot of the metrics.
+    /**
+     * The job count is taken from the job list, and running jobs are 
+     * not counted as queued.
+     */
+    virtual MetricsSnapshot metrics();
+    
 protected:
     /// The spin lock type.
     typedef boost::detail::spinlock Lock;
@@ -100,12 +194,47 @@ protected:
     /// The maximum job queue size.
     size_t max_queue_;
     
+    /// The producer count blocked in submit_wait().
+    boost::atomic<size_t> blocked_;
+    
+    /// The lock for blocked producers.
+    boost::mutex space_lock_;
+    
+    /// The condition variable for blocked producers.
+    boost::condition_variable space_cond_;
+    
+    /// The count of notify_space() calls, guarded by space_lock_.
+    size_t space_epoch_;
+    
+    /// Wake up blocked producers, after a job has left the queue.
+    void notify_space();
+    
+    /// Whether job timing is enabled.
+    boost::atomic<bool> timing_;
+    
+    /// The per-worker metrics.
+    ExecutorMetrics metrics_;
+    
+    /// Stamp the queueing time of a job if timing is enabled, and trace its submission.
+    void stamp(AsyncResult& ar);
+    
+    /// Execute a job, recording it to the metrics of the calling worker.
+    void run_job(AsyncResult& ar);
+    
     /// Remove a job from job list.
     /**
      * Extended classes should override this to provide thread-safe coes.
      */
     virtual void drop(const AsyncResultPtr &ar);
     
+    /// The callback to remove a finished job from job list.
+    /**
+     * Bound with the raw reference instead of AsyncResultPtr, so that 
+     * the callback fits in boost::function without allocation, and the 
+     * job does not keep a reference to itself.
+     */
+    void drop_handler(AsyncResult& ar);
+    
     /// Remove all jobs from job list.
     virtual void drop_all();
 };
@@ -130,10 +259,33 @@ public:
     /// Stop the workpool's loop.
     virtual void stop();
     
-    /// Add a job to the workpool's job queue.
-    virtual AsyncResultPtr submit(const AsyncResult::Task& job, const AsyncResult::Callback& callback);
+    using WorkPoolBase::submit;
+    
+    /// Add a prepared AsyncResult to the job queue, unless it is full.
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    using WorkPoolBase::submit_bulk;
+    
+    /// Add a batch of prepared AsyncResults to the workpool's job queue.
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// The number of worker threads.
+    virtual size_t concurrency();
 
 protected:
+    /// The jobs shared by the handlers draining a batch.
+    struct Batch
+    {
+        /// The batch jobs.
+        JoinResult::Ptr group;
+        
+        /// The next job to execute.
+        boost::atomic<size_t> next;
+    };
+    
+    /// The worker count.
+    size_t worker_count_;
+    
     /// The io_service.
     boost::asio::io_service service_;
     
@@ -143,10 +295,113 @@ protected:
     /// The thread_group.
     boost::thread_group pool_;
     
+    /// Run the io_service loop in a worker thread.
+    void run_thread();
+    
     /// The handler for io_service.
     void exec_(const AsyncResultPtr& ar);
+    
+    /// The handler to execute jobs of a batch, until none is left.
+    void drain_(const boost::shared_ptr<Batch>& batch);
 };
 
+/// The lock-free ring buffer based workpool.
+/**
+ * Jobs are kept in a bounded MPMC ring buffer instead of a locked job 
+ * set and io_service queue. So a submit costs a couple of atomic 
+ * operations, and no spinlock is shared by producers.
+ * 
+ * Only queued jobs are counted by the ring, running jobs are not.
+ */
+class LockFreeWorkPool : public WorkPoolBase
+{
+public:
+    /// Create a new workpool instance.
+    /**
+     * @param worker_count The number of worker threads.
+     * @param max_queue The ring capacity, rounded up to power of 2. 
+     *      Must not be zero.
+     * @throw AvalonInvalidArgument If max_queue is zero.
+     */
+    LockFreeWorkPool(size_t worker_count, size_t max_queue);
+    
+    /// Dispose the workpool.
+    virtual ~LockFreeWorkPool();
+    
+    /// Stop the workpool's loop.
+    /**
+     * Queued jobs will be cancelled, running jobs will be joined.
+     */
+    virtual void stop();
+    
+    using WorkPoolBase::submit;
+    
+    /// Add a prepared AsyncResult to the job queue, unless the ring is full.
+    virtual SubmitStatus try_submit(const AsyncResultPtr& ar);
+    
+    using WorkPoolBase::submit_bulk;
+    
+    /// Add a batch of prepared AsyncResults to the workpool's job queue.
+    /**
+     * If other producers fill the ring during submission, the jobs that 
+     * do not fit are cancelled.
+     * 
+     * @throw AvalonWorkPoolFull If the ring has not enough free cells.
+     */
+    virtual JoinResult::Ptr submit_bulk(const std::vector<AsyncResultPtr>& jobs);
+    
+    /// The number of worker threads.
+    virtual size_t concurrency();
+    
+    /// Take a snapshot of the metrics. The queued jobs are counted by the ring.
+    virtual MetricsSnapshot metrics();
+    
+protected:
+    /// The worker count.
+    size_t worker_count_;
+    
+    /// The job ring.
+    BoundedQueue<AsyncResultPtr> queue_;
+    
+    /// The thread_group.
+    boost::thread_group pool_;
+    
+    /// Whether the workers should exit.
+    boost::atomic<bool> stopping_;
+    
+    /// The sleeping worker count.
+    boost::atomic<size_t> sleepers_;
+    
+    /// The lock for idle workers.
+    boost::mutex idle_lock_;
+    
+    /// The condition variable for idle workers.
+    boost::condition_variable idle_cond_;
+    
+    /// The worker loop.
+    void run_thread();
+    
+    /// Cancel the queued jobs if the pool is stopping, after a push.
+    void cancel_stopped();
+    
+    /// Wake up to n sleeping workers.
+    void wake_workers(size_t n);
+};
+
+template <typename Iterator>
+JoinResult::Ptr WorkPoolBase::submit_bulk(Iterator begin, Iterator end, 
+                                          const AsyncResult::Callback& callback)
+{
+    std::vector<AsyncResultPtr> jobs;
+    jobs.reserve(std::distance(begin, end));
+    for (; begin != end; ++begin) {
+        AsyncResultPtr ar(new AsyncResult(*begin));
+        ar->add_all(callback);
+        jobs.push_back(ar);
+    }
+    return submit_bulk(jobs);
+}
+
 END_AVALON_NS2
 
 #endif // WORKPOOL_H
@@ -0,0 +1,116 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#ifndef THREAD_WORKSTEALINGQUEUE_H
+#define THREAD_WORKSTEALINGQUEUE_H
+
+#include "../define.h"
+
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+BEGIN_AVALON_NS2(thread)
+
+/// The Chase-Lev work-stealing deque.
+/**
+ * The owner thread pushes and pops items at the bottom end (LIFO),
+ * while any other thread may steal items from the top end (FIFO).
+ *
+ * The memory orders follow "Correct and Efficient Work-Stealing for
+ * Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+ *
+ * T should be a pointer type, for the stealer reads the item before
+ * it actually wins the race. Arrays replaced on growth are kept until
+ * the deque is destroyed, since a stealer may still be reading them.
+ */
+template <typename T>
+class WorkStealingQueue : private boost::noncopyable
+{
+public:
+    /// Create a new deque.
+    /**
+     * @param capacity The initial capacity. Will be rounded up to power of 2.
+     */
+    explicit WorkStealingQueue(size_t capacity = 256);
+
+    /// Dispose the deque.
+    ~WorkStealingQueue();
+
+    /// Push an item at the bottom. Only the owner thread may call this.
+    void push(T item);
+
+    /// Pop an item from the bottom. Only the owner thread may call this.
+    /**
+     * @return false if the deque is empty.
+     */
+    bool pop(T& item);
+
+    /// Steal an item from the top. Any thread may call this.
+    /**
+     * @return false if the deque is empty or another thread won the race.
+     */
+    bool steal(T& item);
+
+    /// Whether the deque looks empty.
+    bool empty() const;
+
+    /// Approximate item count.
+    size_t size() const;
+
+protected:
+    /// The circular array.
+    class Array
+    {
+    public:
+        explicit Array(size_t capacity);
+        ~Array();
+
+        size_t capacity() const;
+        T get(boost::int64_t i) const;
+        void put(boost::int64_t i, T item);
+
+        /// Create a twice large array containing items in [top, bottom).
+        Array* grow(boost::int64_t bottom, boost::int64_t top) const;
+
+    protected:
+        size_t mask_;
+        boost::atomic<T>* items_;
+    };
+
+    /// The top index, increased by stealers.
+    boost::atomic<boost::int64_t> top_;
+
+    /// The bottom index, only written by the owner.
+    boost::atomic<boost::int64_t> bottom_;
+
+    /// The current array.
+    boost::atomic<Array*> array_;
+
+    /// The arrays replaced on growth.
+    std::vector<Array*> garbage_;
+};
+
+END_AVALON_NS2
+
+#include "workstealingqueue.tpl.h"
+
+#endif // THREAD_WORKSTEALINGQUEUE_H
@@ -0,0 +1,166 @@
+/*
+    <one line to give the program's name and a brief idea of what it does.>
+    Copyright (C) 2012  <copyright holder> <email>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef THREAD_WORKSTEALINGQUEUE_TPL_H
+#define THREAD_WORKSTEALINGQUEUE_TPL_H
+
+#include "workstealingqueue.h"
+
+BEGIN_AVALON_NS2(thread)
+
+template <typename T>
+WorkStealingQueue<T>::Array::Array(size_t capacity)
+ :  mask_(capacity - 1),
+    items_(new boost::atomic<T>[capacity])
+{
+}
+
+template <typename T>
+WorkStealingQueue<T>::Array::~Array()
+{
+    delete[] items_;
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::Array::capacity() const
+{
+    return mask_ + 1;
+}
+
+template <typename T>
+T WorkStealingQueue<T>::Array::get(boost::int64_t i) const
+{
+    return items_[i & mask_].load(boost::memory_order_relaxed);
+}
+
+template <typename T>
+void WorkStealingQueue<T>::Array::put(boost::int64_t i, T item)
+{
+    items_[i & mask_].store(item, boost::memory_order_relaxed);
+}
+
+template <typename T>
+typename WorkStealingQueue<T>::Array*
+WorkStealingQueue<T>::Array::grow(boost::int64_t bottom, boost::int64_t top) const
+{
+    Array* ret = new Array(capacity() << 1);
+    for (boost::int64_t i=top; i<bottom; i++) {
+        ret->put(i, get(i));
+    }
+    return ret;
+}
+
+template <typename T>
+WorkStealingQueue<T>::WorkStealingQueue(size_t capacity)
+ :  top_(0),
+    bottom_(0),
+    array_(NULL),
+    garbage_()
+{
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    array_.store(new Array(n), boost::memory_order_relaxed);
+}
+
+template <typename T>
+WorkStealingQueue<T>::~WorkStealingQueue()
+{
+    delete array_.load(boost::memory_order_relaxed);
+    for (size_t i=0; i<garbage_.size(); i++) {
+        delete garbage_[i];
+    }
+}
+
+template <typename T>
+void WorkStealingQueue<T>::push(T item)
+{
+    boost::int64_t b = bottom_.load(boost::memory_order_relaxed);
+    boost::int64_t t = top_.load(boost::memory_order_acquire);
+    Array* a = array_.load(boost::memory_order_relaxed);
+    if (b - t > (boost::int64_t)a->capacity() - 1) {
+        garbage_.push_back(a);
+        a = a->grow(b, t);
+        array_.store(a, boost::memory_order_release);
+    }
+    a->put(b, item);
+    boost::atomic_thread_fence(boost::memory_order_release);
+    bottom_.store(b + 1, boost::memory_order_relaxed);
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::pop(T& item)
+{
+    boost::int64_t b = bottom_.load(boost::memory_order_relaxed) - 1;
+    Array* a = array_.load(boost::memory_order_relaxed);
+    bottom_.store(b, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    boost::int64_t t = top_.load(boost::memory_order_relaxed);
+
+    if (t > b) {
+        // empty deque.
+        bottom_.store(b + 1, boost::memory_order_relaxed);
+        return false;
+    }
+
+    item = a->get(b);
+    if (t == b) {
+        // the last item, race against stealers.
+        bool won = top_.compare_exchange_strong(t, t + 1, boost::memory_order_seq_cst,
+                                                boost::memory_order_relaxed);
+        bottom_.store(b + 1, boost::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::steal(T& item)
+{
+    boost::int64_t t = top_.load(boost::memory_order_acquire);
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    boost::int64_t b = bottom_.load(boost::memory_order_acquire);
+    if (t >= b)
+        return false;
+
+    Array* a = array_.load(boost::memory_order_acquire);
+    T x = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, boost::memory_order_seq_cst,
+                                      boost::memory_order_relaxed))
+        return false;
+    item = x;
+    return true;
+}
+
+template <typename T>
+bool WorkStealingQueue<T>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename T>
+size_t WorkStealingQueue<T>::size() const
+{
+    boost::int64_t b = bottom_.load(boost::memory_order_relaxed);
+    boost::int64_t t = top_.load(boost::memory_order_relaxed);
+    return b > t ? (size_t)(b - t) : 0;
+}
+
+END_AVALON_NS2
+
+#endif // THREAD_WORKSTEALINGQUEUE_TPL_H